@@ -0,0 +1,581 @@
+#include "template.h"
+#include "zlib.h"
+#include "toojpeg.h"
+#include <map>
+
+// surface benchmarks: Tmpl8Headless -bench [-filter text] [-reps n] [-scalar] [-update] [-golden file]
+// Every case first runs once on fixed input; the crc32 of its output is compared with the golden
+// file, so an optimization that changes pixels fails the run. -update rewrites the golden file.
+// The case is then timed in batches of at least 2ms. Reported are the median throughput over
+// the batches in Mpixels/s and the interquartile range of the batches, relative to the median.
+// -scalar disables the SSE2/NEON row kernels; the output must not change.
+
+#ifndef TMPL8_BENCH_GOLDEN
+#define TMPL8_BENCH_GOLDEN "../app/src/bench/golden.txt"
+#endif
+
+struct BenchCase
+{
+	string name;
+	double pixels;				// pixels written per run, or other units
+	function<Surface*()> run;	// returns the surface to verify
+	const char* unit = "pix";	// what pixels counts
+};
+
+// deterministic input
+
+static uint seed;
+static uint Rand() { seed ^= seed << 13, seed ^= seed >> 17, seed ^= seed << 5; return seed; }
+
+static void Fill( Surface* s, uint fillSeed )
+{
+	seed = fillSeed;
+	for (int i = 0; i < s->width * s->height; i++) s->buffer[i] = Rand() & 0xffffff;
+}
+
+static void Fill( IndexedSurface* s, uint fillSeed )
+{
+	// random indices over a random palette; index 0 is the color key for keyed copies
+	seed = fillSeed;
+	for (int i = 0; i < 256; i++) s->palette[i] = Rand() & 0xffffff;
+	for (int y = 0; y < s->height; y++) for (int x = 0; x < s->width; x++) s->Set( x, y, Rand() >> 7 );
+}
+
+static Surface* SpriteImage( int w, int h, int frames )
+{
+	// per frame a disc with a hole, on a transparent (black) background
+	Surface* s = new Surface( w * frames, h );
+	Fill( s, 7 );
+	for (int f = 0; f < frames; f++) for (int y = 0; y < h; y++) for (int x = 0; x < w; x++)
+	{
+		const float dx = x + 0.5f - w * 0.5f, dy = y + 0.5f - h * 0.5f, r = sqrtf( dx * dx + dy * dy ) / (w * 0.5f);
+		Pixel& p = s->buffer[f * w + x + y * s->width];
+		if (r > 1 || r < 0.3f + 0.1f * f) p = 0; else p |= 0x010101;
+	}
+	return s;
+}
+
+static Font* MakeFont( const char* chars )
+{
+	// glyphs of 3 to 6 columns, separated by an empty column
+	const int n = (int)strlen( chars ), h = 10;
+	Surface* s = new Surface( n * 7, h );
+	s->Clear( 0 );
+	seed = 11;
+	for (int c = 0, x = 0; c < n; x += 3 + c % 4 + 1, c++) for (int y = 0; y < h; y++)
+		for (int u = 0; u < 3 + c % 4; u++) s->buffer[x + u + y * s->width] = (Rand() & 0x7f7f7f) | 0x010101;
+	return new Font( s, chars );
+}
+
+// golden file
+
+static map<string, uint> LoadGolden( const char* fileName )
+{
+	map<string, uint> golden;
+	FILE* f = fopen( fileName, "r" );
+	if (!f) return golden;
+	char name[128];
+	uint crc;
+	while (fscanf( f, "%127s %x", name, &crc ) == 2) golden[name] = crc;
+	fclose( f );
+	return golden;
+}
+
+static bool SaveGolden( const char* fileName, const map<string, uint>& golden )
+{
+	FILE* f = fopen( fileName, "w" );
+	if (!f) return false;
+	for (auto& g : golden) fprintf( f, "%s %08x\n", g.first.c_str(), g.second );
+	fclose( f );
+	return true;
+}
+
+// timing
+
+static double NowMs() { return chrono::duration<double, milli>( chrono::steady_clock::now().time_since_epoch() ).count(); }
+
+static void Measure( const BenchCase& c, int reps, double& median, double& spread )
+{
+	// calibrate the batch size, then time reps batches
+	int n = 1;
+	for (double t0 = NowMs(); ; n *= 2, t0 = NowMs())
+	{
+		for (int i = 0; i < n; i++) c.run();
+		if (NowMs() - t0 >= 2 || n >= (1 << 20)) break;
+	}
+	vector<double> perRun( reps );
+	for (int r = 0; r < reps; r++)
+	{
+		const double t0 = NowMs();
+		for (int i = 0; i < n; i++) c.run();
+		perRun[r] = (NowMs() - t0) / n;
+	}
+	sort( perRun.begin(), perRun.end() );
+	median = perRun[reps / 2];
+	spread = (perRun[(reps * 3) / 4] - perRun[reps / 4]) / median;
+}
+
+int RunBenchmarks( int argc, char** argv )
+{
+	const char* filter = "", * goldenFile = TMPL8_BENCH_GOLDEN;
+	int reps = 15;
+	bool update = false, scalar = false;
+	for (int i = 0; i < argc; i++)
+	{
+		const bool arg = i + 1 < argc;
+		if (!strcmp( argv[i], "-filter" ) && arg) filter = argv[++i];
+		else if (!strcmp( argv[i], "-reps" ) && arg) reps = max( 3, atoi( argv[++i] ) );
+		else if (!strcmp( argv[i], "-golden" ) && arg) goldenFile = argv[++i];
+		else if (!strcmp( argv[i], "-update" )) update = true;
+		else if (!strcmp( argv[i], "-scalar" )) scalar = true;
+		else { fprintf( stderr, "usage: -bench [-filter text] [-reps n] [-scalar] [-update] [-golden file]\n" ); return 2; }
+	}
+	map<string, uint> golden = LoadGolden( goldenFile );
+	char start[1024];
+	if (!getcwd( start, sizeof( start ) )) start[0] = 0;
+	const string goldenPath = goldenFile[0] == '/' ? string( goldenFile ) : string( start ) + "/" + goldenFile;
+	if (chdir( TMPL8_ASSETS ) != 0) fprintf( stderr, "can't open asset folder %s\n", TMPL8_ASSETS );
+	SelectRowKernels( !scalar );
+	Surface::InitCharset(); // there is no TemplateInit here
+	TooJpeg::useSimd( !scalar );
+	Profiler::enabled = false;
+	printf( "row kernels: %s, %d worker threads\n", rowKernels.name, JobManager::GetJobManager()->NumThreads() );
+	// targets and sources
+	Surface screen( 320, 192 ), large( 1024, 640 ), up( 640, 384 ), up4( 1280, 768 ), down( 160, 96 );
+	Surface src16( 16, 16 ), src64( 64, 64 ), src256( 256, 160 );
+	Fill( &src16, 3 ), Fill( &src64, 4 ), Fill( &src256, 5 );
+	Surface src1024( 1024, 640 ), tall( 64, 2048 ), strip( 64, 2 );
+	IndexedSurface idx8( 256, 160 ), idx4( 256, 160, 4 ), idx8large( 1024, 640 ), idx4large( 1024, 640, 4 );
+	Fill( &src1024, 6 ), Fill( &tall, 12 ), Fill( &idx8, 7 ), Fill( &idx4, 8 ), Fill( &idx8large, 9 ), Fill( &idx4large, 10 );
+	printf( "1024x640 memory: 32-bit %zu bytes, 8-bit %zu bytes, 4-bit %zu bytes\n",
+		(size_t)src1024.width * src1024.height * sizeof( Pixel ), idx8large.Bytes(), idx4large.Bytes() );
+	Sprite rle16( SpriteImage( 16, 16, 2 ), 2, true ), rle64( SpriteImage( 64, 64, 1 ), 1, true );
+	Sprite raw16( SpriteImage( 16, 16, 2 ), 2 ), raw64( SpriteImage( 64, 64, 1 ), 1 ), disc32( SpriteImage( 32, 32, 1 ), 1 );
+	Sprite mipped64( SpriteImage( 64, 64, 1 ), 1 );
+	mipped64.GetSurface()->BuildMips();
+	Font* font = MakeFont( "abcdefghijklmnopqrstuvwxyz0123456789.,:!?" );
+	char text[] = "the quick brown fox jumps over the lazy dog 0123456789";
+	const int textWidth = font->Width( text );
+	string longText;
+	while (longText.size() < 4096) longText += text;
+	longText.resize( 4096 );
+	int widthSum = 0; // keeps the Width calls from being optimized away
+	Surface* png = 0;
+	// a 64x64 tile map of 16x16 tiles in two layers: opaque tiles 0..31 below, tiles 32..63 with holes on top
+	Surface* tileStrip = new Surface( 64 * 16, 16 );
+	Fill( tileStrip, 11 );
+	for (int y = 0; y < 16; y++) for (int x = 0; x < 64 * 16; x++)
+	{
+		Pixel& p = tileStrip->buffer[x + y * tileStrip->width];
+		if (x >= 32 * 16 && ((x ^ y) & 4)) p = 0; else p |= 0x010101;
+	}
+	Sprite tileSprite( tileStrip, 64 ); // the same tiles, for drawing tile by tile
+	Tilemap tilemap( tileStrip, 16, 64, 64, 2 ), animap( tileStrip, 16, 64, 64, 2 );
+	for (int y = 0; y < 64; y++) for (int x = 0; x < 64; x++)
+	{
+		const ushort t0 = (ushort)(Rand() % 32), t1 = Rand() % 4 ? (ushort)Tilemap::EMPTY : (ushort)(32 + Rand() % 32);
+		tilemap.Set( 0, x, y, t0 ), tilemap.Set( 1, x, y, t1 ), animap.Set( 0, x, y, t0 ), animap.Set( 1, x, y, t1 );
+	}
+	for (ushort t = 0; t < 32; t += 8) animap.SetAnimation( t, 4, 1 );
+	int tileFrame = 0, mapFrame = 0, animFrame = 0, setFrame = 0;
+	auto tileByTile = [&]( int sx, int sy ) // draws the visible tiles of both layers with Sprite::Draw
+	{
+		for (int l = 0; l < 2; l++) for (int ty = sy / 16; ty <= (sy + 191) / 16; ty++) for (int tx = sx / 16; tx <= (sx + 319) / 16; tx++)
+		{
+			const ushort t = tilemap.Get( l, tx, ty );
+			if (t != Tilemap::EMPTY) tileSprite.Draw( &screen, tx * 16 - sx, ty * 16 - sy, t, 0 );
+		}
+		return &screen;
+	};
+	// 64k points in a box in front of a camera, as separate arrays and as vec4s; results are
+	// copied to a 64x64 surface as raw floats, so the golden checksums cover them
+	enum { POINTS = 65536 };
+	vector<float> px( POINTS ), py( POINTS ), pz( POINTS ), qx( POINTS ), qy( POINTS ), qz( POINTS );
+	vector<vec4> pv( POINTS ), qv( POINTS );
+	for (int i = 0; i < POINTS; i++)
+	{
+		px[i] = (Rand() % 2000) * 0.01f - 10, py[i] = (Rand() % 2000) * 0.01f - 10, pz[i] = (Rand() % 2000) * 0.01f + 20;
+		pv[i] = vec4( px[i], py[i], pz[i], 1 );
+	}
+	mat4 camera = mat4::translate( vec3( 0, 0, 5 ) ) * mat4::rotatey( 0.4f ) * mat4::rotatex( 0.2f ), projection;
+	projection.cell[0] = projection.cell[5] = 160, projection.cell[14] = 1, projection.cell[15] = 0;
+	const mat4 viewProjection = projection * camera;
+	Surface floats( 64, 64 );
+	auto keep = [&]( const void* data ) { memcpy( floats.buffer, data, 64 * 64 * sizeof( Pixel ) ); return &floats; };
+	vector<mat4> matrices( 1024 ), results( 1024 );
+	for (int i = 0; i < 1024; i++) matrices[i] = mat4::rotate( normalize( vec3( 1, (float)i, 2 ) ), i * 0.01f ) * mat4::translate( vec3( (float)i, 1, 2 ) );
+	// a game world of 64k entities and a 512x512 tile grid, saved as plain data arenas; 'moved'
+	// is a copy in which 1% of the entities change, for the deltas. Snapshot bytes and restored
+	// state are copied to the same 64x64 surface, after their size.
+	struct Entity { float x, y, vx, vy; uint sprite, flags, health, reserved; };
+	enum { ENTITIES = 65536, TILES = 512 * 512 };
+	vector<Entity> entities( ENTITIES ), restored;
+	vector<ushort> tiles( TILES ), restoredTiles;
+	for (Entity& e : entities) e = { (float)(Rand() % 4096), (float)(Rand() % 4096), (Rand() % 9) * 0.5f - 2, (Rand() % 9) * 0.5f - 2, Rand() % 48, Rand() % 4, 100, 0 };
+	for (ushort& t : tiles) t = (ushort)(Rand() % 8 ? Rand() % 4 : Rand() % 64);
+	vector<Entity> moved = entities;
+	vector<ushort> movedTiles = tiles;
+	Snapshot zlibState, lzmaState, movedState, restoredState;
+	zlibState.Add( "entities", entities ), zlibState.Add( "tiles", tiles );
+	lzmaState.Add( "tiles", tiles ), lzmaState.method = Snapshot::LZMA;
+	movedState.Add( "entities", moved ), movedState.Add( "tiles", movedTiles );
+	restoredState.Add( "entities", restored ), restoredState.Add( "tiles", restoredTiles );
+	const double stateBytes = (double)ENTITIES * sizeof( Entity ) + TILES * sizeof( ushort );
+	auto move = [&]() // the same changes every time
+	{
+		for (int i = 0; i < ENTITIES / 100; i++)
+		{
+			Entity& e = moved[(i * 7919) % ENTITIES];
+			e.x = (float)i, e.flags |= 8;
+		}
+		for (int i = 0; i < 64; i++) movedTiles[(i * 4099) % TILES] = 63;
+	};
+	vector<uchar> fullSave, lzmaSave, deltaSave, saved;
+	zlibState.Save( fullSave, true ), lzmaState.Save( lzmaSave, true ), movedState.Save( saved, true );
+	move(), movedState.Save( deltaSave );
+	printf( "%.1fMB game state: zlib %zu bytes, delta after 1%% moved %zu bytes; %zuKB tiles: lzma %zu bytes\n",
+		stateBytes / (1 << 20), fullSave.size(), deltaSave.size(), (size_t)TILES * sizeof( ushort ) / 1024, lzmaSave.size() );
+	auto keepBytes = [&]( const void* data, size_t size )
+	{
+		floats.Clear( 0 );
+		floats.buffer[0] = (Pixel)size;
+		memcpy( floats.buffer + 1, data, min( size, (size_t)64 * 64 * sizeof( Pixel ) - sizeof( Pixel ) ) );
+		return &floats;
+	};
+	// a game frame as JPEG: the original TooJpeg interface takes RGB bytes and calls back for every
+	// byte, the block interface takes the Pixels; both write the same file. Of the kept bytes,
+	// pixel 1 (the constant SOI marker) is replaced by the crc32 of the whole file.
+	Surface frame( "blueprint.png" );
+	vector<uchar> frameRGB( frame.width * frame.height * 3 );
+	for (int i = 0; i < frame.width * frame.height; i++)
+		frameRGB[i * 3] = (uchar)(frame.buffer[i] >> 16), frameRGB[i * 3 + 1] = (uchar)(frame.buffer[i] >> 8), frameRGB[i * 3 + 2] = (uchar)frame.buffer[i];
+	static vector<uchar> jpeg;
+	auto keepJpeg = [&]()
+	{
+		keepBytes( jpeg.data(), jpeg.size() );
+		floats.buffer[1] = (Pixel)crc32( 0, jpeg.data(), (uInt)jpeg.size() );
+		return &floats;
+	};
+	auto encodeJpeg = [&]( bool downSample )
+	{
+		jpeg.clear();
+		TooJpeg::writeJpeg( []( const uchar* bytes, uint count, void* ) { jpeg.insert( jpeg.end(), bytes, bytes + count ); },
+			0, frame.buffer, (ushort)frame.width, (ushort)frame.height, TooJpeg::BGRX, 90, downSample );
+		return keepJpeg();
+	};
+	// loading a file: the 1KB fread loop with a push_back per byte that loadBinaryFile used before
+	// Asset, the buffered AssetReader and a mapped Asset. Each reads a byte per 4KB page of the
+	// result, so that a mapping is paged in; the first 16KB are kept.
+	vector<uchar> loaded;
+	uint pageSum = 0; // keeps the page reads from being optimized away
+	auto keepLoaded = [&]( const uchar* data, size_t size )
+	{
+		for (size_t i = 0; i < size; i += 4096) pageSum += data[i];
+		return keepBytes( data, size );
+	};
+	const double assetBytes = (double)Asset( "blueprint.png" ).Size();
+	SpriteBatch batch;
+	batch.AddSprite( &rle16 );
+	seed = 13;
+	for (int i = 0; i < 10000; i++) batch.Add( (int)(Rand() % 336) - 16, (int)(Rand() % 208) - 16, 0, Rand() % 2 );
+	// short lines within the screen, long lines across it
+	vector<int> shortLines, longLines;
+	double shortPixels = 0, longPixels = 0;
+	seed = 17;
+	for (int i = 0; i < 256; i++)
+	{
+		const int x1 = 16 + Rand() % 288, y1 = 16 + Rand() % 160, x2 = x1 + (int)(Rand() % 31) - 15, y2 = y1 + (int)(Rand() % 31) - 15;
+		const int x3 = Rand() % 320, y3 = Rand() % 192, x4 = Rand() % 320, y4 = Rand() % 192;
+		shortLines.insert( shortLines.end(), { x1, y1, x2, y2 } ), longLines.insert( longLines.end(), { x3, y3, x4, y4 } );
+		shortPixels += max( abs( x2 - x1 ), abs( y2 - y1 ) ) + 1, longPixels += max( abs( x4 - x3 ), abs( y4 - y3 ) ) + 1;
+	}
+	// the same lines as floats for the batched calls, plus clipped lines and a closed
+	// polyline with fractional vertices (a wobbly circle)
+	vector<float> shortList( shortLines.begin(), shortLines.end() ), longList( longLines.begin(), longLines.end() ), clipList, poly;
+	for (int i = 0; i < 256; i++)
+		clipList.insert( clipList.end(), { (float)(Rand() % 960) - 320, (float)(Rand() % 576) - 192, (float)(Rand() % 960) - 320, (float)(Rand() % 576) - 192 } );
+	for (int i = 0; i < 1000; i++)
+	{
+		const float a = i * 6.2831853f / 1000, r = 80 + 10 * sinf( a * 37 );
+		poly.insert( poly.end(), { 160 + r * cosf( a ), 96 + r * sinf( a ) } );
+	}
+	// small triangles scattered over the screen, and two that cover it
+	vector<vec2> tris;
+	double triPixels = 0;
+	for (int i = 0; i < 1000; i++)
+	{
+		const float x = (float)(Rand() % 320), y = (float)(Rand() % 192);
+		const vec2 a( x, y ), b( x + (float)(Rand() % 1600) / 100, y + (float)(Rand() % 400) / 100 ), c( x + (float)(Rand() % 800) / 100, y + (float)(Rand() % 1600) / 100 );
+		tris.insert( tris.end(), { a, b, c } );
+		triPixels += fabsf( (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x) ) * 0.5f;
+	}
+	const vec2 full[4] = { vec2( 0, 0 ), vec2( 320, 0 ), vec2( 320, 192 ), vec2( 0, 192 ) };
+	auto triangles = [&]( int shading, int n )
+	{
+		const vec3 c0( 1, 0.5f, 0 ), c1( 0, 1, 0.5f ), c2( 0.5f, 0, 1 );
+		const vec2 t0( 0, 0 ), t1( 63, 7 ), t2( 9, 63 );
+		for (int i = 0; i < n * 3; i += 3)
+			if (shading == 0) screen.Triangle( tris[i], tris[i + 1], tris[i + 2], 0xff8040 );
+			else if (shading == 1) screen.Triangle( tris[i], tris[i + 1], tris[i + 2], c0, c1, c2 );
+			else screen.Triangle( tris[i], tris[i + 1], tris[i + 2], t0, t1, t2, &src64 );
+		return &screen;
+	};
+	auto cover = [&]( int shading )
+	{
+		for (int i = 0; i < 2; i++)
+		{
+			const vec2& a = full[0], & b = full[i + 1], & c = full[i + 2];
+			if (shading == 0) screen.Triangle( a, b, c, 0x4080ff );
+			else if (shading == 1) screen.Triangle( a, b, c, vec3( 1, 0, 0 ), vec3( 0, 1, 0 ), vec3( 0, 0, 1 ) );
+			else screen.Triangle( a, b, c, vec2( 0, 0 ), vec2( 64 * (i + 1) - 1, 63 * i ), vec2( 63 * (1 - i), 63 ), &src64 );
+		}
+		return &screen;
+	};
+	vec2 gon[16];
+	for (int i = 0; i < 16; i++) gon[i] = vec2( 20 * cosf( i * 0.3926991f ), 20 * sinf( i * 0.3926991f ) );
+	auto lines = []( Surface* s, const vector<int>& l ) { for (size_t i = 0; i < l.size(); i += 4) s->Line( (float)l[i], (float)l[i + 1], (float)l[i + 2], (float)l[i + 3], 0xffffff ); return s; };
+	auto grid = []( Surface* dst, Surface* src, bool blend ) // copies on a grid that covers the screen once
+	{
+		for (int y = 0; y + src->height <= dst->height; y += src->height) for (int x = 0; x + src->width <= dst->width; x += src->width)
+			if (blend) src->BlendCopyTo( dst, x, y ); else src->CopyTo( dst, x, y );
+		return dst;
+	};
+	auto igrid = [&]( IndexedSurface* src, bool keyed ) // grid() for indexed sources, at odd offsets for 4-bit nibbles
+	{
+		for (int y = 0; y + src->height <= large.height; y += src->height) for (int x = 0; x + src->width <= large.width; x += src->width)
+			if (keyed) src->CopyToKeyed( &large, x - 1, y ); else src->CopyTo( &large, x - 1, y );
+		return &large;
+	};
+	auto sprites = []( Surface* dst, Sprite& s, uint flags, int offset ) // a grid of sprites; offset > 0 clips the outer ring
+	{
+		const int w = s.GetWidth(), h = s.GetHeight();
+		for (int y = -offset; y + h <= dst->height + offset; y += h) for (int x = -offset; x + w <= dst->width + offset; x += w)
+			s.Draw( dst, x, y, 0, flags );
+		return dst;
+	};
+	auto spritePixels = []( Surface* dst, Sprite& s, int offset ) // visible area drawn by sprites()
+	{
+		double p = 0;
+		const int w = s.GetWidth(), h = s.GetHeight();
+		for (int y = -offset; y + h <= dst->height + offset; y += h) for (int x = -offset; x + w <= dst->width + offset; x += w)
+			p += (double)(min( x + w, dst->width ) - max( x, 0 )) * (min( y + h, dst->height ) - max( y, 0 ));
+		return p;
+	};
+	vector<BenchCase> cases = {
+		{ "clear/320x192", 320 * 192, [&] { screen.Clear( 0x204060 ); return &screen; } },
+		{ "clear/1024x640", 1024 * 640, [&] { large.Clear( 0x204060 ); return &large; } },
+		{ "bar/16", 16 * 16, [&] { large.Bar( 10, 10, 25, 25, 0xff8000 ); return &large; } },
+		{ "bar/64", 64 * 64, [&] { large.Bar( 10, 10, 73, 73, 0xff8000 ); return &large; } },
+		{ "bar/256", 256 * 256, [&] { large.Bar( 10, 10, 265, 265, 0xff8000 ); return &large; } },
+		{ "hline/16", 192 * 16, [&] { for (int y = 0; y < 192; y++) screen.HLine( y, y, 16, 0x00ff00 ); return &screen; } },
+		{ "hline/320", 192 * 320, [&] { for (int y = 0; y < 192; y++) screen.HLine( 0, y, 320, 0x00ff00 ); return &screen; } },
+		{ "vline/16", 320 * 16, [&] { for (int x = 0; x < 320; x++) screen.VLine( x, x % 176, 16, 0xff0000 ); return &screen; } },
+		{ "vline/192", 320 * 192, [&] { for (int x = 0; x < 320; x++) screen.VLine( x, 0, 192, 0xff0000 ); return &screen; } },
+		{ "line/short", shortPixels, [&] { return lines( &screen, shortLines ); } },
+		{ "line/long", longPixels, [&] { return lines( &screen, longLines ); } },
+		{ "line/long-aa", longPixels, [&] { for (size_t i = 0; i < longList.size(); i += 4) screen.LineAA( longList[i], longList[i + 1], longList[i + 2], longList[i + 3], 0xffffff ); return &screen; } },
+		{ "linelist/short", 256, [&] { screen.LineList( shortList.data(), 256, 0xffffff ); return &screen; }, "line" },
+		{ "linelist/long", 256, [&] { screen.LineList( longList.data(), 256, 0xffffff ); return &screen; }, "line" },
+		{ "linelist/clipped", 256, [&] { screen.LineList( clipList.data(), 256, 0xffffff ); return &screen; }, "line" },
+		{ "linelist/short-aa", 256, [&] { screen.LineList( shortList.data(), 256, 0xffffff, true ); return &screen; }, "line" },
+		{ "linelist/long-aa", 256, [&] { screen.LineList( longList.data(), 256, 0xffffff, true ); return &screen; }, "line" },
+		{ "polyline/1000", 1000, [&] { screen.Polyline( poly.data(), 1000, 0xffff00, true ); return &screen; }, "line" },
+		{ "polyline/1000-aa", 1000, [&] { screen.Polyline( poly.data(), 1000, 0xffff00, true, true ); return &screen; }, "line" },
+		{ "box/x100", 400, [&] { for (int i = 0; i < 100; i++) screen.Box( i, i % 90, 319 - i, 191 - i % 90, 0xff00ff ); return &screen; }, "line" },
+		{ "triangle/flat-x1000", triPixels, [&] { return triangles( 0, 1000 ); } },
+		{ "triangle/flat-x1000-tris", 1000, [&] { return triangles( 0, 1000 ); }, "tri" },
+		{ "triangle/gouraud-x1000", triPixels, [&] { return triangles( 1, 1000 ); } },
+		{ "triangle/textured-x1000", triPixels, [&] { return triangles( 2, 1000 ); } },
+		{ "triangle/flat-320x192", 320 * 192, [&] { return cover( 0 ); } },
+		{ "triangle/gouraud-320x192", 320 * 192, [&] { return cover( 1 ); } },
+		{ "triangle/textured-320x192", 320 * 192, [&] { return cover( 2 ); } },
+		{ "polygon/16-x60", 60 * 1250, [&]
+		{
+			for (int i = 0; i < 60; i++)
+			{
+				vec2 p[16];
+				for (int j = 0; j < 16; j++) p[j] = gon[j] + vec2( (float)(20 + (i * 47) % 280), (float)(20 + (i * 29) % 152) );
+				screen.Polygon( p, 16, 0x30c030 + i );
+			}
+			return &screen;
+		} },
+		{ "copy/16", 20 * 12 * 256, [&] { return grid( &screen, &src16, false ); } },
+		{ "copy/64", 5 * 3 * 4096, [&] { return grid( &screen, &src64, false ); } },
+		{ "copy/256x160", 4 * 4 * 256 * 160, [&] { return grid( &large, &src256, false ); } },
+		{ "copy/1024x640", 1024 * 640, [&] { src1024.CopyTo( &large, 0, 0 ); return &large; } },
+		{ "indexed/copy8-256x160", 4 * 4 * 256 * 160, [&] { return igrid( &idx8, false ); } },
+		{ "indexed/copy4-256x160", 4 * 4 * 256 * 160, [&] { return igrid( &idx4, false ); } },
+		{ "indexed/keyed8-256x160", 4 * 4 * 256 * 160, [&] { return igrid( &idx8, true ); } },
+		{ "indexed/keyed4-256x160", 4 * 4 * 256 * 160, [&] { return igrid( &idx4, true ); } },
+		{ "indexed/copy8-1024x640", 1024 * 640, [&] { idx8large.CopyTo( &large, 0, 0 ); return &large; } },
+		{ "indexed/copy4-1024x640", 1024 * 640, [&] { idx4large.CopyTo( &large, 0, 0 ); return &large; } },
+		{ "indexed/cycle8-1024x640", 1024 * 640, [&] // palette cycling costs a rotate, not a pixel pass
+		{
+			idx8large.CyclePalette( 16, 64 );
+			idx8large.CopyTo( &large, 0, 0 );
+			return &large;
+		} },
+		{ "blendcopy/16", 20 * 12 * 256, [&] { return grid( &screen, &src16, true ); } },
+		{ "blendcopy/64", 5 * 3 * 4096, [&] { return grid( &screen, &src64, true ); } },
+		{ "blendcopy/256x160", 4 * 4 * 256 * 160, [&] { return grid( &large, &src256, true ); } },
+		{ "resize/1024x640-320x192-nearest", 320 * 192, [&] { screen.Resize( &large, Surface::NEAREST ); return &screen; } },
+		{ "resize/1024x640-320x192-bilinear", 320 * 192, [&] { screen.Resize( &large, Surface::BILINEAR ); return &screen; } },
+		{ "resize/1024x640-320x192-box", 320 * 192, [&] { screen.Resize( &large, Surface::BOX ); return &screen; } },
+		{ "resize/64x2048-64x2-box", 64 * 2, [&] { strip.Resize( &tall, Surface::BOX ); return &strip; } }, // 1024 rows per pixel
+		{ "resize/320x192-160x96-bilinear", 160 * 96, [&] { down.Resize( &screen, Surface::BILINEAR ); return &down; } },
+		{ "resize/320x192-640x384-nearest", 640 * 384, [&] { up.Resize( &screen, Surface::NEAREST ); return &up; } },
+		{ "resize/320x192-640x384-bilinear", 640 * 384, [&] { up.Resize( &screen, Surface::BILINEAR ); return &up; } },
+		{ "resize/320x192-1280x768-nearest", 1280 * 768, [&] { up4.Resize( &screen, Surface::NEAREST ); return &up4; } },
+		{ "resize/320x192-1280x768-bilinear", 1280 * 768, [&] { up4.Resize( &screen, Surface::BILINEAR ); return &up4; } },
+		{ "mips/1024x640", 1024 * 640, [&] { large.BuildMips(); return large.Mip( 2 ); } },
+		{ "scalecolor/320x192", 320 * 192, [&] { screen.ScaleColor( 28 ); return &screen; } },
+		{ "sprite/16-rle", spritePixels( &screen, rle16, 0 ), [&] { return sprites( &screen, rle16, 0, 0 ); } },
+		{ "sprite/16-perpixel", spritePixels( &screen, raw16, 0 ), [&] { return sprites( &screen, raw16, 0, 0 ); } },
+		{ "sprite/64-rle", spritePixels( &screen, rle64, 0 ), [&] { return sprites( &screen, rle64, 0, 0 ); } },
+		{ "sprite/64-perpixel", spritePixels( &screen, raw64, 0 ), [&] { return sprites( &screen, raw64, 0, 0 ); } },
+		{ "sprite/16-flare-rle", spritePixels( &screen, rle16, 0 ), [&] { return sprites( &screen, rle16, Sprite::FLARE, 0 ); } },
+		{ "sprite/16-flare-perpixel", spritePixels( &screen, raw16, 0 ), [&] { return sprites( &screen, raw16, Sprite::FLARE, 0 ); } },
+		{ "sprite/64-clipped-rle", spritePixels( &screen, rle64, 40 ), [&] { return sprites( &screen, rle64, 0, 40 ); } },
+		{ "sprite/64-clipped-perpixel", spritePixels( &screen, raw64, 40 ), [&] { return sprites( &screen, raw64, 0, 40 ); } },
+		{ "drawscaled/64-128", 128 * 128, [&] { raw64.DrawScaled( 0, 0, 128, 128, &large ); return &large; } },
+		{ "drawscaled/16-48", 48 * 48, [&] { raw16.DrawScaled( 0, 0, 48, 48, &screen ); return &screen; } },
+		{ "transformed/32-x300", 300 * 48 * 48, [&] // 300 sprites at 1.5x, each at its own angle; partly clipped
+		{
+			for (int i = 0; i < 300; i++) disc32.DrawTransformed( &screen, (float)((i * 37) % 320), (float)((i * 53) % 192), i * 0.7f, 1.5f );
+			return &screen;
+		} },
+		{ "transformed/64-flip-flare", 64 * 64 * 4, [&]
+		{
+			for (int i = 0; i < 4; i++) raw64.DrawTransformed( &screen, 60.0f + i * 66, 96, 0.3f, i & 1 ? -1.0f : 1.0f, i & 2 ? -1.0f : 1.0f, 0, Sprite::FLARE );
+			return &screen;
+		} },
+		{ "transformed/64-mip-x40", 40 * 19 * 19, [&] // 40 sprites at 0.3x, drawn from the second mip level
+		{
+			for (int i = 0; i < 40; i++) mipped64.DrawTransformed( &screen, (float)(16 + (i * 37) % 288), (float)(16 + (i * 53) % 160), i * 0.7f, 0.3f );
+			return &screen;
+		} },
+		{ "print/builtin", 30 * 54 * 36, [&] { for (int y = 0; y < 180; y += 6) screen.Print( text, 0, y, 0xffffff ); return &screen; } },
+		{ "print/font", 18.0 * textWidth * font->Height(), [&] { for (int y = 0; y < 180; y += 10) font->Print( &large, text, 0, y ); return &large; } },
+		{ "print/font-clipped", 18.0 * textWidth * font->Height(), [&] { for (int y = -5; y < 200; y += 12) font->Print( &screen, text, (y & 31) - 20, y ); return &screen; } },
+		{ "font/width-4k", 4096, [&] { widthSum += font->Width( longText.data() ); return &screen; }, "char" },
+		{ "tilemap/tiles-320x192", 320 * 192, [&] { const int f = tileFrame++; return tileByTile( f * 3 % 704, f * 2 % 832 ); } },
+		{ "tilemap/cached-320x192", 320 * 192, [&] // scrolls, compositing a new row or column of chunks now and then
+		{
+			const int f = mapFrame++;
+			tilemap.Draw( &screen, f * 3 % 704, f * 2 % 832 );
+			return &screen;
+		} },
+		{ "tilemap/animated-320x192", 320 * 192, [&] // every call shows new frames of a quarter of the lower layer
+		{
+			animap.SetTime( ++animFrame );
+			animap.Draw( &screen, 100, 200 );
+			return &screen;
+		} },
+		{ "tilemap/set-x16", 320 * 192, [&] // changes 16 visible tiles per call
+		{
+			const int f = setFrame++;
+			for (int i = 0; i < 16; i++) tilemap.Set( 0, 10 + (i * 7 + f) % 20, 20 + (i * 5 + f) % 12, (ushort)((f + i) % 32) );
+			tilemap.Draw( &screen, 160, 320 );
+			return &screen;
+		} },
+		{ "transform/vec4-64k", POINTS, [&] { for (int i = 0; i < POINTS; i++) qv[i] = pv[i] * camera; return keep( qv.data() ); }, "pt" },
+		{ "transform/vec4-batch-64k", POINTS, [&] { TransformVectors( camera, pv.data(), qv.data(), POINTS ); return keep( qv.data() ); }, "pt" },
+		{ "transform/soa-64k", POINTS, [&]
+		{
+			TransformPoints( camera, px.data(), py.data(), pz.data(), qx.data(), qy.data(), qz.data(), POINTS );
+			return keep( qz.data() );
+		}, "pt" },
+		{ "project/vec4-64k", POINTS, [&] // one vector per call, then the perspective divide
+		{
+			for (int i = 0; i < POINTS; i++)
+			{
+				const vec4 p = pv[i] * viewProjection;
+				const float r = 1.0f / p.w;
+				qx[i] = p.x * r, qy[i] = p.y * r;
+			}
+			return keep( qy.data() );
+		}, "pt" },
+		{ "project/soa-64k", POINTS, [&] { ProjectPoints( viewProjection, px.data(), py.data(), pz.data(), qx.data(), qy.data(), POINTS ); return keep( qy.data() ); }, "pt" },
+		{ "mat4/mul-1k", 1024, [&] { for (int i = 0; i < 1024; i++) results[i] = matrices[i] * camera; return keep( results.data() ); }, "mat" },
+		{ "mat4/invert-1k", 1024, [&]
+		{
+			for (int i = 0; i < 1024; i++) results[i] = matrices[i], results[i].invert();
+			return keep( results.data() );
+		}, "mat" },
+		{ "snapshot/save-full-zlib", stateBytes, [&] { zlibState.Save( saved, true ); return keepBytes( saved.data(), saved.size() ); }, "B" },
+		{ "snapshot/save-full-lzma", TILES * sizeof( ushort ), [&] { lzmaState.Save( saved, true ); return keepBytes( saved.data(), saved.size() ); }, "B" },
+		{ "snapshot/save-delta-1%", stateBytes, [&] { move(), movedState.Save( saved ); return keepBytes( saved.data(), saved.size() ); }, "B" },
+		{ "snapshot/restore-full-zlib", stateBytes, [&]
+		{
+			restoredState.Restore( fullSave.data(), fullSave.size() );
+			return keepBytes( restored.data() + ENTITIES - 512, restored.size() * sizeof( Entity ) );
+		}, "B" },
+		{ "snapshot/restore-delta-1%", stateBytes, [&]
+		{
+			movedState.Restore( deltaSave.data(), deltaSave.size() );
+			return keepBytes( moved.data(), moved.size() * sizeof( Entity ) );
+		}, "B" },
+		{ "jpeg/320x192-bytes", 320 * 192, [&]
+		{
+			jpeg.clear();
+			TooJpeg::writeJpeg( []( uchar c ) { jpeg.push_back( c ); }, frameRGB.data(), (ushort)frame.width, (ushort)frame.height );
+			return keepJpeg();
+		} },
+		{ "jpeg/320x192-block", 320 * 192, [&] { return encodeJpeg( false ); } },
+		{ "jpeg/320x192-block-420", 320 * 192, [&] { return encodeJpeg( true ); } },
+		{ "spritebatch/10k-16", 10000 * 16 * 16, [&] { batch.Draw( &screen ); return &screen; } },
+		{ "asset/blueprint-fread", assetBytes, [&]
+		{
+			FILE* f = fopen( "blueprint.png", "rb" );
+			loaded.clear();
+			char t[1028];
+			while (!feof( f ))
+			{
+				uint bytes = (uint)fread( t, 1, 1024, f );
+				for (uint i = 0; i < bytes; i++) loaded.push_back( t[i] );
+			}
+			fclose( f );
+			return keepLoaded( loaded.data(), loaded.size() );
+		}, "B" },
+		{ "asset/blueprint-reader", assetBytes, [&]
+		{
+			AssetReader r( "blueprint.png" );
+			loaded.resize( r.Size() );
+			loaded.resize( r.Read( loaded.data(), loaded.size() ) );
+			return keepLoaded( loaded.data(), loaded.size() );
+		}, "B" },
+		{ "asset/blueprint-mapped", assetBytes, [&] { Asset a( "blueprint.png" ); return keepLoaded( a.Data(), a.Size() ); }, "B" },
+		{ "png/blueprint", 0, [&] { delete png; png = new Surface( "blueprint.png" ); return png; } },
+		{ "png/blueprint-decodepng", 0, [&] // the generic decoder and the repack, which the direct path replaces
+		{
+			delete png;
+			png = new Surface();
+			png->LoadPNGImage( "blueprint.png", false );
+			return png;
+		} },
+	};
+	png = new Surface( "blueprint.png" );
+	for (BenchCase& c : cases) if (c.name.compare( 0, 4, "png/" ) == 0) c.pixels = png->width * png->height;
+	// run
+	int failed = 0;
+	for (BenchCase& c : cases)
+	{
+		if (!strstr( c.name.c_str(), filter )) continue;
+		Fill( &screen, 1 ), Fill( &large, 2 ), Fill( &up, 1 ), Fill( &up4, 1 ), Fill( &down, 1 );
+		const Surface* out = c.run();
+		const uint crc = (uint)crc32( 0, (const Bytef*)out->buffer, out->width * out->height * sizeof( Pixel ) );
+		const char* status = "ok";
+		if (update) golden[c.name] = crc, status = "updated";
+		else if (!golden.count( c.name )) status = "no golden", failed++;
+		else if (golden[c.name] != crc) status = "MISMATCH", failed++;
+		double median, spread;
+		Measure( c, reps, median, spread );
+		const string unit = string( "M" ) + c.unit + "/s";
+		printf( "%-28s %9.1f %-7s iqr %5.1f%%  %9.3fus  %s\n", c.name.c_str(), c.pixels / (median * 1000), unit.c_str(), spread * 100, median * 1000, status );
+	}
+	delete png;
+	delete font;
+	if (update && !SaveGolden( goldenPath.c_str(), golden )) { fprintf( stderr, "can't write %s\n", goldenFile ); return 1; }
+	if (failed) printf( "%d case(s) do not match %s\n", failed, goldenFile );
+	return failed ? 1 : 0;
+}
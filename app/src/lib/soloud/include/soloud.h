@@ -164,6 +164,8 @@ namespace SoLoud
 		bool mInsideAudioThreadMutex;
 		// Called by SoLoud to shut down the back-end. If NULL, not called. Should be set by back-end.
 		soloudCallFunction mBackendCleanupFunc;
+		// Called before (true) and after (false) each mix, on the audio thread. If NULL, not called.
+		void (*mMixCallback)(bool aBegin);
 
 		// CTor
 		Soloud();
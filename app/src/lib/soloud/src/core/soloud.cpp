@@ -116,6 +116,7 @@ namespace SoLoud
 		mAudioThreadMutex = NULL;
 		mPostClipScaler = 0;
 		mBackendCleanupFunc = NULL;
+		mMixCallback = NULL;
 		mChannels = 2;		
 		mStreamTime = 0;
 		mLastClockedTime = 0;
@@ -2023,14 +2024,18 @@ namespace SoLoud
 
 	void Soloud::mix(float *aBuffer, unsigned int aSamples)
 	{
+		if (mMixCallback) mMixCallback(true);
 		mix_internal(aSamples);
 		interlace_samples_float(mScratch.mData, aBuffer, aSamples, mChannels);
+		if (mMixCallback) mMixCallback(false);
 	}
 
 	void Soloud::mixSigned16(short *aBuffer, unsigned int aSamples)
 	{
+		if (mMixCallback) mMixCallback(true);
 		mix_internal(aSamples);
 		interlace_samples_s16(mScratch.mData, aBuffer, aSamples, mChannels);
+		if (mMixCallback) mMixCallback(false);
 	}
 
 	void deinterlace_samples_float(const float *aSourceBuffer, float *aDestBuffer, unsigned int aSamples, unsigned int aChannels)
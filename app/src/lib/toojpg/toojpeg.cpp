@@ -6,6 +6,17 @@
 
 #include "toojpeg.h"
 
+// the only includes: SIMD intrinsics, if available
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define TOOJPEG_SSE2
+#define TOOJPEG_SIMD
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define TOOJPEG_NEON
+#define TOOJPEG_SIMD
+#endif
+
 // notes:
 // - the "official" specifications: https://www.w3.org/Graphics/JPEG/itu-t81.pdf and https://www.w3.org/Graphics/JPEG/jfif3.pdf
 // - a short documentation of the JFIF/JPEG file format can be found in the Wikipedia: https://en.wikipedia.org/wiki/JPEG_File_Interchange_Format
@@ -47,6 +58,107 @@ struct BitBuffer
   uint8_t  numBits;  // number of valid bits (the right-most bits)
 };
 
+// collect output bytes and pass them on in blocks, so that the callback isn't invoked for every single byte
+struct Output
+{
+  Output(TooJpeg::WRITE_BLOCK callback_, void* user_)
+  : callback(callback_), user(user_), used(0) {}
+  inline void operator()(uint8_t oneByte)
+  {
+    buffer[used++] = oneByte;
+    if (used == sizeof(buffer))
+      flush();
+  }
+  void flush()
+  {
+    if (used > 0)
+      callback(buffer, used, user);
+    used = 0;
+  }
+  TooJpeg::WRITE_BLOCK callback;
+  void*    user;
+  uint32_t used;           // number of bytes in buffer
+  uint8_t  buffer[2048];
+};
+
+// ////////////////////////////////////////
+// SIMD: four floats per register for DCT, quantization and colour conversion (SSE2 or NEON)
+// all floating-point operations happen in the same order as in the scalar code, therefore the JPEG is bit-identical
+#ifdef TOOJPEG_SSE2
+struct Quad { __m128 v; };
+inline Quad operator+(Quad a, Quad b)  { return { _mm_add_ps(a.v, b.v) }; }
+inline Quad operator-(Quad a, Quad b)  { return { _mm_sub_ps(a.v, b.v) }; }
+inline Quad operator*(Quad a, Quad b)  { return { _mm_mul_ps(a.v, b.v) }; }
+inline Quad operator*(Quad a, float b) { return { _mm_mul_ps(a.v, _mm_set1_ps(b)) }; }
+inline Quad operator*(float a, Quad b) { return { _mm_mul_ps(_mm_set1_ps(a), b.v) }; }
+inline Quad operator-(Quad a, float b) { return { _mm_sub_ps(a.v, _mm_set1_ps(b)) }; }
+inline Quad load (const float* data)   { return { _mm_loadu_ps(data) }; }
+inline void store(float* data, Quad a) { _mm_storeu_ps(data, a.v); }
+inline void transpose(Quad& a, Quad& b, Quad& c, Quad& d) { _MM_TRANSPOSE4_PS(a.v, b.v, c.v, d.v); }
+// round away from zero, like the scalar code, and store as 16 bit integers
+inline void storeRounded(int16_t* data, Quad a)
+{
+  auto positive = _mm_cmpgt_ps(a.v, _mm_setzero_ps());
+  auto half     = _mm_or_ps(_mm_and_ps(positive, _mm_set1_ps(+0.5f)), _mm_andnot_ps(positive, _mm_set1_ps(-0.5f)));
+  auto rounded  = _mm_cvttps_epi32(_mm_add_ps(a.v, half));
+  _mm_storel_epi64((__m128i*)data, _mm_packs_epi32(rounded, rounded));
+}
+// four pixels of 4 bytes each (B,G,R,unused) to floats
+inline void loadBGRX(const uint8_t* pixels, Quad& r, Quad& g, Quad& b)
+{
+  auto bgrx = _mm_loadu_si128((const __m128i*)pixels);
+  auto mask = _mm_set1_epi32(0xFF);
+  r = { _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(bgrx, 16), mask)) };
+  g = { _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(bgrx,  8), mask)) };
+  b = { _mm_cvtepi32_ps(_mm_and_si128(bgrx, mask)) };
+}
+// sums of neighbouring lanes: a0+a1, a2+a3, b0+b1, b2+b3
+inline Quad addPairs(Quad a, Quad b)
+{
+  return { _mm_add_ps(_mm_shuffle_ps(a.v, b.v, _MM_SHUFFLE(2,0,2,0)), _mm_shuffle_ps(a.v, b.v, _MM_SHUFFLE(3,1,3,1))) };
+}
+#elif defined(TOOJPEG_NEON)
+struct Quad { float32x4_t v; };
+inline Quad operator+(Quad a, Quad b)  { return { vaddq_f32(a.v, b.v) }; }
+inline Quad operator-(Quad a, Quad b)  { return { vsubq_f32(a.v, b.v) }; }
+inline Quad operator*(Quad a, Quad b)  { return { vmulq_f32(a.v, b.v) }; }
+inline Quad operator*(Quad a, float b) { return { vmulq_f32(a.v, vdupq_n_f32(b)) }; }
+inline Quad operator*(float a, Quad b) { return { vmulq_f32(vdupq_n_f32(a), b.v) }; }
+inline Quad operator-(Quad a, float b) { return { vsubq_f32(a.v, vdupq_n_f32(b)) }; }
+inline Quad load (const float* data)   { return { vld1q_f32(data) }; }
+inline void store(float* data, Quad a) { vst1q_f32(data, a.v); }
+inline void transpose(Quad& a, Quad& b, Quad& c, Quad& d)
+{
+  auto ab = vtrnq_f32(a.v, b.v); // a0 b0 a2 b2, a1 b1 a3 b3
+  auto cd = vtrnq_f32(c.v, d.v);
+  a = { vcombine_f32(vget_low_f32 (ab.val[0]), vget_low_f32 (cd.val[0])) };
+  b = { vcombine_f32(vget_low_f32 (ab.val[1]), vget_low_f32 (cd.val[1])) };
+  c = { vcombine_f32(vget_high_f32(ab.val[0]), vget_high_f32(cd.val[0])) };
+  d = { vcombine_f32(vget_high_f32(ab.val[1]), vget_high_f32(cd.val[1])) };
+}
+inline void storeRounded(int16_t* data, Quad a)
+{
+  auto half = vbslq_f32(vcgtq_f32(a.v, vdupq_n_f32(0)), vdupq_n_f32(+0.5f), vdupq_n_f32(-0.5f));
+  vst1_s16(data, vmovn_s32(vcvtq_s32_f32(vaddq_f32(a.v, half))));
+}
+inline void loadBGRX(const uint8_t* pixels, Quad& r, Quad& g, Quad& b)
+{
+  auto bgrx = vld1q_u32((const uint32_t*)pixels);
+  auto mask = vdupq_n_u32(0xFF);
+  r = { vcvtq_f32_u32(vandq_u32(vshrq_n_u32(bgrx, 16), mask)) };
+  g = { vcvtq_f32_u32(vandq_u32(vshrq_n_u32(bgrx,  8), mask)) };
+  b = { vcvtq_f32_u32(vandq_u32(bgrx, mask)) };
+}
+inline Quad addPairs(Quad a, Quad b)
+{
+  auto evenOdd = vuzpq_f32(a.v, b.v);
+  return { vaddq_f32(evenOdd.val[0], evenOdd.val[1]) };
+}
+#endif
+
+// can be switched off by TooJpeg::useSimd(false)
+static bool simd = true;
+
 // ////////////////////////////////////////
 // constants
 
@@ -82,7 +194,7 @@ inline Number clamp(Number value, Limit minimum, Limit maximum)
 }
 
 // start a new JFIF block
-inline void writeMarker(TooJpeg::WRITE_ONE_BYTE output, uint8_t id, uint16_t length)
+inline void writeMarker(Output& output, uint8_t id, uint16_t length)
 {
   output(0xFF); output(id);      // ID, always preceded by 0xFF
   output(uint8_t(length >> 8));  // length (big-endian)
@@ -90,7 +202,7 @@ inline void writeMarker(TooJpeg::WRITE_ONE_BYTE output, uint8_t id, uint16_t len
 }
 
 // write bits stored in BitCode, keep excess bits in BitBuffer
-inline void writeBits(TooJpeg::WRITE_ONE_BYTE output, BitBuffer& buffer, BitCode data)
+inline void writeBits(Output& output, BitBuffer& buffer, BitCode data)
 {
   // append the new bits to those bits leftover from previous call(s)
   buffer.numBits += data.numBits;
@@ -122,6 +234,11 @@ inline BitCode convertCode(int16_t value)
   BitCode result(value, 0);
 
   auto absolute = value < 0 ? -value : +value; // by the way: value is never zero
+#if defined(__GNUC__)
+  // find position of highest set bit, fast way for GCC and Clang
+  result.numBits = uint8_t(32 - __builtin_clz(absolute));
+  auto mask = (1 << result.numBits) - 1;
+#else
   auto mask = 0; // will be 2^numBits - 1
   // find position of highest set bit, fast way for GCC: result.numBits = 32 - __builtin_clz(value);
   while (absolute > mask)
@@ -129,6 +246,7 @@ inline BitCode convertCode(int16_t value)
     result.numBits++;
     mask = 2*mask + 1;   // append a set bit (numBits increased by one, so we need to update 2^numBits - 1)
   }
+#endif
 
   if (value < 0)
     result.code += mask; // remember: mask = 2^numBits - 1
@@ -136,7 +254,9 @@ inline BitCode convertCode(int16_t value)
 }
 
 // forward DCT computation (fast AAN algorithm: Arai, Agui and Nakajima: "A fast DCT-SQ scheme for images")
-inline void DCT(float* block, uint8_t stride) // stride = 1 or 8 (horizontal or vertical)
+// Value is a float or, for SIMD, a Quad (four rows or columns at once)
+template <typename Value>
+inline void DCT(Value* block, uint8_t stride) // stride = 1 or 8 (horizontal or vertical)
 {
   // modify in-place
   auto& block0 = block[0         ]; // same as 0 * stride
@@ -176,28 +296,85 @@ inline void DCT(float* block, uint8_t stride) // stride = 1 or 8 (horizontal or
   block5 = z7 + z2; block3 = z7 - z2;
 }
 
+#ifdef TOOJPEG_SIMD
+// same as the scalar DCT of rows and columns, followed by scaling and rounding
+void quantizeSimd(const float* block64, const float scaled[BlockSize], int16_t coefficients[BlockSize])
+{
+  // each row is split into two Quads: columns 0-3 and 4-7
+  Quad rows[8][2], columns[8][2];
+  for (auto row = 0; row < 8; row++)
+  {
+    rows[row][0] = load(block64 + row*8);
+    rows[row][1] = load(block64 + row*8 + 4);
+  }
+
+  // transpose 4x4 tiles so that each lane holds a different row, then the DCT of the rows is a "vertical" DCT of Quads
+  for (auto tileY = 0; tileY < 2; tileY++)
+    for (auto tileX = 0; tileX < 2; tileX++)
+    {
+      Quad a = rows[tileY*4][tileX], b = rows[tileY*4 + 1][tileX], c = rows[tileY*4 + 2][tileX], d = rows[tileY*4 + 3][tileX];
+      transpose(a, b, c, d);
+      columns[tileX*4][tileY] = a; columns[tileX*4 + 1][tileY] = b; columns[tileX*4 + 2][tileY] = c; columns[tileX*4 + 3][tileY] = d;
+    }
+  // DCT: rows
+  DCT(&columns[0][0], 2);
+  DCT(&columns[0][1], 2);
+
+  // and back
+  for (auto tileY = 0; tileY < 2; tileY++)
+    for (auto tileX = 0; tileX < 2; tileX++)
+    {
+      Quad a = columns[tileX*4][tileY], b = columns[tileX*4 + 1][tileY], c = columns[tileX*4 + 2][tileY], d = columns[tileX*4 + 3][tileY];
+      transpose(a, b, c, d);
+      rows[tileY*4][tileX] = a; rows[tileY*4 + 1][tileX] = b; rows[tileY*4 + 2][tileX] = c; rows[tileY*4 + 3][tileX] = d;
+    }
+  // DCT: columns
+  DCT(&rows[0][0], 2);
+  DCT(&rows[0][1], 2);
+
+  // scale and round
+  for (auto row = 0; row < 8; row++)
+  {
+    storeRounded(coefficients + row*8,     rows[row][0] * load(scaled + row*8));
+    storeRounded(coefficients + row*8 + 4, rows[row][1] * load(scaled + row*8 + 4));
+  }
+}
+#endif
+
 // process 8x8 block
-int16_t processDU(TooJpeg::WRITE_ONE_BYTE output, BitBuffer& buffer,
+int16_t processDU(Output& output, BitBuffer& buffer,
                   float block[8][8], const float scaled[BlockSize], int16_t lastDC,
                   const BitCode huffmanDC[256], const BitCode huffmanAC[256])
 {
   // "linearize" the 8x8 block, treat it as a flat array of 64 floats
   auto block64 = (float*) block;
 
-  // DCT: rows
-  for (auto offset = 0; offset < 8; offset++)
-    DCT(block64 + offset*8, 1);
-  // DCT: columns
-  for (auto offset = 0; offset < 8; offset++)
-    DCT(block64 + offset*1, 8);
+  // all 64 coefficients after DCT and quantization, still in their original order
+  int16_t coefficients[BlockSize];
+#ifdef TOOJPEG_SIMD
+  if (simd)
+    quantizeSimd(block64, scaled, coefficients);
+  else
+#endif
+  {
+    // DCT: rows
+    for (auto offset = 0; offset < 8; offset++)
+      DCT(block64 + offset*8, 1);
+    // DCT: columns
+    for (auto offset = 0; offset < 8; offset++)
+      DCT(block64 + offset*1, 8);
 
-  // scale
-  for (auto i = 0; i < BlockSize; i++)
-    block64[i] *= scaled[i];
+    // scale
+    for (auto i = 0; i < BlockSize; i++)
+      block64[i] *= scaled[i];
+
+    // round to nearest integer (actually, rounding is performed by casting from float to int16)
+    for (auto i = 0; i < BlockSize; i++)
+      coefficients[i] = (int16_t)(block64[i] + (block64[i] > 0 ? +0.5f : -0.5f)); // C++11's nearbyint() achieves a similar effect
+  }
 
   // encode DC (the first coefficient is the "average color" of the 8x8 block)
-  // convert to an integer
-  int16_t DC = (int16_t)(block64[0] + (block64[0] > 0 ? +0.5f : -0.5f)); // C++11's nearbyint() achieves a similar effect
+  int16_t DC = coefficients[0];
   // same "average color" as previous block ?
   if (DC == lastDC)
     writeBits(output, buffer, huffmanDC[0x00]); // yes, write a special short symbol
@@ -213,9 +390,7 @@ int16_t processDU(TooJpeg::WRITE_ONE_BYTE output, BitBuffer& buffer,
   int16_t quantized[BlockSize];
   for (auto i = 1; i < BlockSize; i++)
   {
-    auto value = block64[ZigZagInv[i]];
-    // round to nearest integer (actually, rounding is performed by casting from float to int16)
-    quantized[i] = (int16_t)(value + (value > 0 ? +0.5f : -0.5f)); // C++11's nearbyint() achieves a similar effect
+    quantized[i] = coefficients[ZigZagInv[i]];
     // remember offset of last non-zero coefficient
     if (quantized[i] != 0)
       posNonZero = i;
@@ -279,30 +454,41 @@ template <typename T>
 float rgb2cb(T r, T g, T b) { return -0.16874f * r -0.33126f * g +0.5f     * b; } // ITU: -0.168736f * r -0.331264f * g +0.5f      * b
 template <typename T>
 float rgb2cr(T r, T g, T b) { return +0.5f     * r -0.41869f * g -0.08131f * b; } // ITU: +0.5f      * r -0.418688f * g -0.081312f * b
+#ifdef TOOJPEG_SIMD
+inline Quad rgb2y (Quad r, Quad g, Quad b) { return +0.299f   * r +0.587f    * g +0.114f  * b; }
+inline Quad rgb2cb(Quad r, Quad g, Quad b) { return -0.16874f * r -0.33126f * g +0.5f     * b; }
+inline Quad rgb2cr(Quad r, Quad g, Quad b) { return +0.5f     * r -0.41869f * g -0.08131f * b; }
+#endif
 
 } // end of anonymous namespace
 
-// -------------------- the only externally visible function ... --------------------
+// -------------------- the only externally visible functions ... --------------------
 
 namespace TooJpeg
 {
 
-// handle       - callback that stores a single byte (writes to disk, memory, ...)
+// handle       - callback that stores a block of bytes (writes to disk, memory, ...)
+// user         - passed on to the callback
 // width,height - image size
-// pixels       - stored in RGB format or grayscale, stored from upper-left to lower-right
-// isRGB        - true if RGB format (3 bytes per pixel); false if grayscale (1 byte per pixel)
+// pixels       - stored in RGB format, BGRX format or grayscale, stored from upper-left to lower-right
+// format       - Grayscale (1 byte per pixel), RGB (3 bytes per pixel) or BGRX (4 bytes per pixel, the last one is ignored)
 // quality      - between 1 (worst) and 100 (best)
 // downSample   - if true then YCbCr 4:2:0 format is used (smaller size, minor quality loss) instead of 4:4:4, not relevant for grayscale
 // comment      - optional JPEG comment (0/NULL if no comment)
-bool writeJpeg(TooJpeg::WRITE_ONE_BYTE output, const void* pixels_, unsigned short width_, unsigned short height_,
-               bool isRGB, unsigned char quality_, bool downSample, const char* comment)
+bool writeJpeg(TooJpeg::WRITE_BLOCK callback, void* user, const void* pixels_, unsigned short width_, unsigned short height_,
+               Format format, unsigned char quality_, bool downSample, const char* comment)
 {
   // reject invalid pointers
-  if (!output || !pixels_)
+  if (!callback || !pixels_)
     return false;
   // check image format
   if (width_ == 0 || height_ == 0)
     return false;
+  if (format != Grayscale && format != RGB && format != BGRX)
+    return false;
+
+  // all bytes go through this buffer
+  Output output(callback, user);
 
   // quality level
   uint16_t quality = clamp(quality_, 1, 100);
@@ -310,7 +496,12 @@ bool writeJpeg(TooJpeg::WRITE_ONE_BYTE output, const void* pixels_, unsigned sho
   quality = quality < 50 ? 5000 / quality : 200 - quality * 2;
 
   // number of components
+  const auto isRGB         = format != Grayscale;
   const auto numComponents = isRGB ? 3 : 1;
+  // RGB and BGRX pixels: position of each colour
+  const auto bytesPerPixel = int(format);
+  const auto offsetRed     = format == BGRX ? 2 : 0;
+  const auto offsetBlue    = format == BGRX ? 0 : 2;
   // note: if there is just one component (=grayscale), then only luminance needs to be stored in the file
   //       thus everything related to chrominance need not to be written to the JPEG
   //       I still compute a few things, like quantization tables to avoid a complete code mess
@@ -563,6 +754,23 @@ bool writeJpeg(TooJpeg::WRITE_ONE_BYTE output, const void* pixels_, unsigned sho
       for (auto blockY = 0; blockY < 8 * sampling; blockY += 8) // these loops are iterated just once (grayscale, 4:4:4) or twice (4:2:0)
         for (auto blockX = 0; blockX < 8 * sampling; blockX += 8)
         {
+#ifdef TOOJPEG_SIMD
+          // BGRX blocks that are completely inside the image: four pixels at once
+          if (simd && format == BGRX && mcuX + blockX + 8 <= width && mcuY + blockY + 8 <= height)
+            for (auto deltaY = 0; deltaY < 8; deltaY++)
+              for (auto deltaX = 0; deltaX < 8; deltaX += 4)
+              {
+                Quad r, g, b;
+                loadBGRX(pixels + ((mcuY + deltaY + blockY) * width + mcuX + deltaX + blockX) * 4, r, g, b);
+                store(&Y[deltaY][deltaX], rgb2y(r, g, b) - 128);
+                if (isYCbCr444)
+                {
+                  store(&Cb[deltaY][deltaX], rgb2cb(r, g, b));
+                  store(&Cr[deltaY][deltaX], rgb2cr(r, g, b));
+                }
+              }
+          else
+#endif
           // now we finally have a 8x8 block ...
           for (auto deltaY = 0; deltaY < 8; deltaY++)
             for (auto deltaX = 0; deltaX < 8; deltaX++)
@@ -579,11 +787,11 @@ bool writeJpeg(TooJpeg::WRITE_ONE_BYTE output, const void* pixels_, unsigned sho
                 continue;
               }
 
-              // RGB: 3 bytes per pixel (whereas grayscale images have only 1 byte per pixel)
-              pixelPos *= numComponents;
-              auto r = pixels[pixelPos    ];
-              auto g = pixels[pixelPos + 1];
-              auto b = pixels[pixelPos + 2];
+              // RGB: 3 bytes per pixel, BGRX: 4 bytes per pixel (whereas grayscale images have only 1 byte per pixel)
+              pixelPos *= bytesPerPixel;
+              auto r = pixels[pixelPos + offsetRed ];
+              auto g = pixels[pixelPos + 1         ];
+              auto b = pixels[pixelPos + offsetBlue];
 
               Y   [deltaY][deltaX] = rgb2y (r, g, b) - 128; // again, the JPEG standard requires Y to be shifted by 128
               if (isYCbCr444)
@@ -607,6 +815,26 @@ bool writeJpeg(TooJpeg::WRITE_ONE_BYTE output, const void* pixels_, unsigned sho
       if (!downSample)
         continue;
 
+#ifdef TOOJPEG_SIMD
+      // BGRX: add four pixels from two lines, then pairs of those sums
+      if (simd && format == BGRX && mcuX + 16 <= width && mcuY + 16 <= height)
+        for (auto deltaY = 0; deltaY < 8; deltaY++)
+          for (auto deltaX = 0; deltaX < 8; deltaX += 4)
+          {
+            auto top = pixels + ((mcuY + 2*deltaY) * width + mcuX + 2*deltaX) * 4, bottom = top + width * 4;
+            Quad r[4], g[4], b[4];
+            loadBGRX(top,         r[0], g[0], b[0]);
+            loadBGRX(top    + 16, r[1], g[1], b[1]);
+            loadBGRX(bottom,      r[2], g[2], b[2]);
+            loadBGRX(bottom + 16, r[3], g[3], b[3]);
+            auto red   = addPairs(r[0] + r[2], r[1] + r[3]); // all sums are exact, so their order doesn't matter
+            auto green = addPairs(g[0] + g[2], g[1] + g[3]);
+            auto blue  = addPairs(b[0] + b[2], b[1] + b[3]);
+            store(&Cb[deltaY][deltaX], rgb2cb(red, green, blue) * 0.25f); // same as dividing by numSamples = 4
+            store(&Cr[deltaY][deltaX], rgb2cr(red, green, blue) * 0.25f);
+          }
+      else
+#endif
       // ////////////////////////////////////////
       // the following Cb+Cr code looks a bit more complicated because I have to average/downsample chrominance of four pixels
       for (auto deltaY = 0; deltaY < 8; deltaY++)
@@ -638,10 +866,10 @@ bool writeJpeg(TooJpeg::WRITE_ONE_BYTE output, const void* pixels_, unsigned sho
           auto numSamples = sampling * sampling; // = 2*2 = 4
           for (auto s = 0; s < numSamples; s++)
           {
-            auto pixelPosSample = (row * width + column + offsets[s]) * numComponents;
-            r += pixels[pixelPosSample    ];
-            g += pixels[pixelPosSample + 1];
-            b += pixels[pixelPosSample + 2];
+            auto pixelPosSample = (row * width + column + offsets[s]) * bytesPerPixel;
+            r += pixels[pixelPosSample + offsetRed ];
+            g += pixels[pixelPosSample + 1         ];
+            b += pixels[pixelPosSample + offsetBlue];
           }
 
           Cb[deltaY][deltaX] = rgb2cb(r, g, b) / numSamples;
@@ -659,7 +887,34 @@ bool writeJpeg(TooJpeg::WRITE_ONE_BYTE output, const void* pixels_, unsigned sho
   // ///////////////////////////
   // EOI marker
   output(0xFF); output(0xD9);
+  output.flush();
   return true;
 } // writeJpeg()
 
+// the original interface: one byte at a time
+static void writeBytes(const unsigned char* bytes, unsigned int numBytes, void* user)
+{
+  auto output = *(WRITE_ONE_BYTE*)user;
+  for (unsigned int i = 0; i < numBytes; i++)
+    output(bytes[i]);
+}
+
+bool writeJpeg(WRITE_ONE_BYTE output, const void* pixels, unsigned short width, unsigned short height,
+               bool isRGB, unsigned char quality, bool downSample, const char* comment)
+{
+  if (!output)
+    return false;
+  return writeJpeg(writeBytes, &output, pixels, width, height, isRGB ? RGB : Grayscale, quality, downSample, comment);
+}
+
+bool useSimd(bool enabled)
+{
+#ifdef TOOJPEG_SIMD
+  simd = enabled;
+#else
+  simd = false;
+#endif
+  return simd;
+}
+
 } // namespace TooJpeg
@@ -34,6 +34,21 @@ namespace TooJpeg
   // comment      - optional JPEG comment (0/NULL if no comment), must not contain ASCII code 0xFF
   bool writeJpeg(WRITE_ONE_BYTE output, const void* pixels, unsigned short width, unsigned short height,
                  bool isRGB = true, unsigned char quality = 90, bool downSample = false, const char* comment = 0);
+
+  // faster: write a block of up to 2048 bytes, user is the pointer passed to writeJpeg
+  typedef void (*WRITE_BLOCK)(const unsigned char* bytes, unsigned int numBytes, void* user);
+  // e.g. auto myOutput = [](const unsigned char* bytes, unsigned int numBytes, void* user) { fwrite(bytes, 1, numBytes, (FILE*)user); };
+
+  // pixel layouts: BGRX has 4 bytes per pixel (blue, green, red, ignored), i.e. 0x00RRGGBB words on little-endian CPUs
+  enum Format { Grayscale = 1, RGB = 3, BGRX = 4 };
+
+  // same as above, but the output is passed on in blocks and pixels may be BGRX
+  bool writeJpeg(WRITE_BLOCK output, void* user, const void* pixels, unsigned short width, unsigned short height,
+                 Format format = RGB, unsigned char quality = 90, bool downSample = false, const char* comment = 0);
+
+  // DCT, quantization and BGRX colour conversion use SSE2 or NEON where available, unless disabled here;
+  // the JPEG is the same either way. Returns true if SIMD is used.
+  bool useSimd(bool enabled);
 } // namespace TooJpeg
 
 // My main inspiration was Jon Olick's Minimalistic JPEG writer
@@ -0,0 +1,161 @@
+#include "template.h"
+
+#ifndef _WIN64
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// -----------------------------------------------------------
+// Memory mapped assets
+// -----------------------------------------------------------
+
+Asset::Asset( const char* fileName, bool searchPacks )
+{
+	const Pack::Entry* e = 0;
+	const Pack* pack = searchPacks ? Pack::Lookup( fileName, e ) : 0;
+	if (pack)
+	{
+		size = e->size;
+		if (e->method == Pack::STORE) data = pack->Data( e ), valid = true;
+		else if (pack->Extract( e, copy )) data = copy.data(), valid = true;
+		return;
+	}
+#ifdef _WIN64
+	file = CreateFileA( fileName, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0 );
+	if (file == INVALID_HANDLE_VALUE) return;
+	LARGE_INTEGER s;
+	GetFileSizeEx( file, &s );
+	size = (size_t)s.QuadPart, valid = true;
+	if (size > 0 && (mapping = CreateFileMappingA( file, 0, PAGE_READONLY, 0, 0, 0 )) != 0)
+		data = (const uchar*)MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 );
+#else
+#ifdef __ANDROID__
+	if (fileName[0] != '/')
+	{
+		// apk asset; stored (uncompressed) assets are mapped straight from the apk
+		AAsset* a = AAssetManager_open( android_get_asset_manager(), fileName, AASSET_MODE_BUFFER );
+		if (!a) return;
+		asset = a, valid = true;
+		size = (size_t)AAsset_getLength( a );
+		data = (const uchar*)AAsset_getBuffer( a );
+	}
+	else
+#endif
+	{
+		const int fd = open( fileName, O_RDONLY );
+		if (fd < 0) return;
+		struct stat st;
+		if (fstat( fd, &st ) == 0) size = (size_t)st.st_size, valid = true;
+		if (size > 0)
+		{
+			void* p = mmap( 0, size, PROT_READ, MAP_PRIVATE, fd, 0 );
+			if (p != MAP_FAILED) mapped = p, data = (const uchar*)p;
+		}
+		close( fd );
+	}
+#endif
+	if (valid && !data && size > 0) ReadAll( fileName );
+}
+
+Asset::~Asset()
+{
+#ifdef _WIN64
+	if (mapping) { if (data && data != copy.data()) UnmapViewOfFile( data ); CloseHandle( mapping ); }
+	if (file != INVALID_HANDLE_VALUE) CloseHandle( file );
+#else
+	if (mapped) munmap( mapped, size );
+#ifdef __ANDROID__
+	if (asset) AAsset_close( (AAsset*)asset );
+#endif
+#endif
+}
+
+void Asset::ReadAll( const char* fileName )
+{
+	// mapping failed; fall back to a single read into owned memory
+	AssetReader reader( fileName, 65536, false );
+	copy.resize( size );
+	size = reader.Read( copy.data(), size );
+	data = copy.data();
+}
+
+// -----------------------------------------------------------
+// Buffered streaming reader
+// -----------------------------------------------------------
+
+AssetReader::AssetReader( const char* fileName, size_t bufferSize, bool searchPacks )
+{
+	const Pack::Entry* e = 0;
+	if (searchPacks && Pack::Lookup( fileName, e ))
+	{
+		packed = new Asset( fileName );
+		size = packed->Size();
+		return;
+	}
+#ifdef _WIN64
+	f = fopen( fileName, "rb" );
+#else
+	f = fileName[0] == '/' ? fopen( fileName, "rb" ) : android_fopen( fileName, "rb" );
+#endif
+	if (!f) return;
+	fseek( f, 0, SEEK_END );
+	size = (size_t)ftell( f );
+	fseek( f, 0, SEEK_SET );
+	buffer.resize( bufferSize );
+}
+
+AssetReader::~AssetReader()
+{
+	if (f) fclose( f );
+	delete packed;
+}
+
+size_t AssetReader::Read( void* dst, size_t bytes )
+{
+	if (packed)
+	{
+		// pack entry: already in memory
+		const size_t n = min( bytes, size - pos );
+		memcpy( dst, packed->Data() + pos, n );
+		pos += n, avail = pos, done = pos == size;
+		return n;
+	}
+	if (!f) return 0;
+	uchar* d = (uchar*)dst;
+	size_t total = 0;
+	while (bytes > 0)
+	{
+		if (pos == avail)
+		{
+			if (done) break;
+			if (bytes >= buffer.size())
+			{
+				// large request: read straight into the destination
+				const size_t n = fread( d, 1, bytes, f );
+				total += n;
+				if (n < bytes) done = true;
+				break;
+			}
+			pos = 0, avail = fread( buffer.data(), 1, buffer.size(), f );
+			if (avail < buffer.size()) done = true;
+			if (avail == 0) break;
+		}
+		const size_t n = min( bytes, avail - pos );
+		memcpy( d, buffer.data() + pos, n );
+		pos += n, d += n, total += n, bytes -= n;
+	}
+	return total;
+}
+
+// -----------------------------------------------------------
+// SoLoud file interface
+// -----------------------------------------------------------
+
+unsigned int AssetFile::read( unsigned char* dst, unsigned int bytes )
+{
+	const size_t n = min( (size_t)bytes, asset.Size() - min( offset, asset.Size() ) );
+	if (n) memcpy( dst, asset.Data() + offset, n );
+	offset += n;
+	return (unsigned int)n;
+}
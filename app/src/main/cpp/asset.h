@@ -0,0 +1,72 @@
+#ifndef _ASSET_H
+#define _ASSET_H
+
+// read-only view of a complete file. Mounted packs are searched first; stored pack entries
+// are used in place, compressed ones are unpacked once. Otherwise, where possible the file is
+// memory mapped (MapViewOfFile on Windows, mmap for paths on Android/Linux, AAsset_getBuffer
+// for apk assets), so decoders read it without any copy. As a last resort the contents are
+// read once through an AssetReader.
+class Asset
+{
+public:
+	Asset( const char* fileName, bool searchPacks = true );
+	~Asset();
+	Asset( const Asset& ) = delete;
+	Asset& operator = ( const Asset& ) = delete;
+	const uchar* Data() const { return data; }
+	size_t Size() const { return size; }
+	bool IsValid() const { return valid; }
+	bool IsMapped() const { return data != 0 && data != copy.data(); }
+private:
+	void ReadAll( const char* fileName );
+	const uchar* data = 0;
+	size_t size = 0;
+	bool valid = false;
+#ifdef _WIN64
+	HANDLE file = INVALID_HANDLE_VALUE, mapping = 0;
+#else
+	void* mapped = 0;	// mmap'ed region
+	void* asset = 0;	// AAsset, on Android
+#endif
+	vector<uchar> copy;
+};
+
+// buffered sequential reader, for files that are consumed as a stream; pack entries are
+// read from the pack
+class AssetReader
+{
+public:
+	AssetReader( const char* fileName, size_t bufferSize = 65536, bool searchPacks = true );
+	~AssetReader();
+	bool IsValid() const { return f != 0 || (packed && packed->IsValid()); }
+	size_t Size() const { return size; }
+	size_t Read( void* dst, size_t bytes ); // returns the number of bytes read
+	bool Eof() const { return done && pos == avail; }
+private:
+	FILE* f = 0;
+	Asset* packed = 0;
+	vector<uchar> buffer;
+	size_t pos = 0, avail = 0, size = 0;
+	bool done = false;
+};
+
+// SoLoud file on top of an Asset, so audio sources load from packs and mapped files:
+// AssetFile f( "music.ogg" ); wav.loadFile( &f );
+// A WavStream reads from the file while playing, so keep the AssetFile alive until then.
+class AssetFile : public SoLoud::File
+{
+public:
+	AssetFile( const char* fileName ) : asset( fileName ) {}
+	int eof() { return offset >= asset.Size(); }
+	unsigned int read( unsigned char* dst, unsigned int bytes );
+	unsigned int length() { return (unsigned int)asset.Size(); }
+	void seek( int offset ) { this->offset = min( (size_t)max( 0, offset ), asset.Size() ); }
+	unsigned int pos() { return (unsigned int)offset; }
+	const unsigned char* getMemPtr() { return asset.Data(); }
+	bool IsValid() const { return asset.IsValid(); }
+private:
+	Asset asset;
+	size_t offset = 0;
+};
+
+#endif // _ASSET_H
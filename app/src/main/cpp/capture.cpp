@@ -0,0 +1,154 @@
+#include "template.h"
+#include "toojpeg.h"
+
+// -----------------------------------------------------------
+// Screenshots and frame capture
+// -----------------------------------------------------------
+
+bool Capture::Shot( const Surface* screen )
+{
+	return Grab( screen );
+}
+
+void Capture::Start( int n )
+{
+	lock_guard<mutex> l( lock );
+	every = max( 1, n ), frame = 0;
+}
+
+void Capture::Stop()
+{
+	{
+		lock_guard<mutex> l( lock );
+		every = 0;
+	}
+	wake.notify_one(); // write what is left
+}
+
+void Capture::Frame( const Surface* screen )
+{
+	if (every > 0 && frame++ % every == 0) Grab( screen );
+}
+
+bool Capture::Grab( const Surface* screen )
+{
+	PROFILE_ZONE( "Capture" );
+	Image* image;
+	{
+		lock_guard<mutex> l( lock );
+		if (!worker.joinable())
+		{
+			// first capture: start the worker; files of this run are named after the current time
+			const time_t now = ::time( 0 );
+			strftime( stamp, sizeof( stamp ), "%Y%m%d_%H%M%S", localtime( &now ) );
+			for (Image& i : images) pool.push_back( &i );
+			quit = false;
+			worker = thread( &Capture::WorkerMain, this );
+		}
+		if (pool.empty()) { dropped++; return false; }
+		image = pool.back(), pool.pop_back();
+		image->index = next++;
+		outstanding++;
+	}
+	// the copy is the only work on the calling thread
+	image->width = screen->width, image->height = screen->height;
+	image->pixels.assign( screen->buffer, screen->buffer + screen->width * screen->height );
+	{
+		lock_guard<mutex> l( lock );
+		queue.push_back( image );
+	}
+	wake.notify_one();
+	captured++;
+	return true;
+}
+
+void Capture::Flush()
+{
+	unique_lock<mutex> l( lock );
+	flushes++;
+	wake.notify_one();
+	done.wait( l, [this] { return outstanding == 0; } );
+	flushes--;
+}
+
+void Capture::Close()
+{
+	{
+		lock_guard<mutex> l( lock );
+		if (!worker.joinable()) return;
+		quit = true;
+	}
+	wake.notify_one();
+	worker.join();
+	worker = thread();
+	pool.clear();
+}
+
+void Capture::WorkerMain()
+{
+	unique_lock<mutex> l( lock );
+	while (1)
+	{
+		// a batch is written once it is large enough, or when no more frames are expected soon
+		wake.wait( l, [this] { return quit || !queue.empty() || (!files.empty() && (every == 0 || flushes > 0)); } );
+		if (!queue.empty())
+		{
+			Image* image = queue.front();
+			queue.pop_front();
+			l.unlock();
+			Encode( *image );
+			l.lock();
+			pool.push_back( image );
+		}
+		const bool idle = queue.empty() && (every == 0 || flushes > 0 || quit);
+		if (!files.empty() && (batch.size() >= batchBytes || idle))
+		{
+			l.unlock();
+			WriteBatch();
+			l.lock();
+			done.notify_all();
+		}
+		if (quit && queue.empty() && files.empty()) return;
+	}
+}
+
+void Capture::Encode( Image& image )
+{
+	PROFILE_ZONE( "CaptureEncode" );
+	const int64_t start = Profiler::Now();
+	const size_t offset = batch.size();
+	const bool ok = TooJpeg::writeJpeg( []( const uchar* bytes, uint count, void* user ) {
+		vector<uchar>* out = (vector<uchar>*)user;
+		out->insert( out->end(), bytes, bytes + count );
+	}, &batch, image.pixels.data(), (ushort)image.width, (ushort)image.height, TooJpeg::BGRX, (uchar)quality, downSample );
+	if (!ok) batch.resize( offset );
+	files.push_back( { image.index, offset, batch.size() - offset } );
+	const float ms = (Profiler::Now() - start) * 1e-6f;
+	encodeTime = encodeTime > 0 ? encodeTime * 0.9f + ms * 0.1f : ms;
+}
+
+void Capture::WriteBatch()
+{
+	PROFILE_ZONE( "CaptureWrite" );
+	uint ok = 0, bad = 0;
+	for (const File& f : files)
+	{
+		char index[16];
+		snprintf( index, sizeof( index ), "_%05u.jpg", f.index );
+		const string name = "/" + prefix + "_" + stamp + index;
+		FILE* file = f.size ? fopen( (folder + name).c_str(), "wb" ) : 0;
+		if (!file && f.size && !fallback.empty())
+		{
+			// e.g. no permission for DCIM: use the fallback from now on
+			folder = fallback, fallback.clear();
+			file = fopen( (folder + name).c_str(), "wb" );
+		}
+		bool stored = file && fwrite( batch.data() + f.offset, 1, f.size, file ) == f.size;
+		if (file) stored &= fclose( file ) == 0;
+		if (stored) ok++; else bad++;
+	}
+	batch.clear(), files.clear();
+	written += ok, failed += bad;
+	lock_guard<mutex> l( lock );
+	outstanding -= ok + bad;
+}
@@ -0,0 +1,57 @@
+#ifndef _CAPTURE_H
+#define _CAPTURE_H
+
+// screenshots and frame capture: Shot and Frame copy the screen into one of a few pooled
+// buffers and return; a worker thread encodes the copies to JPEG with TooJpeg. When every
+// buffer is in use, the frame is dropped from the capture, never from the game. Encoded files
+// are collected in memory and written together once batchBytes are pending, or as soon as
+// the worker is idle while not recording, so that storage sees a burst of writes every few
+// seconds instead of one file per frame. Files are named <prefix>_<start time>_<n>.jpg and go
+// to folder, or to fallback if folder can't be written (on Android: DCIM and the app's
+// internal data folder). Set these before the first capture.
+
+class Capture
+{
+public:
+	enum { BUFFERS = 8 };
+	~Capture() { Close(); }
+	bool Shot( const Surface* screen ); // false if no buffer is free
+	void Start( int every = 1 ); // capture every n-th frame passed to Frame
+	void Stop();
+	bool Recording() const { return every > 0; }
+	void Frame( const Surface* screen ); // called by the template every frame
+	void Flush(); // blocks until every captured frame is written
+	void Close(); // Flush, and stop the worker thread
+	uint Captured() const { return captured; }
+	uint Dropped() const { return dropped; }
+	uint Written() const { return written; }
+	uint Failed() const { return failed; } // frames that could not be encoded or written
+	float EncodeTime() const { return encodeTime; } // in ms, average over recent frames
+	string folder = ".", fallback, prefix = "tmpl8";
+	int quality = 90;
+	bool downSample = true; // 4:2:0 chroma: smaller files, and faster
+	size_t batchBytes = 1 << 20;
+private:
+	struct Image { vector<Pixel> pixels; int width, height; uint index; };
+	struct File { uint index; size_t offset, size; }; // size 0: encoding failed
+	bool Grab( const Surface* screen );
+	void WorkerMain();
+	void Encode( Image& image );
+	void WriteBatch();
+	Image images[BUFFERS];
+	vector<Image*> pool;
+	deque<Image*> queue;
+	vector<uchar> batch; // encoded files, owned by the worker
+	vector<File> files;
+	thread worker;
+	mutex lock;
+	condition_variable wake, done;
+	char stamp[32] = {};
+	int every = 0, flushes = 0;
+	uint frame = 0, next = 0, outstanding = 0; // outstanding: captured, but not yet written
+	atomic<uint> captured{ 0 }, dropped{ 0 }, written{ 0 }, failed{ 0 };
+	atomic<float> encodeTime{ 0 };
+	bool quit = false;
+};
+
+#endif // _CAPTURE_H
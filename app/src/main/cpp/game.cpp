@@ -1,27 +1,60 @@
 #include "template.h"
 
+Game::Game()
+{
+	// register the state that survives the app being stopped
+	snapshot.Add( "crosshairs", [this]( Snapshot::Stream& s ) { s.Write( cursorx ), s.Write( cursory ), s.Write( crossx ), s.Write( crossy ); },
+		[this]( Snapshot::Stream& s ) { return s.Read( cursorx ) && s.Read( cursory ) && s.Read( crossx ) && s.Read( crossy ); } );
+}
+
 void Game::Init()
 {
-	// load a sound and play it
-	std::vector<unsigned char> buffer;
-	loadBinaryFile( buffer, "coin.wav" );
-	sound.loadMem( buffer.data(), (int)buffer.size(), true, true );
-	loud.play( sound );
-	// load a png from the assets folder
-	bluePrint = new Surface( "blueprint.png" );
+	// load a sound in the background and play it once it is decoded
+	sound = loader->LoadWav( "coin.wav", 0, [this]( AssetLoader::Request& r ) {
+		if (r.state == AssetLoader::READY) loud.play( *(Wav*)r.object );
+	} );
+	// load a png from the assets folder; until it arrives, Get returns 0
+	bluePrint = loader->LoadSurface( "blueprint.png", 1 );
+}
+
+void Game::Step( const float stepTime )
+{
+	// the cross hairs follow the pen, closing half the distance every 1/30th of a second
+	lastx = crossx, lasty = crossy;
+	const float f = 1 - powf( 0.5f, stepTime / 33.3f );
+	crossx += ((cursorx * 320.0f) / scrwidth - crossx) * f;
+	crossy += ((cursory * 192.0f) / scrheight - crossy) * f;
 }
 
-void Game::Tick( const float deltaTime )
+void Game::Tick( const float deltaTime, const float alpha )
 {
+	// redraw only when something changed; frames without drawing are not uploaded or presented
+	int cx = (int)(lastx + (crossx - lastx) * alpha);
+	int cy = (int)(lasty + (crossy - lasty) * alpha);
+	Surface* s = bluePrint.Get();
+	if (cx == drawnx && cy == drawny && s == drawnImage && screen == drawnScreen) return;
+	drawnx = cx, drawny = cy, drawnImage = s, drawnScreen = screen;
 	// surface operation
-	bluePrint->CopyTo( screen, 0, 0 );
+	if (s) s->CopyTo( screen, 0, 0 ); else screen->Clear( 0 );
 	// cross hairs
-	int cx = (cursorx * 320) / scrwidth;
-	int cy = (cursory * 192) / scrheight;
 	if (cx >= 0 && cx < 320) screen->VLine( cx, 0, 192, 0xff0000 );
 	if (cy >= 0 && cy < 192) screen->HLine( 0, cy, 320, 0x00ff00 );
 }
 
+void Game::SaveState( void*& buffer, size_t& bufferSize )
+{
+	// usually a small delta against the last full snapshot, in snapshot.baseFile
+	vector<uchar> data;
+	if (!snapshot.Save( data ) || !(buffer = malloc( data.size() ))) return;
+	memcpy( buffer, data.data(), data.size() );
+	bufferSize = data.size();
+}
+
+void Game::RestoreState( const void* buffer, size_t bufferSize )
+{
+	if (snapshot.Restore( buffer, bufferSize )) lastx = crossx, lasty = crossy;
+}
+
 void Game::Shutdown()
 {
 }
\ No newline at end of file
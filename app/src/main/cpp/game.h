@@ -4,26 +4,35 @@
 class Game
 {
 public:
-	Game() = default;
+	Game();
 	void Init();
-	void Tick( const float deltaTime );
+	void Step( const float stepTime ); // advances the simulation by stepTime ms, at GameLoop::stepRate
+	// draws a frame; deltaTime: duration of the previous frame, in ms; alpha: fraction of a step by which this frame lags the next simulation state
+	void Tick( const float deltaTime, const float alpha );
 	void Shutdown();
 	void PenPos( const int x, const int y ) { cursorx = x, cursory = y; }
 	void PenDown() { pendown = true; }
 	void PenUp() { pendown = false; }
-	void SaveState( void* buffer, size_t& bufferSize ) { /* nothing here yet */ }
-	void RestoreState( void* buffer, size_t bufferSize ) { /* nothing here yet */ }
+	void SaveState( void*& buffer, size_t& bufferSize ); // buffer: allocated with malloc
+	void RestoreState( const void* buffer, size_t bufferSize );
 	void SetScreenSize( const int w, const int h ) { scrwidth = w, scrheight = h; }
 public:
 	Surface* screen;
+	Renderer* renderer; // draws to screen; immediate by default, see Renderer::SetDeferred
+	AssetLoader* loader = 0; // background asset loading, updated before each Tick
 	Soloud loud;
+	Snapshot snapshot; // the state that SaveState and RestoreState keep
+	Capture capture; // screenshots and recording, encoded in the background
 private:
 	int cursorx = 0, cursory = 0;
+	float crossx = 0, crossy = 0, lastx = 0, lasty = 0;	// simulated cross hairs, this and the previous step
 	bool pendown = false;
 	int scrwidth = 1, scrheight = 1;
+	int drawnx = -1, drawny = -1;			// state of the last drawn frame
+	Surface* drawnImage = 0, * drawnScreen = 0;
 	GLuint pixels = -1, shader = -1, post = -1;
-	SoLoud::Wav sound;
-	Surface* bluePrint = 0;
+	AssetLoader::Handle<SoLoud::Wav> sound;
+	AssetLoader::Handle<Surface> bluePrint;
 };
 
 #endif // _GAME_H
@@ -0,0 +1,71 @@
+#include "template.h"
+
+// -----------------------------------------------------------
+// Game loop timing
+// -----------------------------------------------------------
+
+int GameLoop::Advance( float frameTime )
+{
+	if (stepRate <= 0)
+	{
+		// variable step: one step of the frame time, nothing left to interpolate
+		stepTime = frameTime, alpha = 1;
+		return 1;
+	}
+	stepTime = 1000.0f / stepRate;
+	accumulator += frameTime;
+	int steps = (int)(accumulator / stepTime);
+	clampedNow = steps > maxSteps;
+	if (clampedNow) steps = maxSteps;
+	accumulator -= steps * (double)stepTime;
+	// past the guard, drop the time that could not be simulated
+	if (accumulator >= stepTime) accumulator = fmod( accumulator, (double)stepTime );
+	alpha = (float)(accumulator / stepTime);
+	return steps;
+}
+
+void GameLoop::Pace( float elapsed, bool presented )
+{
+	// frames that were not presented wait for a 60Hz period even when unpaced, so that
+	// idle frames do not spin. Sleep coarsely, then yield for the last millisecond.
+	const float rate = targetRate > 0 ? targetRate : presented ? 0 : 60;
+	if (rate <= 0) return;
+	const int64_t end = Profiler::Now() + (int64_t)((1000.0f / rate - elapsed) * 1e6f);
+	const int64_t coarse = end - Profiler::Now() - 1000000;
+	if (coarse > 0) this_thread::sleep_for( chrono::nanoseconds( coarse ) );
+	while (Profiler::Now() < end) this_thread::yield();
+}
+
+int GameLoop::SwapInterval( float displayRate )
+{
+	// the whole number of refreshes per frame closest to the target; at least 1
+	if (targetRate <= 0 || displayRate <= 0) return 1;
+	return max( 1, (int)(displayRate / targetRate + 0.5f) );
+}
+
+void GameLoop::FrameDone( float ms )
+{
+	frameTime[frameCount % HISTORY] = ms;
+	clamped[frameCount++ % HISTORY] = clampedNow;
+	clampedNow = false;
+}
+
+GameLoop::Stats GameLoop::GetStats()
+{
+	Stats s = {};
+	const int n = (int)min( frameCount, (uint)HISTORY );
+	if (n == 0) return s;
+	const float period = targetRate > 0 ? 1000.0f / targetRate : 1000.0f / 60;
+	double sum = 0, sum2 = 0;
+	for (int i = 0; i < n; i++)
+	{
+		const float t = frameTime[i];
+		sum += t, sum2 += (double)t * t;
+		s.worst = max( s.worst, t );
+		s.missed += t > period * 1.5f;
+		s.clamped += clamped[i];
+	}
+	s.mean = (float)(sum / n);
+	s.jitter = (float)sqrt( max( 0.0, sum2 / n - (sum / n) * (sum / n) ) );
+	return s;
+}
@@ -0,0 +1,41 @@
+#ifndef _GAMELOOP_H
+#define _GAMELOOP_H
+
+// game loop timing: the simulation advances in fixed steps of 1000 / stepRate ms, independent
+// of the display. Each frame, Advance adds the frame time to an accumulator and returns the
+// number of steps to run; the remainder becomes Alpha, the fraction of a step by which the
+// rendered frame lags the next simulation state, for interpolating between the last two.
+// No more than maxSteps steps run per frame: a device that cannot keep up slows the game
+// down, instead of spending ever more time catching up (the 'spiral of death'). Pace waits
+// until a frame period for targetRate has passed; SwapInterval picks the vsync interval that
+// approximates targetRate on a display. Frame times are kept for the jitter statistics that
+// the profiler overlay shows. stepRate 0 runs one step per frame, of the frame time.
+
+class GameLoop
+{
+public:
+	enum { HISTORY = 128 };
+	struct Stats
+	{
+		float mean, jitter, worst; // frame time average, standard deviation and maximum, in ms
+		int missed, clamped; // frames over 1.5 target periods; frames that hit maxSteps
+	};
+	static int Advance( float frameTime ); // frameTime in ms; returns the number of steps to run
+	static float StepTime() { return stepTime; } // duration of a step, in ms
+	static float Alpha() { return alpha; }
+	static void Pace( float elapsed, bool presented ); // elapsed: ms since the start of the frame
+	static int SwapInterval( float displayRate );
+	static void FrameDone( float frameTime ); // frameTime in ms, including pacing
+	static Stats GetStats(); // over the last HISTORY frames
+	inline static float stepRate = 60, targetRate = 60; // in Hz; targetRate 30, 60, 90 or 120, 0 is unpaced
+	inline static int maxSteps = 5;
+private:
+	inline static double accumulator = 0;
+	inline static float stepTime = 1000.0f / 60, alpha = 0;
+	inline static float frameTime[HISTORY] = {};
+	inline static bool clamped[HISTORY] = {};
+	inline static bool clampedNow = false;
+	inline static uint frameCount = 0;
+};
+
+#endif // _GAMELOOP_H
@@ -0,0 +1,97 @@
+#include "template.h"
+
+// -----------------------------------------------------------
+// Work-stealing job manager
+// -----------------------------------------------------------
+
+JobManager* JobManager::GetJobManager()
+{
+	static JobManager manager;
+	return &manager;
+}
+
+JobManager::JobManager( int threads )
+{
+	if (threads <= 0) threads = max( 1, (int)thread::hardware_concurrency() );
+	for (int i = 0; i < threads; i++) queues.push_back( new Queue );
+	for (int i = 0; i < threads - 1; i++) workers.push_back( thread( &JobManager::WorkerMain, this, i ) );
+}
+
+JobManager::~JobManager()
+{
+	{
+		lock_guard<mutex> l( lock );
+		quit = true;
+	}
+	wake.notify_all();
+	for (auto& w : workers) w.join();
+	for (auto q : queues) delete q;
+}
+
+void JobManager::AddJob( Job* job )
+{
+	// distribute round-robin; stealing evens out the rest
+	Queue* q = queues[next++ % queues.size()];
+	lock_guard<mutex> l( q->lock );
+	q->jobs.push_back( job );
+	pending++;
+}
+
+Job* JobManager::Fetch( int idx )
+{
+	// own queue first (front), then steal from the back of the others
+	const int N = (int)queues.size();
+	for (int i = 0; i < N; i++)
+	{
+		Queue* q = queues[(idx + i) % N];
+		lock_guard<mutex> l( q->lock );
+		if (q->jobs.empty()) continue;
+		Job* job;
+		if (i == 0) job = q->jobs.front(), q->jobs.pop_front();
+		else job = q->jobs.back(), q->jobs.pop_back();
+		return job;
+	}
+	return 0;
+}
+
+void JobManager::WorkerMain( int idx )
+{
+	uint seen = 0;
+	while (1)
+	{
+		{
+			unique_lock<mutex> l( lock );
+			wake.wait( l, [&] { return quit || generation != seen; } );
+			if (quit) return;
+			seen = generation;
+		}
+		while (Job* job = Fetch( idx ))
+		{
+			job->Main();
+			if (--pending == 0)
+			{
+				lock_guard<mutex> l( lock );
+				done.notify_all();
+			}
+		}
+	}
+}
+
+void JobManager::RunJobs()
+{
+	if (pending == 0) return;
+	{
+		lock_guard<mutex> l( lock );
+		generation++;
+	}
+	wake.notify_all();
+	// the calling thread works on the last queue
+	while (Job* job = Fetch( (int)queues.size() - 1 ))
+	{
+		job->Main();
+		pending--;
+	}
+	unique_lock<mutex> l( lock );
+	done.wait( l, [&] { return pending == 0; } );
+	next = 0;
+}
@@ -0,0 +1,37 @@
+#ifndef _JOBS_H
+#define _JOBS_H
+
+// job system: jobs are queued from the main thread and executed by a pool of worker threads
+// plus the caller of RunJobs. Each thread owns a queue; idle threads steal from the back of
+// the other queues, so uneven jobs (e.g. busy screen tiles) still balance out.
+
+class Job
+{
+public:
+	virtual ~Job() = default;
+	virtual void Main() = 0;
+};
+
+class JobManager
+{
+public:
+	static JobManager* GetJobManager();
+	JobManager( int threads = 0 ); // 0: one thread per core, including the calling thread
+	~JobManager();
+	void AddJob( Job* job );
+	void RunJobs(); // executes all queued jobs; returns when they are done
+	int NumThreads() const { return (int)queues.size(); }
+private:
+	struct Queue { mutex lock; deque<Job*> jobs; };
+	void WorkerMain( int idx );
+	Job* Fetch( int idx );
+	vector<Queue*> queues; // the last queue belongs to the thread calling RunJobs
+	vector<thread> workers;
+	atomic<int> pending{ 0 };
+	mutex lock;
+	condition_variable wake, done;
+	uint generation = 0, next = 0;
+	bool quit = false;
+};
+
+#endif // _JOBS_H
@@ -0,0 +1,204 @@
+#include "template.h"
+
+// -----------------------------------------------------------
+// Asynchronous asset loader
+// -----------------------------------------------------------
+
+void AssetLoader::Request::Cancel()
+{
+	// a request that already completed belongs to the caller; cancel has no effect then
+	int s = state;
+	while (s < READY && !state.compare_exchange_weak( s, CANCELED ));
+}
+
+AssetLoader::AssetLoader( int threads )
+{
+	for (int i = 0; i < threads; i++) workers.emplace_back( &AssetLoader::WorkerMain, this );
+}
+
+AssetLoader::~AssetLoader()
+{
+	{
+		lock_guard<mutex> l( lock );
+		quit = true;
+	}
+	wake.notify_all();
+	for (thread& t : workers) t.join();
+	// discard whatever did not complete
+	while (!queue.empty()) Discard( *queue.top() ), queue.pop();
+	for (auto& r : loaded) Discard( *r );
+}
+
+AssetLoader::Handle<Surface> AssetLoader::LoadSurface( const char* file, int priority, Callback cb )
+{
+	return Submit( SURFACE, file, 0, priority, cb );
+}
+
+AssetLoader::Handle<GLuint> AssetLoader::LoadTexture( const char* file, int priority, Callback cb )
+{
+	return Submit( TEXTURE, file, 0, priority, cb );
+}
+
+AssetLoader::Handle<Sprite> AssetLoader::LoadSprite( Handle<Surface> surface, uint frames, int priority, Callback cb )
+{
+	shared_ptr<Request> r = Submit( SPRITE, "", surface.request, priority, cb );
+	r->frames = frames;
+	return r;
+}
+
+AssetLoader::Handle<Font> AssetLoader::LoadFont( Handle<Surface> surface, const char* chars, int priority, Callback cb )
+{
+	shared_ptr<Request> r = Submit( FONT, "", surface.request, priority, cb );
+	r->chars = chars;
+	return r;
+}
+
+AssetLoader::Handle<SoLoud::Wav> AssetLoader::LoadWav( const char* file, int priority, Callback cb )
+{
+	return Submit( WAV, file, 0, priority, cb );
+}
+
+shared_ptr<AssetLoader::Request> AssetLoader::Submit( int type, const char* file, shared_ptr<Request> dependency, int priority, Callback cb )
+{
+	shared_ptr<Request> r = make_shared<Request>();
+	r->type = type, r->priority = priority, r->seq = seq++;
+	r->file = file, r->dependency = dependency, r->callback = cb;
+	pending++;
+	// dependents wait on the main thread until Update sees their dependency ready
+	if (dependency) waiting.push_back( r ); else Enqueue( r );
+	return r;
+}
+
+void AssetLoader::Enqueue( const shared_ptr<Request>& r )
+{
+	{
+		lock_guard<mutex> l( lock );
+		queue.push( r );
+	}
+	wake.notify_one();
+}
+
+void AssetLoader::WorkerMain()
+{
+	while (1)
+	{
+		shared_ptr<Request> r;
+		{
+			unique_lock<mutex> l( lock );
+			wake.wait( l, [this] { return quit || !queue.empty(); } );
+			if (quit) return;
+			r = queue.top();
+			queue.pop();
+		}
+		int s = QUEUED;
+		if (r->state.compare_exchange_strong( s, LOADING ))
+		{
+			PROFILE_ZONE( "Load" );
+			Decode( *r );
+			s = LOADING;
+			r->state.compare_exchange_strong( s, LOADED ); // fails if canceled meanwhile
+		}
+		// every request is retired on the main thread, including canceled ones
+		lock_guard<mutex> l( lock );
+		loaded.push_back( r );
+	}
+}
+
+void AssetLoader::Decode( Request& r )
+{
+	// worker thread: file access and decoding only, no GL or SoLoud engine calls
+	switch (r.type)
+	{
+	case SURFACE:
+	case TEXTURE:
+	{
+		Surface* s = new Surface( r.file.c_str() );
+		if (s->buffer) r.object = s; else delete s;
+		break;
+	}
+	case SPRITE:
+		r.object = new Sprite( r.source, r.frames, true ), r.source = 0;
+		break;
+	case FONT:
+		r.object = new Font( r.source, r.chars.c_str() ), r.source = 0;
+		break;
+	case WAV:
+	{
+		Asset a( r.file.c_str() );
+		Wav* w = new Wav;
+		if (a.IsValid() && w->loadMem( a.Data(), (uint)a.Size(), false, false ) == SO_NO_ERROR) r.object = w; else delete w;
+		break;
+	}
+	}
+}
+
+void AssetLoader::Discard( Request& r )
+{
+	delete r.source;
+	r.source = 0;
+	if (!r.object) return;
+	switch (r.type)
+	{
+	case SURFACE: case TEXTURE: delete (Surface*)r.object; break;
+	case SPRITE: delete (Sprite*)r.object; break;
+	case FONT: delete (Font*)r.object; break;
+	case WAV: delete (Wav*)r.object; break;
+	}
+	r.object = 0;
+}
+
+void AssetLoader::Update()
+{
+	PROFILE_ZONE( "Loader" );
+	vector<shared_ptr<Request>> done;
+	{
+		lock_guard<mutex> l( lock );
+		done.swap( loaded );
+	}
+	for (auto& r : done)
+	{
+		pending--;
+		if (r->state == CANCELED) { Discard( *r ); continue; }
+		if (r->object && r->type == TEXTURE)
+		{
+			// main thread part: upload to GL; the cpu-side pixels are no longer needed
+			Surface* s = (Surface*)r->object;
+			r->texture = CreateTexture( s->buffer, s->width, s->height );
+			delete s;
+			r->object = &r->texture;
+		}
+		r->state = r->object ? READY : FAILED;
+		if (r->callback) r->callback( *r );
+	}
+	// release dependents of completed requests; ready requests can be enqueued from a callback
+	for (size_t i = 0; i < waiting.size(); i++)
+	{
+		shared_ptr<Request> r = waiting[i];
+		const int d = r->dependency->state;
+		if (d < READY && r->state != CANCELED) continue;
+		waiting[i--] = waiting.back();
+		waiting.pop_back();
+		if (r->state == CANCELED) { pending--; continue; }
+		if (d == READY)
+		{
+			// the dependent takes the Surface, so that it is owned (and deleted) exactly once
+			r->source = (Surface*)r->dependency->object;
+			r->dependency->object = 0;
+			r->dependency->state = CONSUMED;
+			Enqueue( r );
+			continue;
+		}
+		pending--;
+		r->state = FAILED;
+		if (r->callback) r->callback( *r );
+	}
+}
+
+void AssetLoader::WaitAll()
+{
+	while (pending > 0)
+	{
+		Update();
+		if (pending > 0) this_thread::sleep_for( chrono::milliseconds( 1 ) );
+	}
+}
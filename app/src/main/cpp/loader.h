@@ -0,0 +1,79 @@
+#ifndef _LOADER_H
+#define _LOADER_H
+
+// asynchronous asset loader: Load* returns a handle immediately; files are read and decoded by
+// worker threads, highest priority first. Work that must happen on the main thread (creating
+// GL textures) and completion callbacks run in Update, which the template calls every frame.
+// A request with a dependency (e.g. a Font on its Surface) starts once the dependency is ready.
+// Loaded objects belong to the caller; like their constructors, Sprite and Font take ownership
+// of the Surface they are made from. That Surface is taken from its request when the Sprite or
+// Font starts loading: the Surface handle becomes CONSUMED and Get returns 0 from then on. So a
+// Surface handle feeds at most one Sprite or Font; a second one fails. Callers must not delete
+// a Surface that they passed to LoadSprite or LoadFont.
+
+class AssetLoader
+{
+public:
+	enum { QUEUED = 0, LOADING, LOADED, READY, FAILED, CANCELED, CONSUMED };
+	enum { SURFACE = 0, TEXTURE, SPRITE, FONT, WAV };
+	struct Request
+	{
+		int type, priority;
+		uint seq;
+		string file, chars;
+		uint frames = 1;
+		atomic<int> state{ QUEUED };
+		void* object = 0;		// the loaded Surface, Sprite, Font or Wav
+		Surface* source = 0;	// SPRITE and FONT requests: the Surface taken from the dependency
+		GLuint texture = 0;		// TEXTURE requests: created on the main thread
+		shared_ptr<Request> dependency;
+		function<void( Request& )> callback; // called on the main thread when ready or failed
+		bool IsDone() const { return state >= READY; }
+		void Cancel();
+	};
+	template <class T> class Handle
+	{
+	public:
+		Handle() = default;
+		Handle( const shared_ptr<Request>& r ) : request( r ) {}
+		T* Get() const { return request && request->state == READY ? (T*)request->object : 0; }
+		int GetState() const { return request ? (int)request->state : (int)FAILED; }
+		bool IsReady() const { return GetState() == READY; }
+		void Cancel() { if (request) request->Cancel(); }
+		shared_ptr<Request> request;
+	};
+	typedef function<void( Request& )> Callback;
+	AssetLoader( int threads = 2 );
+	~AssetLoader();
+	Handle<Surface> LoadSurface( const char* file, int priority = 0, Callback cb = 0 );
+	Handle<GLuint> LoadTexture( const char* file, int priority = 0, Callback cb = 0 );
+	Handle<Sprite> LoadSprite( Handle<Surface> surface, uint frames, int priority = 0, Callback cb = 0 );
+	Handle<Font> LoadFont( Handle<Surface> surface, const char* chars, int priority = 0, Callback cb = 0 );
+	Handle<SoLoud::Wav> LoadWav( const char* file, int priority = 0, Callback cb = 0 );
+	void Update(); // main thread: finish loaded requests, run callbacks, release dependents
+	void WaitAll(); // main thread: block until all requests are done
+	int Pending() const { return pending; }
+private:
+	struct Order
+	{
+		bool operator () ( const shared_ptr<Request>& a, const shared_ptr<Request>& b ) const
+		{
+			return a->priority != b->priority ? a->priority < b->priority : a->seq > b->seq;
+		}
+	};
+	shared_ptr<Request> Submit( int type, const char* file, shared_ptr<Request> dependency, int priority, Callback cb );
+	void Enqueue( const shared_ptr<Request>& r );
+	void WorkerMain();
+	static void Decode( Request& r );
+	static void Discard( Request& r );
+	priority_queue<shared_ptr<Request>, vector<shared_ptr<Request>>, Order> queue;
+	vector<shared_ptr<Request>> loaded, waiting;
+	vector<thread> workers;
+	mutex lock;
+	condition_variable wake;
+	uint seq = 0;
+	int pending = 0;
+	bool quit = false;
+};
+
+#endif // _LOADER_H
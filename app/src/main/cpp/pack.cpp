@@ -0,0 +1,90 @@
+#include "template.h"
+#include "zlib.h"
+#include "LzmaLib.h"
+
+// -----------------------------------------------------------
+// Asset packs
+// -----------------------------------------------------------
+
+static bool SameName( const char* a, const char* b )
+{
+	// b is a pack name, normalized by the packer
+	if (a[0] == '.' && (a[1] == '/' || a[1] == '\\')) a += 2;
+	for (; *a && *b; a++, b++) if ((*a == '\\' ? '/' : *a) != *b) return false;
+	return *a == *b;
+}
+
+Pack::Pack( const char* fileName )
+{
+	file = new Asset( fileName, false );
+	const size_t size = file->Size();
+	base = file->Data();
+	if (!base || size < sizeof( Header )) return;
+	const Header* h = (const Header*)base;
+	if (memcmp( h->magic, "TPAK", 4 ) || h->version != VERSION) return;
+	const size_t namesStart = sizeof( Header ) + (size_t)h->count * sizeof( Entry );
+	if (namesStart + h->namesSize > size) return;
+	const Entry* e = (const Entry*)(base + sizeof( Header ));
+	for (uint i = 0; i < h->count; i++)
+		if (e[i].name >= h->namesSize || e[i].offset + e[i].packedSize > size) return;
+	header = h, entry = e, names = (const char*)base + namesStart;
+}
+
+Pack::~Pack()
+{
+	delete file;
+}
+
+const Pack::Entry* Pack::Find( const char* name ) const
+{
+	if (!entry) return 0;
+	// lower bound on the hash, then compare names among entries with the same hash
+	const uint h = Hash( name );
+	uint first = 0, count = header->count;
+	while (count > 0)
+	{
+		const uint step = count / 2;
+		if (entry[first + step].hash < h) first += step + 1, count -= step + 1; else count = step;
+	}
+	for (uint i = first; i < header->count && entry[i].hash == h; i++)
+		if (SameName( name, names + entry[i].name )) return entry + i;
+	return 0;
+}
+
+bool Pack::Extract( const Entry* e, vector<uchar>& out ) const
+{
+	out.resize( e->size );
+	const uchar* src = Data( e );
+	if (e->method == STORE) { memcpy( out.data(), src, e->size ); return true; }
+	if (e->method == ZLIB)
+	{
+		uLongf length = e->size;
+		return uncompress( out.data(), &length, src, e->packedSize ) == Z_OK && length == e->size;
+	}
+	if (e->method == LZMA && e->packedSize >= LZMAPROPS)
+	{
+		size_t length = e->size, srcLength = e->packedSize - LZMAPROPS;
+		return LzmaUncompress( out.data(), &length, src + LZMAPROPS, &srcLength, src, LZMAPROPS ) == SZ_OK && length == e->size;
+	}
+	return false;
+}
+
+bool Pack::Mount( const char* fileName )
+{
+	Pack* pack = new Pack( fileName );
+	if (!pack->IsValid()) { delete pack; return false; }
+	mounted.push_back( pack );
+	return true;
+}
+
+void Pack::UnmountAll()
+{
+	for (Pack* pack : mounted) delete pack;
+	mounted.clear();
+}
+
+const Pack* Pack::Lookup( const char* name, const Entry*& e )
+{
+	for (size_t i = mounted.size(); i-- > 0;) if ((e = mounted[i]->Find( name ))) return mounted[i];
+	return 0;
+}
@@ -0,0 +1,48 @@
+#ifndef _PACK_H
+#define _PACK_H
+
+// asset pack: many files in a single file, with an index sorted by name hash. Entries are
+// stored, zlib or LZMA compressed, and start at a multiple of the pack's alignment, so stored
+// entries can be used in place from the mapped pack. Packs are created with tools/packer.
+// Layout: Header, Entry[count], zero-terminated names, entry data.
+// Mounted packs are searched by Asset (and thereby by loadBinaryFile, Surface, AssetFile)
+// before the file system; mount them at startup, before any loading starts.
+
+class Pack
+{
+public:
+	enum { STORE = 0, ZLIB, LZMA };
+	enum { VERSION = 1, LZMAPROPS = 5 }; // LZMA entries start with the 5 property bytes
+	struct Header { char magic[4]; uint version, count, namesSize, alignment, reserved[3]; };
+	struct Entry { uint hash, name; uint64_t offset; uint size, packedSize, method, reserved; };
+	Pack( const char* fileName );
+	~Pack();
+	bool IsValid() const { return entry != 0; }
+	uint Count() const { return header->count; }
+	const Entry* GetEntry( uint i ) const { return entry + i; }
+	const Entry* Find( const char* name ) const;
+	const char* Name( const Entry* e ) const { return names + e->name; }
+	const uchar* Data( const Entry* e ) const { return base + e->offset; } // packed data
+	bool Extract( const Entry* e, vector<uchar>& out ) const;
+	// FNV-1a over the normalized name: '\' becomes '/', a leading "./" is skipped
+	static uint Hash( const char* name )
+	{
+		if (name[0] == '.' && (name[1] == '/' || name[1] == '\\')) name += 2;
+		uint h = 2166136261u;
+		for (; *name; name++) h = (h ^ (uchar)(*name == '\\' ? '/' : *name)) * 16777619u;
+		return h;
+	}
+	// mounted packs; later mounts take precedence
+	static bool Mount( const char* fileName );
+	static void UnmountAll();
+	static const Pack* Lookup( const char* name, const Entry*& e );
+private:
+	Asset* file = 0;
+	const uchar* base = 0;
+	const Header* header = 0;
+	const Entry* entry = 0;
+	const char* names = 0;
+	inline static vector<Pack*> mounted;
+};
+
+#endif // _PACK_H
@@ -0,0 +1,233 @@
+#include "template.h"
+
+#ifndef TMPL8_HEADLESS
+
+// -----------------------------------------------------------
+// Post-processing
+// -----------------------------------------------------------
+
+#ifndef GL_TIME_ELAPSED_EXT
+#define GL_TIME_ELAPSED_EXT 0x88BF
+#endif
+#ifndef GL_GPU_DISJOINT_EXT
+#define GL_GPU_DISJOINT_EXT 0x8FBB
+#endif
+
+GLuint CompileShader( const char* vtext, const char* ftext );
+
+#ifdef _WIN64
+static const char vsText[] = "#version 330\nlayout(location=0)in vec3 pos;\nlayout(location=1)in "
+	"vec2 uv;\nout vec2 t;\nvoid main(){t=uv;gl_Position=vec4(pos,1);}";
+static const char fsHeader[] = "#version 330\nuniform sampler2D C,L;\nin vec2 t;\n";
+static const char fsHeaderHigh[] = "#version 330\nuniform sampler2D C,L;\nin vec2 t;\n";
+#else
+static const char vsText[] = "attribute vec4 pos;\nattribute vec2 uv;\nvarying vec2 t; \n"
+	"void main(){gl_Position=pos;t=uv;}";
+static const char fsHeader[] = "precision mediump float;\nuniform sampler2D C,L;\nvarying vec2 t;\n";
+static const char fsHeaderHigh[] = "precision mediump float;\nuniform sampler2D C,L;\nvarying highp vec2 t;\n";
+#endif
+
+// OFF and LOW, on the screen texture; LOW is my cheap approximation of the CRT look
+static const char plainBody[] = "void main(){gl_FragColor=vec4(texture2D(C,t).bgr,1);}";
+static const char lowBody[] =
+	"vec3 M(vec2 p){p.x+=p.y*3.;vec3 m=vec3(0.8);p.x=fract(p.x/6.);if(p.x<.333)m.r=1.2;else if("
+	"p.x<0.666)m.g=1.2;else m.b=1.2;return m;}void main(){vec2 p=t*vec2(320,192);float o=abs(p."
+	"y-floor(p.y)-0.5);float s=min(1.,1./(3.*o+0.3));vec2 d=vec2(s/640.,0.);vec4 pl=texture2D(C"
+	",t-d),pr=texture2D(C,t+d),p0=texture2D(C,t);gl_FragColor=vec4((pl*0.25+p0*0.5+pr*0.25).bgr"
+	"*s*M(t*vec2(1024,640)),1);}";
+// screen to linear light; the linear copy holds the square root of the linear value, so that
+// 10 bits per channel keep the dark shades apart
+static const char linearizeBody[] =
+	"void main(){vec3 c=texture2D(C,t).rgb*(255./256.)+.5/256.;gl_FragColor=vec4(texture2D(L,vec2(c.r,.5)).r,"
+	"texture2D(L,vec2(c.g,.5)).r,texture2D(L,vec2(c.b,.5)).r,1);}";
+// the kernel of Timothy Lottes' CRT shader, https://www.shadertoy.com/view/ls2SRD: texels
+// X to each side horizontally (XO in the outermost rows) and Y rows up and down, weighted by
+// exp2(s*|d|^3) of their distance to the pixel
+static const char kernelCommon[] =
+	"const highp vec2 r=vec2(320,192);float G(float d,float s){return exp2(s*d*d*abs(d));}vec3 F("
+	"highp vec2 p){vec3 c=texture2D(C,p).rgb;return c*c;}vec3 E(vec3 c){c=sqrt(clamp(c,0.,1.))*(1"
+	"023./1024.)+.5/1024.;return vec3(texture2D(L,vec2(c.r,.5)).r,texture2D(L,vec2(c.g,.5)).r,tex"
+	"ture2D(L,vec2(c.b,.5)).r);}vec3 M(highp vec2 p){p.x+=p.y*3.;vec3 m=vec3(0.65);p.x=fract(p.x/"
+	"6.);if(p.x<.333)m.r=1.35;else if(p.x<0.666)m.g=1.35;else m.b=1.35;return m;}";
+static const char singleBody[] =
+	"void main(){highp vec2 p=t*r,c=floor(p)+.5;vec2 d=c-p;vec3 s=vec3(0);for(int j=-Y;j<=Y;j++){f"
+	"loat o=float(j),n=0.;vec3 h=vec3(0);for(int i=-X;i<=X;i++){float k=float(i);if(abs(o)==float"
+	"(Y)&&abs(k)>float(XO))continue;float w=G(d.x+k,-4.);h+=F((c+vec2(k,o))/r)*w;n+=w;}s+=h/n*G(d"
+	".y+o,-24.);}gl_FragColor=vec4(E(s*1.25*M(t*vec2(1024,640))).bgr,1);}";
+// separable: rows of horizontally filtered texels, stored like the linear copy, then the
+// vertical filter, mask and sRGB conversion
+static const char horizontalBody[] =
+	"void main(){highp float p=t.x*r.x,c=floor(p)+.5;float d=c-p,n=0.;vec3 h=vec3(0);for(int i=-"
+	"X;i<=X;i++){float k=float(i),w=G(d+k,-4.);h+=F(vec2((c+k)/r.x,t.y))*w;n+=w;}gl_FragColor=vec"
+	"4(sqrt(h/n),1);}";
+static const char verticalBody[] =
+	"void main(){highp float p=t.y*r.y,c=floor(p)+.5;float d=c-p;vec3 s=vec3(0);for(int j=-Y;j<=Y"
+	";j++){float o=float(j);s+=F(vec2(t.x,(c+o)/r.y))*G(d+o,-24.);}gl_FragColor=vec4(E(s*1.25*M(t"
+	"*vec2(1024,640))).bgr,1);}";
+
+static GLuint Program( const char* header, const char* defines, const char* common, const char* body )
+{
+	string fs = string( header ) + defines + common + body;
+	const GLuint program = CompileShader( vsText, fs.c_str() );
+	glUseProgram( program );
+	glUniform1i( glGetUniformLocation( program, "C" ), 0 );
+	glUniform1i( glGetUniformLocation( program, "L" ), 1 );
+	return program;
+}
+
+static GLuint LookupTexture( int size, GLint format, GLenum type, const void* data, GLint filter )
+{
+	GLuint id;
+	glGenTextures( 1, &id );
+	glBindTexture( GL_TEXTURE_2D, id );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter );
+	glTexImage2D( GL_TEXTURE_2D, 0, format, size, 1, 0, GL_RED, type, data );
+	return id;
+}
+
+void PostProcess::Init( bool gles3 )
+{
+	// a new context: earlier objects are gone
+	plain = Program( fsHeader, "", "", plainBody );
+	low = Program( fsHeader, "", "", lowBody );
+	linear = rows = Target();
+	kernels = timers = disjoint = raised = false, pending = queryHead = samples = 0;
+	gpuTime = -1;
+	if (gles3)
+	{
+		// lookup textures: 8-bit sRGB to the root of linear light, and back, indexed by that root
+		float in[256];
+		uchar out[1024];
+		for (int i = 0; i < 256; i++)
+		{
+			const float c = i / 255.0f;
+			in[i] = sqrtf( c <= 0.04045f ? c / 12.92f : powf( (c + 0.055f) / 1.055f, 2.4f ) );
+		}
+		for (int i = 0; i < 1024; i++)
+		{
+			const float c = (i / 1023.0f) * (i / 1023.0f);
+			out[i] = (uchar)(255 * (c < 0.0031308f ? c * 12.92f : 1.055f * powf( c, 1 / 2.4f ) - 0.055f) + 0.5f);
+		}
+		toLinear = LookupTexture( 256, GL_R32F, GL_FLOAT, in, GL_NEAREST );
+		toSRGB = LookupTexture( 1024, GL_R8, GL_UNSIGNED_BYTE, out, GL_LINEAR );
+		kernels = Resize( linear, 320, 192, false );
+		linearize = Program( fsHeader, "", "", linearizeBody );
+		for (int t = MEDIUM; t <= HIGH; t++)
+		{
+			const char* defines = t == HIGH ? "#define X 3\n#define XO 2\n#define Y 2\n" : "#define X 1\n#define XO 1\n#define Y 1\n";
+			single[t] = Program( fsHeaderHigh, defines, kernelCommon, singleBody );
+			horizontal[t] = Program( fsHeaderHigh, defines, kernelCommon, horizontalBody );
+			vertical[t] = Program( fsHeaderHigh, defines, kernelCommon, verticalBody );
+		}
+		// GPU timing: timer queries are core on desktop OpenGL 3.3, an extension on OpenGL ES
+		const char* extensions = (const char*)glGetString( GL_EXTENSIONS );
+		disjoint = extensions && strstr( extensions, "GL_EXT_disjoint_timer_query" );
+		timers = disjoint || (extensions && strstr( extensions, "GL_ARB_timer_query" ));
+		if (timers) glGenQueries( QUERIES, query );
+		glGetError(); // a missing format or extension leaves an error
+	}
+	active = ceiling = kernels ? MEDIUM : LOW;
+	glUseProgram( 0 );
+}
+
+bool PostProcess::Resize( Target& target, int width, int height, bool linear )
+{
+	// a render target that stores 10 bits per channel
+	if (target.width == width && target.height == height) return target.complete;
+	if (!target.texture) glGenTextures( 1, &target.texture ), glGenFramebuffers( 1, &target.fbo );
+	glBindTexture( GL_TEXTURE_2D, target.texture );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, linear ? GL_LINEAR : GL_NEAREST );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, linear ? GL_LINEAR : GL_NEAREST );
+	glTexImage2D( GL_TEXTURE_2D, 0, GL_RGB10_A2, width, height, 0, GL_RGBA, GL_UNSIGNED_INT_2_10_10_10_REV, 0 );
+	glBindFramebuffer( GL_FRAMEBUFFER, target.fbo );
+	glFramebufferTexture2D( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, target.texture, 0 );
+	target.complete = glCheckFramebufferStatus( GL_FRAMEBUFFER ) == GL_FRAMEBUFFER_COMPLETE;
+	glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+	target.width = width, target.height = height;
+	return target.complete;
+}
+
+void PostProcess::Pass( GLuint program, const Target* target, int width, int height, GLuint source, GLuint lut )
+{
+	glBindFramebuffer( GL_FRAMEBUFFER, target ? target->fbo : 0 );
+	glViewport( 0, 0, target ? target->width : width, target ? target->height : height );
+	glUseProgram( program );
+	glActiveTexture( GL_TEXTURE1 );
+	glBindTexture( GL_TEXTURE_2D, lut );
+	glActiveTexture( GL_TEXTURE0 );
+	glBindTexture( GL_TEXTURE_2D, source );
+	DrawQuad();
+}
+
+void PostProcess::Draw( GLuint screen, int width, int height )
+{
+	PROFILE_ZONE( "PostProcess" );
+	ReadTimers();
+	int t = tier == AUTO ? active : min( tier, kernels ? (int)HIGH : (int)LOW );
+	if (t >= MEDIUM && separable && !Resize( rows, width, 192, true )) t = LOW;
+	const bool timed = timers && pending < QUERIES;
+	if (timed) glBeginQuery( GL_TIME_ELAPSED_EXT, query[queryHead] );
+	if (t < MEDIUM) Pass( t == LOW ? low : plain, 0, width, height, screen, 0 );
+	else
+	{
+		Pass( linearize, &linear, 0, 0, screen, toLinear );
+		if (!separable) Pass( single[t], 0, width, height, linear.texture, toSRGB );
+		else Pass( horizontal[t], &rows, 0, 0, linear.texture, 0 ), Pass( vertical[t], 0, width, height, rows.texture, toSRGB );
+	}
+	if (timed) glEndQuery( GL_TIME_ELAPSED_EXT ), queryHead = (queryHead + 1) % QUERIES, pending++;
+	glActiveTexture( GL_TEXTURE0 );
+	glBindTexture( GL_TEXTURE_2D, screen );
+	if (!timers && tier == AUTO && ++samples >= GameLoop::HISTORY)
+	{
+		// no GPU time: step down while a quarter of the frames are missed
+		if (GameLoop::GetStats().missed > GameLoop::HISTORY / 4 && active > OFF) active--;
+		samples = 0;
+	}
+}
+
+void PostProcess::ReadTimers()
+{
+	// collect finished queries without waiting; results that span a disjoint event are void
+	GLint lost = 0;
+	if (disjoint) glGetIntegerv( GL_GPU_DISJOINT_EXT, &lost );
+	while (pending > 0)
+	{
+		const GLuint q = query[(queryHead - pending + QUERIES) % QUERIES];
+		GLuint available = 0, ns = 0;
+		glGetQueryObjectuiv( q, GL_QUERY_RESULT_AVAILABLE, &available );
+		if (!available) break;
+		glGetQueryObjectuiv( q, GL_QUERY_RESULT, &ns );
+		pending--;
+		if (!lost) Adapt( ns * 1e-6f );
+	}
+}
+
+void PostProcess::Adapt( float ms )
+{
+	// average over the frames since the last change of tier
+	gpuTime = samples++ == 0 ? ms : gpuTime * 0.9f + ms * 0.1f;
+	if (tier != AUTO || samples < SETTLE) return;
+	// step down when over budget, and up when well below it; a tier that is too slow right
+	// after stepping up to it is not tried again
+	const float limit = budget * 1000 / (GameLoop::targetRate > 0 ? GameLoop::targetRate : 60);
+	if (gpuTime > limit && active > OFF)
+	{
+		if (raised) ceiling = active - 1;
+		active--, samples = 0, raised = false;
+	}
+	else if (gpuTime < limit / 3 && active < ceiling) active++, samples = 0, raised = true;
+	else raised = false;
+}
+
+const char* PostProcess::Name( int tier )
+{
+	static const char* names[] = { "auto", "off", "low", "medium", "high" };
+	return names[tier < AUTO || tier > HIGH ? 0 : tier + 1];
+}
+
+#endif // TMPL8_HEADLESS
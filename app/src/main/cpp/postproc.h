@@ -0,0 +1,50 @@
+#ifndef _POSTPROC_H
+#define _POSTPROC_H
+
+// post-processing: draws the 320x192 screen texture to the window with a CRT look, at one of
+// four quality tiers:
+//   OFF     plain nearest-neighbour upscale
+//   LOW     three horizontal taps, scanlines and shadow mask, in gamma space
+//   MEDIUM  Timothy Lottes' CRT shader with a 3x3 kernel (9 taps)
+//   HIGH    the same with the original 31-tap kernel, 7 wide by 5 rows high
+// The Lottes weights beyond one texel are below 1e-4, so MEDIUM matches HIGH to within a
+// unit of 8-bit output. Both read a copy of the screen that a 320x192 pass converts to linear
+// light through a lookup texture, and convert back to sRGB through a second one, so no pixel
+// computes pow. With separable set, they run as two passes: a horizontal one at the window
+// width but only 192 rows, then a vertical one that reads 2Y + 1 of those rows per pixel.
+// With tier AUTO, the tier follows the measured GPU time of the post-processing: it goes
+// down once that exceeds budget (a fraction of the frame period), and up again once it stays
+// below a third of that; a tier that is over budget right after going up is not tried again,
+// so the tier does not oscillate. AUTO goes no higher than MEDIUM. Without timer
+// queries (EXT_disjoint_timer_query on OpenGL ES), the tier goes down while frames are
+// missed. On OpenGL ES 2.0, only OFF and LOW are available.
+
+class PostProcess
+{
+public:
+	enum { AUTO = -1, OFF = 0, LOW, MEDIUM, HIGH, TIERS };
+	static void Init( bool gles3 ); // after creating the context; gles3: float and 10-bit render targets are available
+	static void Draw( GLuint screen, int width, int height ); // screen: the 320x192 texture; width, height: window size
+	static int Active() { return active; } // the tier that Draw uses
+	static float GpuTime() { return gpuTime; } // in ms; -1 if the GPU time can't be measured
+	static const char* Name( int tier );
+	inline static int tier = AUTO;
+	inline static bool separable = true;
+	inline static float budget = 0.2f; // for AUTO, as a fraction of the frame period
+private:
+	enum { QUERIES = 4, SETTLE = 30 };
+	struct Target { GLuint texture, fbo; int width, height; bool complete; };
+	static void Pass( GLuint program, const Target* target, int width, int height, GLuint source, GLuint lut );
+	static bool Resize( Target& target, int width, int height, bool linear );
+	static void ReadTimers();
+	static void Adapt( float ms );
+	inline static GLuint plain = 0, low = 0, linearize = 0, single[TIERS] = {}, horizontal[TIERS] = {}, vertical[TIERS] = {};
+	inline static GLuint toLinear = 0, toSRGB = 0; // lookup textures
+	inline static Target linear = {}, rows = {};
+	inline static GLuint query[QUERIES] = {};
+	inline static int queryHead = 0, pending = 0, samples = 0, active = OFF, ceiling = OFF;
+	inline static bool kernels = false, timers = false, disjoint = false, raised = false;
+	inline static float gpuTime = -1;
+};
+
+#endif // _POSTPROC_H
@@ -0,0 +1,132 @@
+#include "template.h"
+
+// -----------------------------------------------------------
+// Frame profiler
+// -----------------------------------------------------------
+
+int64_t Profiler::Now()
+{
+	static const auto epoch = chrono::steady_clock::now();
+	return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - epoch).count();
+}
+
+Profiler::Ring* Profiler::ThreadRing()
+{
+	thread_local Ring* ring = 0;
+	if (!ring)
+	{
+		// rings are never freed, so events of finished threads can still be exported
+		lock_guard<mutex> l( lock );
+		ring = new Ring;
+		ring->tid = (int)rings.size();
+		rings.push_back( ring );
+	}
+	return ring;
+}
+
+void Profiler::Record( const char* name, int64_t begin, int64_t end )
+{
+	if (!enabled) return;
+	Ring* ring = ThreadRing();
+	const uint idx = ring->count.load( memory_order_relaxed );
+	ring->event[idx % RINGSIZE] = { name, begin, end };
+	ring->count.store( idx + 1, memory_order_release );
+}
+
+void Profiler::MixCallback( bool begin )
+{
+	thread_local int64_t start = 0;
+	if (begin) start = Now(); else Record( "Mix", start, Now() );
+}
+
+void Profiler::FrameDone( float ms )
+{
+	frameTime[frameCount++ % FRAMES] = ms;
+}
+
+int Profiler::DrawOverlay( Surface* target )
+{
+	// frame time graph for the last FRAMES frames, 1 pixel per ms; the line marks 16.7ms.
+	// Black is left transparent by the template, which composites the overlay over the screen.
+	const int x0 = 2, y0 = 2, h = 40;
+	const Pixel panel = 0x202020;
+	target->Bar( x0, y0, x0 + FRAMES - 1, y0 + h - 1, panel );
+	for (int i = 0; i < FRAMES; i++)
+	{
+		const float t = frameTime[(frameCount + i) % FRAMES];
+		const int l = min( h, (int)t );
+		const Pixel c = t < 17.5f ? 0x00ff00 : t < 34 ? 0xffff00 : 0xff0000;
+		target->VLine( x0 + i, y0 + h - l, l, c );
+	}
+	target->HLine( x0, y0 + h - 17, FRAMES, 0x808080 );
+	// histogram: number of frames per 4ms bucket, last bucket is 36ms and up
+	int bucket[10] = {};
+	for (int i = 0; i < FRAMES; i++) bucket[min( 9, (int)(frameTime[i] / 4) )]++;
+	const int hx = x0 + FRAMES + 4;
+	target->Bar( hx, y0, hx + 10 * 4 - 1, y0 + h - 1, panel );
+	for (int i = 0; i < 10; i++)
+	{
+		const int l = (bucket[i] * h) / FRAMES;
+		target->Bar( hx + i * 4, y0 + h - l, hx + i * 4 + 2, y0 + h - 1, 0x00c0ff );
+	}
+	// average duration per zone over the recorded frames, from the ring of each thread
+	const char* name[16];
+	float total[16];
+	int zones = 0;
+	const int64_t window = Now() - 1000000000; // last second
+	lock.lock();
+	for (Ring* ring : rings)
+	{
+		const uint count = ring->count.load( memory_order_acquire );
+		for (uint i = count > RINGSIZE ? count - RINGSIZE : 0; i < count; i++)
+		{
+			const Event& e = ring->event[i % RINGSIZE];
+			if (e.end < window) continue;
+			int z = 0;
+			while (z < zones && name[z] != e.name) z++;
+			if (z == zones) { if (zones == 16) continue; name[zones] = e.name, total[zones++] = 0; }
+			total[z] += (e.end - e.begin) * 1e-6f;
+		}
+	}
+	lock.unlock();
+	int frames = 0;
+	float sum = 0;
+	for (int i = 0; i < FRAMES && sum < 1000; i++, frames++) sum += frameTime[(frameCount - 1 - i) % FRAMES];
+	char t[64];
+	sprintf( t, "frame %.2fms", frames ? sum / frames : 0 );
+	target->Print( t, x0, y0 + h + 3, 0xffffff );
+	// pacing: jitter is the standard deviation of the frame time
+	const GameLoop::Stats p = GameLoop::GetStats();
+	sprintf( t, "%.0fhz jitter %.2fms max %.1fms missed %d clamped %d", GameLoop::targetRate, p.jitter, p.worst, p.missed, p.clamped );
+	target->Print( t, x0, y0 + h + 10, 0xffffff );
+	for (int z = 0; z < zones; z++)
+	{
+		sprintf( t, "%s %.2fms", name[z], frames ? total[z] / frames : 0 );
+		target->Print( t, x0, y0 + h + 17 + z * 7, 0xffffff );
+	}
+	return y0 + h + 17 + zones * 7;
+}
+
+bool Profiler::ExportChromeTrace( const char* fileName )
+{
+	// Chrome trace event format, see chrome://tracing or https://ui.perfetto.dev
+	FILE* f = fopen( fileName, "w" );
+	if (!f) return false;
+	fprintf( f, "{\"traceEvents\":[" );
+	bool first = true;
+	lock_guard<mutex> l( lock );
+	for (Ring* ring : rings)
+	{
+		const uint count = ring->count.load( memory_order_acquire );
+		for (uint i = count > RINGSIZE ? count - RINGSIZE : 0; i < count; i++)
+		{
+			const Event& e = ring->event[i % RINGSIZE];
+			fprintf( f, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":0,\"tid\":%i}",
+				first ? "" : ",", e.name, e.begin * 1e-3, (e.end - e.begin) * 1e-3, ring->tid );
+			first = false;
+		}
+	}
+	fprintf( f, "\n]}\n" );
+	fclose( f );
+	return true;
+}
@@ -0,0 +1,43 @@
+#ifndef _PROFILER_H
+#define _PROFILER_H
+
+// frame profiler: PROFILE_ZONE( "name" ) records the begin and end time of the enclosing
+// scope in a ring buffer owned by the calling thread, so recording never takes a lock.
+// Zone names must be string literals. Frame times are kept for the overlay histogram.
+
+class Profiler
+{
+public:
+	enum { RINGSIZE = 8192, FRAMES = 128 };
+	struct Event { const char* name; int64_t begin, end; };
+	static int64_t Now(); // in ns
+	static void Record( const char* name, int64_t begin, int64_t end );
+	static void FrameDone( float frameTime ); // in ms
+	static int DrawOverlay( Surface* target ); // returns the number of rows drawn
+	static bool ExportChromeTrace( const char* fileName );
+	static void MixCallback( bool begin ); // for Soloud::mMixCallback
+	inline static bool enabled = true, showOverlay = false;
+private:
+	struct Ring { Event event[RINGSIZE]; atomic<uint> count{ 0 }; int tid; };
+	static Ring* ThreadRing();
+	inline static mutex lock;
+	inline static vector<Ring*> rings;
+	inline static float frameTime[FRAMES] = {};
+	inline static uint frameCount = 0;
+};
+
+class ProfileZone
+{
+public:
+	ProfileZone( const char* name ) : name( name ), begin( Profiler::Now() ) {}
+	~ProfileZone() { Profiler::Record( name, begin, Profiler::Now() ); }
+private:
+	const char* name;
+	int64_t begin;
+};
+
+#define PROFILE_CONCAT2(a,b) a##b
+#define PROFILE_CONCAT(a,b) PROFILE_CONCAT2(a,b)
+#define PROFILE_ZONE(name) ProfileZone PROFILE_CONCAT(zone,__LINE__)( name )
+
+#endif // _PROFILER_H
@@ -0,0 +1,217 @@
+#include "template.h"
+
+// -----------------------------------------------------------
+// Tiled renderer
+// -----------------------------------------------------------
+
+void Renderer::Add( const Command& c, int y1, int y2 )
+{
+	// bin the command in every tile overlapped by rows [y1,y2)
+	y1 = max( y1, 0 ), y2 = min( y2, target->height );
+	if (y1 >= y2) return;
+	target->MarkDirty( 0, y1, target->width, y2 );
+	const uint idx = (uint)commands.size();
+	commands.push_back( c );
+	for (int t = y1 / TILEHEIGHT; t <= (y2 - 1) / TILEHEIGHT; t++) tiles[t].push_back( idx );
+}
+
+void Renderer::Clear( Pixel color )
+{
+	if (!deferred) { target->Clear( color ); return; }
+	Command c = { CLEAR };
+	c.color = color;
+	Add( c, 0, target->height );
+}
+
+void Renderer::Plot( int x, int y, Pixel color )
+{
+	if (!deferred) { target->Plot( x, y, color ); return; }
+	Command c = { PLOT };
+	c.i.x1 = x, c.i.y1 = y, c.color = color;
+	Add( c, y, y + 1 );
+}
+
+void Renderer::Line( float x1, float y1, float x2, float y2, Pixel color )
+{
+	if (!deferred) { target->Line( x1, y1, x2, y2, color ); return; }
+	Command c = { LINE };
+	c.f.x1 = x1, c.f.y1 = y1, c.f.x2 = x2, c.f.y2 = y2, c.color = color;
+	// one row of margin: clipping may round an endpoint into the next row
+	Add( c, (int)floorf( min( y1, y2 ) ) - 1, (int)floorf( max( y1, y2 ) ) + 2 );
+}
+
+void Renderer::LineAA( float x1, float y1, float x2, float y2, Pixel color )
+{
+	if (!deferred) { target->LineAA( x1, y1, x2, y2, color ); return; }
+	Command c = { LINEAA };
+	c.f.x1 = x1, c.f.y1 = y1, c.f.x2 = x2, c.f.y2 = y2, c.color = color;
+	// the second pixel of a step lands one row further
+	Add( c, (int)floorf( min( y1, y2 ) ) - 1, (int)floorf( max( y1, y2 ) ) + 3 );
+}
+
+void Renderer::HLine( int x, int y, int l, Pixel color )
+{
+	if (!deferred) { target->HLine( x, y, l, color ); return; }
+	Command c = { HLINE };
+	c.i.x1 = x, c.i.y1 = y, c.i.x2 = l, c.color = color;
+	Add( c, y, y + 1 );
+}
+
+void Renderer::VLine( int x, int y, int l, Pixel color )
+{
+	if (!deferred) { target->VLine( x, y, l, color ); return; }
+	Command c = { VLINE };
+	c.i.x1 = x, c.i.y1 = y, c.i.x2 = l, c.color = color;
+	Add( c, y, y + l );
+}
+
+void Renderer::Box( int x1, int y1, int x2, int y2, Pixel color )
+{
+	if (!deferred) { target->Box( x1, y1, x2, y2, color ); return; }
+	Line( (float)x1, (float)y1, (float)x2, (float)y1, color );
+	Line( (float)x2, (float)y1, (float)x2, (float)y2, color );
+	Line( (float)x1, (float)y2, (float)x2, (float)y2, color );
+	Line( (float)x1, (float)y1, (float)x1, (float)y2, color );
+}
+
+void Renderer::Bar( int x1, int y1, int x2, int y2, Pixel color )
+{
+	if (!deferred) { target->Bar( x1, y1, x2, y2, color ); return; }
+	Command c = { BAR };
+	c.i.x1 = x1, c.i.y1 = y1, c.i.x2 = x2, c.i.y2 = y2, c.color = color;
+	Add( c, y1, y2 + 1 );
+}
+
+void Renderer::Triangle( const vec2* v, const float* attributes, int count, int shading, const Surface* texture, Pixel color )
+{
+	// positions and attributes go to params; i.x1 is the offset, flags the shading
+	Command c = { TRIANGLE };
+	c.i.x1 = (int)params.size(), c.flags = shading, c.object = (void*)texture, c.color = color;
+	for (int i = 0; i < 3; i++) params.insert( params.end(), { v[i].x, v[i].y } );
+	params.insert( params.end(), attributes, attributes + count );
+	Add( c, (int)floorf( min( v[0].y, min( v[1].y, v[2].y ) ) ) - 1, (int)floorf( max( v[0].y, max( v[1].y, v[2].y ) ) ) + 2 );
+}
+
+void Renderer::Triangle( const vec2& v0, const vec2& v1, const vec2& v2, Pixel color )
+{
+	if (!deferred) { target->Triangle( v0, v1, v2, color ); return; }
+	const vec2 v[3] = { v0, v1, v2 };
+	Triangle( v, 0, 0, FLAT, 0, color );
+}
+
+void Renderer::Triangle( const vec2& v0, const vec2& v1, const vec2& v2, const vec3& c0, const vec3& c1, const vec3& c2 )
+{
+	if (!deferred) { target->Triangle( v0, v1, v2, c0, c1, c2 ); return; }
+	const vec2 v[3] = { v0, v1, v2 };
+	const float a[9] = { c0.x, c0.y, c0.z, c1.x, c1.y, c1.z, c2.x, c2.y, c2.z };
+	Triangle( v, a, 9, GOURAUD, 0 );
+}
+
+void Renderer::Triangle( const vec2& v0, const vec2& v1, const vec2& v2, const vec2& t0, const vec2& t1, const vec2& t2, const Surface* texture )
+{
+	if (!deferred) { target->Triangle( v0, v1, v2, t0, t1, t2, texture ); return; }
+	const vec2 v[3] = { v0, v1, v2 };
+	const float a[6] = { t0.x, t0.y, t1.x, t1.y, t2.x, t2.y };
+	Triangle( v, a, 6, TEXTURED, texture );
+}
+
+void Renderer::Polygon( const vec2* v, int n, Pixel color )
+{
+	if (!deferred) { target->Polygon( v, n, color ); return; }
+	for (int i = 2; i < n; i++) Triangle( v[0], v[i - 1], v[i], color );
+}
+
+void Renderer::CopyTo( Surface* src, int x, int y )
+{
+	if (!deferred) { src->CopyTo( target, x, y ); return; }
+	Command c = { COPY };
+	c.i.x1 = x, c.i.y1 = y, c.object = src;
+	Add( c, y, y + src->height );
+}
+
+void Renderer::BlendCopyTo( Surface* src, int x, int y )
+{
+	if (!deferred) { src->BlendCopyTo( target, x, y ); return; }
+	Command c = { BLENDCOPY };
+	c.i.x1 = x, c.i.y1 = y, c.object = src;
+	Add( c, y, y + src->height );
+}
+
+void Renderer::Draw( Sprite* sprite, int x, int y )
+{
+	if (!deferred) { sprite->Draw( target, x, y ); return; }
+	Command c = { SPRITE };
+	c.i.x1 = x, c.i.y1 = y, c.object = sprite;
+	c.frame = sprite->GetFrame(), c.flags = sprite->GetFlags();
+	Add( c, y, y + sprite->GetHeight() );
+}
+
+void Renderer::Print( const char* s, int x, int y, Pixel color )
+{
+	if (!deferred) { target->Print( s, x, y, color ); return; }
+	Command c = { PRINT };
+	c.i.x1 = x, c.i.y1 = y, c.i.x2 = (int)text.size(), c.color = color;
+	text.append( s, strlen( s ) + 1 );
+	Add( c, y, y + 6 ); // 5 rows plus shadow
+}
+
+void Renderer::RenderTile( int tile )
+{
+	// replay the binned commands in recording order, restricted to rows [y1,y2)
+	const int y1 = tile * TILEHEIGHT, y2 = min( y1 + TILEHEIGHT, target->height ), w = target->width;
+	Surface band( w, y2 - y1, target->buffer + y1 * w );
+	for (uint idx : tiles[tile])
+	{
+		const Command& c = commands[idx];
+		switch (c.type)
+		{
+		case CLEAR: for (int i = 0; i < band.width * band.height; i++) band.buffer[i] = c.color; break;
+		case PLOT: target->Plot( c.i.x1, c.i.y1, c.color ); break;
+		case LINE: target->Line( c.f.x1, c.f.y1, c.f.x2, c.f.y2, c.color, y1, y2 ); break;
+		case LINEAA: target->LineAA( c.f.x1, c.f.y1, c.f.x2, c.f.y2, c.color, y1, y2 ); break;
+		case HLINE: target->HLine( c.i.x1, c.i.y1, c.i.x2, c.color ); break;
+		case VLINE:
+		{
+			const int v1 = max( c.i.y1, y1 ), v2 = min( c.i.y1 + c.i.x2, y2 );
+			target->VLine( c.i.x1, v1, v2 - v1, c.color );
+			break;
+		}
+		case BAR: target->Bar( c.i.x1, max( c.i.y1, y1 ), c.i.x2, min( c.i.y2, y2 - 1 ), c.color ); break;
+		case COPY: ((Surface*)c.object)->CopyTo( &band, c.i.x1, c.i.y1 - y1 ); break;
+		case BLENDCOPY: ((Surface*)c.object)->BlendCopyTo( &band, c.i.x1, c.i.y1 - y1 ); break;
+		case SPRITE: ((Sprite*)c.object)->Draw( &band, c.i.x1, c.i.y1 - y1, c.frame, c.flags ); break;
+		case TRIANGLE:
+		{
+			// the target, not the band: triangles are rasterized in target coordinates
+			const float* p = params.data() + c.i.x1;
+			const vec2 v0( p[0], p[1] ), v1( p[2], p[3] ), v2( p[4], p[5] );
+			if (c.flags == FLAT) target->Triangle( v0, v1, v2, c.color, y1, y2 );
+			else if (c.flags == GOURAUD) target->Triangle( v0, v1, v2, vec3( p[6], p[7], p[8] ), vec3( p[9], p[10], p[11] ), vec3( p[12], p[13], p[14] ), y1, y2 );
+			else target->Triangle( v0, v1, v2, vec2( p[6], p[7] ), vec2( p[8], p[9] ), vec2( p[10], p[11] ), (const Surface*)c.object, y1, y2 );
+			break;
+		}
+		case PRINT: band.Print( text.c_str() + c.i.x2, c.i.x1, c.i.y1 - y1, c.color ); break;
+		}
+	}
+}
+
+void Renderer::Flush()
+{
+	if (commands.empty()) return;
+	// rows were marked dirty by Add; tiles must not update the region concurrently
+	DirtyRegion* dirty = target->dirty;
+	target->dirty = 0;
+	JobManager* jm = JobManager::GetJobManager();
+	jobs.resize( tiles.size() );
+	for (int t = 0; t < (int)tiles.size(); t++) if (!tiles[t].empty())
+	{
+		jobs[t].renderer = this, jobs[t].tile = t;
+		jm->AddJob( &jobs[t] );
+	}
+	jm->RunJobs();
+	target->dirty = dirty;
+	commands.clear();
+	for (auto& t : tiles) t.clear();
+	text.clear();
+	params.clear();
+}
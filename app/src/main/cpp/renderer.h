@@ -0,0 +1,65 @@
+#ifndef _RENDERER_H
+#define _RENDERER_H
+
+// tiled renderer: a command buffer in front of a Surface. In immediate mode every call is
+// forwarded to the target. In deferred mode calls are recorded, binned per screen tile and
+// rasterized in parallel by the job manager on Flush; the result is identical to immediate
+// mode. Tiles are full-width bands, so that a tile is itself a valid Surface.
+
+class Renderer
+{
+public:
+	enum { TILEHEIGHT = 16 };
+	Renderer( Surface* target ) : target( target ) { tiles.resize( (target->height + TILEHEIGHT - 1) / TILEHEIGHT ); }
+	void SetDeferred( bool d ) { Flush(); deferred = d; }
+	bool IsDeferred() const { return deferred; }
+	// drawing; same semantics as the Surface / Sprite methods
+	void Clear( Pixel color );
+	void Plot( int x, int y, Pixel color );
+	void Line( float x1, float y1, float x2, float y2, Pixel color );
+	void LineAA( float x1, float y1, float x2, float y2, Pixel color );
+	void HLine( int x, int y, int l, Pixel color );
+	void VLine( int x, int y, int l, Pixel color );
+	void Box( int x1, int y1, int x2, int y2, Pixel color );
+	void Bar( int x1, int y1, int x2, int y2, Pixel color );
+	void Triangle( const vec2& v0, const vec2& v1, const vec2& v2, Pixel color );
+	void Triangle( const vec2& v0, const vec2& v1, const vec2& v2, const vec3& c0, const vec3& c1, const vec3& c2 );
+	void Triangle( const vec2& v0, const vec2& v1, const vec2& v2, const vec2& t0, const vec2& t1, const vec2& t2, const Surface* texture );
+	void Polygon( const vec2* v, int n, Pixel color );
+	void CopyTo( Surface* src, int x, int y );
+	void BlendCopyTo( Surface* src, int x, int y );
+	void Draw( Sprite* sprite, int x, int y );
+	void Print( const char* s, int x, int y, Pixel color );
+	void Flush(); // rasterize all recorded commands
+	Surface* GetTarget() { return target; }
+private:
+	enum { CLEAR = 0, PLOT, LINE, LINEAA, HLINE, VLINE, BAR, COPY, BLENDCOPY, SPRITE, PRINT, TRIANGLE };
+	enum { FLAT = 0, GOURAUD, TEXTURED }; // triangle shading, in Command::flags
+	struct Command
+	{
+		int type;
+		union { struct { float x1, y1, x2, y2; } f; struct { int x1, y1, x2, y2; } i; };
+		Pixel color;
+		void* object;		// source Surface or Sprite
+		uint frame, flags;	// sprite state at the time of recording
+	};
+	class TileJob : public Job
+	{
+	public:
+		void Main() { renderer->RenderTile( tile ); }
+		Renderer* renderer;
+		int tile;
+	};
+	void Add( const Command& c, int y1, int y2 );
+	void Triangle( const vec2* v, const float* attributes, int count, int shading, const Surface* texture, Pixel color = 0 );
+	void RenderTile( int tile );
+	Surface* target;
+	bool deferred = false;
+	vector<Command> commands;
+	vector<vector<uint>> tiles;	// per tile: indices of the commands that touch it
+	vector<TileJob> jobs;
+	string text;				// zero-terminated strings for PRINT, referenced by i.x2
+	vector<float> params;		// TRIANGLE vertices and attributes, referenced by i.x1
+};
+
+#endif // _RENDERER_H
@@ -0,0 +1,205 @@
+#include "template.h"
+#include "zlib.h"
+#include "LzmaLib.h"
+
+// -----------------------------------------------------------
+// Game state snapshots
+// -----------------------------------------------------------
+
+static bool WriteFile( const string& fileName, const vector<uchar>& data )
+{
+	// write a new file and then replace the old one, so that a crash never leaves half a base
+	const string temp = fileName + ".tmp";
+	FILE* f = fopen( temp.c_str(), "wb" );
+	if (!f) return false;
+	const bool written = fwrite( data.data(), 1, data.size(), f ) == data.size();
+	if (fclose( f ) != 0 || !written) { remove( temp.c_str() ); return false; }
+#ifdef _WIN64
+	return MoveFileExA( temp.c_str(), fileName.c_str(), MOVEFILE_REPLACE_EXISTING ) != 0;
+#else
+	return rename( temp.c_str(), fileName.c_str() ) == 0;
+#endif
+}
+
+void Snapshot::Add( const char* name, function<void( Stream& )> save, function<bool( Stream& )> load )
+{
+	AddBlock( name, [save]( vector<uchar>& scratch, size_t& size ) { scratch.clear(); Stream s( scratch ); save( s ); size = scratch.size(); return (const uchar*)scratch.data(); },
+		[load]( const uchar* data, size_t size ) { Stream s( data, size ); return load( s ); } );
+}
+
+void Snapshot::AddBlock( const char* name, Getter get, Setter set )
+{
+	// block ids are name hashes, as in asset packs; a block added again replaces the old one
+	const uint id = Pack::Hash( name );
+	Block* b = Find( id );
+	if (!b) blocks.push_back( Block() ), b = &blocks.back(), b->id = id;
+	b->get = get, b->set = set;
+	b->base.clear(); // no base: the next delta stores the whole block
+}
+
+void Snapshot::Remove( const char* name )
+{
+	const uint id = Pack::Hash( name );
+	blocks.erase( remove_if( blocks.begin(), blocks.end(), [id]( const Block& b ) { return b.id == id; } ), blocks.end() );
+}
+
+Snapshot::Block* Snapshot::Find( uint id )
+{
+	for (Block& b : blocks) if (b.id == id) return &b;
+	return 0;
+}
+
+bool Snapshot::Save( vector<uchar>& out, bool full )
+{
+	PROFILE_ZONE( "SaveState" );
+	// the current bytes of each block, and the pages in which they differ from the base
+	size_t total = 0, changed = 0;
+	for (Block& b : blocks)
+	{
+		b.data = b.get( b.scratch, b.size ), b.pages.clear();
+		total += b.size;
+		if (full || !baseId) continue;
+		for (size_t offset = 0; offset < b.size; offset += PAGE)
+		{
+			const size_t n = min( (size_t)PAGE, b.size - offset );
+			if (offset + n > b.base.size() || memcmp( b.data + offset, b.base.data() + offset, n ))
+				b.pages.push_back( (uint)(offset / PAGE) ), changed += n;
+		}
+	}
+	if (full || !baseId || changed > total * maxDelta)
+	{
+		// a full snapshot, which becomes the new base
+		if (!Encode( out, false )) return false;
+		memcpy( &baseId, out.data() + offsetof( Header, id ), sizeof( uint ) );
+		for (Block& b : blocks) b.base.assign( b.data, b.data + b.size ), b.pages.clear();
+		if (baseFile.empty()) return true;
+		// keep it in the base file, and return a delta without changes instead
+		if (!WriteFile( baseFile, out )) { baseId = 0; return false; }
+	}
+	return Encode( out, true );
+}
+
+bool Snapshot::Encode( vector<uchar>& out, bool delta )
+{
+	// per block: id, size, and for a delta the number of pages, followed by the bytes of the
+	// block, or by the index and bytes of each page. Delta pages are xor'ed with the base, so
+	// the bytes that did not change are zeros, which compress to almost nothing.
+	raw.clear();
+	auto put = [this]( const void* data, size_t bytes ) { raw.insert( raw.end(), (const uchar*)data, (const uchar*)data + bytes ); };
+	for (const Block& b : blocks)
+	{
+		const uint head[3] = { b.id, (uint)b.size, (uint)b.pages.size() };
+		put( head, delta ? 12 : 8 );
+		if (!delta) put( b.data, b.size );
+		else for (uint p : b.pages)
+		{
+			const size_t offset = (size_t)p * PAGE, n = min( (size_t)PAGE, b.size - offset ), start = raw.size() + 4;
+			put( &p, 4 ), put( b.data + offset, n );
+			for (size_t i = 0, m = offset < b.base.size() ? min( n, b.base.size() - offset ) : 0; i < m; i++) raw[start + i] ^= b.base[offset + i];
+		}
+	}
+	Header h = { { 'T', 'S', 'N', 'P' }, VERSION, delta, (uint)(raw.empty() ? STORE : method), 0, baseId, (uint)raw.size(), 0 };
+	size_t packed = raw.size();
+	if (h.method == ZLIB)
+	{
+		uLongf length = compressBound( (uLong)raw.size() );
+		out.resize( sizeof( Header ) + length );
+		if (compress2( out.data() + sizeof( Header ), &length, raw.data(), (uLong)raw.size(), level ) != Z_OK) return false;
+		packed = length;
+	}
+	else if (h.method == LZMA)
+	{
+		size_t length = raw.size() + raw.size() / 3 + 128, props = LZMAPROPS;
+		out.resize( sizeof( Header ) + LZMAPROPS + length );
+		uchar* dst = out.data() + sizeof( Header );
+		if (LzmaCompress( dst + LZMAPROPS, &length, raw.data(), raw.size(), dst, &props, level, 0, -1, -1, -1, -1, 1 ) != SZ_OK) return false;
+		packed = LZMAPROPS + length;
+	}
+	else
+	{
+		h.method = STORE;
+		out.resize( sizeof( Header ) + raw.size() );
+		memcpy( out.data() + sizeof( Header ), raw.data(), raw.size() );
+	}
+	out.resize( sizeof( Header ) + packed );
+	h.packedSize = (uint)packed;
+	h.id = (uint)crc32( 0, out.data() + sizeof( Header ), (uInt)packed );
+	if (!h.id) h.id = 1; // 0 means 'no base'
+	if (!delta) h.base = h.id;
+	memcpy( out.data(), &h, sizeof( Header ) );
+	return true;
+}
+
+bool Snapshot::Decode( const uchar* data, size_t size, Header& h, vector<uchar>& raw )
+{
+	if (size < sizeof( Header ) || h.packedSize > size - sizeof( Header )) return false;
+	const uchar* src = data + sizeof( Header );
+	const uint crc = (uint)crc32( 0, src, h.packedSize );
+	if ((crc ? crc : 1) != h.id) return false;
+	raw.resize( h.size );
+	if (h.method == STORE) { if (h.packedSize != h.size) return false; memcpy( raw.data(), src, h.size ); return true; }
+	if (h.method == ZLIB)
+	{
+		uLongf length = h.size;
+		return uncompress( raw.data(), &length, src, h.packedSize ) == Z_OK && length == h.size;
+	}
+	if (h.method == LZMA && h.packedSize >= LZMAPROPS)
+	{
+		size_t length = h.size, srcLength = h.packedSize - LZMAPROPS;
+		return LzmaUncompress( raw.data(), &length, src + LZMAPROPS, &srcLength, src, LZMAPROPS ) == SZ_OK && length == h.size;
+	}
+	return false;
+}
+
+bool Snapshot::Restore( const void* data, size_t size )
+{
+	PROFILE_ZONE( "RestoreState" );
+	Header h;
+	if (size < sizeof( Header )) return false;
+	memcpy( &h, data, sizeof( Header ) );
+	if (memcmp( h.magic, "TSNP", 4 ) || h.version != VERSION) return false;
+	if (h.delta && h.base != baseId)
+	{
+		// the base is not in memory: restore the full snapshot in the base file first
+		if (baseFile.empty()) return false;
+		Asset file( baseFile.c_str(), false );
+		if (!file.IsValid() || !Restore( file.Data(), file.Size() ) || baseId != h.base) return false;
+	}
+	if (!Decode( (const uchar*)data, size, h, raw )) return false;
+	bool fits = true;
+	if (!h.delta) for (Block& b : blocks) b.base.clear(); // blocks missing from the snapshot have no base
+	const uchar* p = raw.data(), * end = p + raw.size();
+	while (p < end)
+	{
+		uint head[3] = {};
+		const size_t headSize = h.delta ? 12 : 8;
+		if ((size_t)(end - p) < headSize) return false;
+		memcpy( head, p, headSize ), p += headSize;
+		Block* b = Find( head[0] );
+		const size_t blockSize = head[1];
+		if (!h.delta)
+		{
+			if ((size_t)(end - p) < blockSize) return false;
+			if (b) b->base.assign( p, p + blockSize ), fits &= b->set( p, blockSize );
+			p += blockSize;
+			continue;
+		}
+		// a delta: xor the changed pages into a copy of the base
+		if (b) b->scratch.assign( b->base.begin(), b->base.begin() + min( b->base.size(), blockSize ) ), b->scratch.resize( blockSize );
+		for (uint i = 0; i < head[2]; i++)
+		{
+			uint page;
+			if ((size_t)(end - p) < 4) return false;
+			memcpy( &page, p, 4 ), p += 4;
+			const size_t offset = (size_t)page * PAGE;
+			if (offset >= blockSize) return false;
+			const size_t n = min( (size_t)PAGE, blockSize - offset );
+			if ((size_t)(end - p) < n) return false;
+			if (b) for (size_t j = 0; j < n; j++) b->scratch[offset + j] ^= p[j];
+			p += n;
+		}
+		if (b) fits &= b->set( b->scratch.data(), blockSize );
+	}
+	if (!h.delta) baseId = h.id;
+	return fits;
+}
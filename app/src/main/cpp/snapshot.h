@@ -0,0 +1,87 @@
+#ifndef _SNAPSHOT_H
+#define _SNAPSHOT_H
+
+// game state snapshots: a registry of named blocks of state that are saved and restored
+// together. A block is plain data, copied as bytes: a trivially copyable object, or a vector
+// of them (an arena) whose length is saved along. Objects with pointers register a pair of
+// callbacks that write and read plain data through a Stream instead. Blocks are found back
+// by the hash of their name; blocks that a snapshot lacks are left alone, so adding state to
+// a game does not invalidate older saves.
+// Save writes a full snapshot, or a delta against the last full one: each block is compared
+// with its bytes at that time in pages of PAGE bytes, and only the pages that differ are
+// stored. Once more than maxDelta of the state differs, Save writes a full snapshot again.
+// Snapshots are zlib (fast) or LZMA (small) compressed. When baseFile is set, full snapshots
+// are written to that file and Save returns a delta against it in all cases, so that the
+// state handed to the OS stays small; Restore reads the file when a delta needs it.
+
+class Snapshot
+{
+public:
+	enum { STORE = 0, ZLIB, LZMA }; // as in Pack
+	enum { VERSION = 1, PAGE = 256, LZMAPROPS = 5 };
+	struct Header { char magic[4]; uint version, delta, method, id, base, size, packedSize; }; // id: crc32 of the packed data
+	// plain data for custom blocks
+	class Stream
+	{
+	public:
+		Stream( vector<uchar>& out ) : out( &out ) {}
+		Stream( const uchar* data, size_t size ) : in( data ), size( size ) {}
+		void Write( const void* data, size_t bytes ) { out->insert( out->end(), (const uchar*)data, (const uchar*)data + bytes ); }
+		bool Read( void* data, size_t bytes ) { if (bytes > size - pos) return false; memcpy( data, in + pos, bytes ), pos += bytes; return true; }
+		template <class T> void Write( const T& v ) { static_assert(is_trivially_copyable<T>::value, "plain data only"); Write( &v, sizeof( T ) ); }
+		template <class T> bool Read( T& v ) { static_assert(is_trivially_copyable<T>::value, "plain data only"); return Read( &v, sizeof( T ) ); }
+		template <class T> void Write( const vector<T>& v ) { Write( (uint)v.size() ), Write( v.data(), v.size() * sizeof( T ) ); }
+		template <class T> bool Read( vector<T>& v )
+		{
+			uint n;
+			if (!Read( n ) || n > (size - pos) / sizeof( T )) return false;
+			v.resize( n );
+			return Read( v.data(), n * sizeof( T ) );
+		}
+	private:
+		vector<uchar>* out = 0;
+		const uchar* in = 0;
+		size_t size = 0, pos = 0;
+	};
+	template <class T> void Add( const char* name, T& object )
+	{
+		static_assert(is_trivially_copyable<T>::value, "plain data only; use callbacks");
+		AddBlock( name, [&object]( vector<uchar>&, size_t& size ) { size = sizeof( T ); return (const uchar*)&object; },
+			[&object]( const uchar* data, size_t size ) { if (size != sizeof( T )) return false; memcpy( (void*)&object, data, size ); return true; } );
+	}
+	template <class T> void Add( const char* name, vector<T>& arena )
+	{
+		static_assert(is_trivially_copyable<T>::value, "plain data only; use callbacks");
+		AddBlock( name, [&arena]( vector<uchar>&, size_t& size ) { size = arena.size() * sizeof( T ); return (const uchar*)arena.data(); },
+			[&arena]( const uchar* data, size_t size ) { if (size % sizeof( T )) return false; arena.resize( size / sizeof( T ) ); memcpy( (void*)arena.data(), data, size ); return true; } );
+	}
+	void Add( const char* name, function<void( Stream& )> save, function<bool( Stream& )> load );
+	void Remove( const char* name );
+	bool Save( vector<uchar>& out, bool full = false ); // returns false if the base file can't be written
+	bool Restore( const void* data, size_t size ); // returns false if the snapshot or a block does not fit
+	int method = ZLIB, level = 1;
+	float maxDelta = 0.25f; // fraction of the state
+	string baseFile;
+private:
+	typedef function<const uchar*( vector<uchar>& scratch, size_t& size )> Getter; // current bytes of a block
+	typedef function<bool( const uchar* data, size_t size )> Setter;
+	struct Block
+	{
+		uint id;
+		Getter get;
+		Setter set;
+		vector<uchar> base, scratch; // bytes at the last full snapshot; custom block data
+		vector<uint> pages; // pages that differ from the base
+		const uchar* data = 0;
+		size_t size = 0;
+	};
+	void AddBlock( const char* name, Getter get, Setter set );
+	Block* Find( uint id );
+	bool Encode( vector<uchar>& out, bool delta );
+	bool Decode( const uchar* data, size_t size, Header& h, vector<uchar>& raw );
+	vector<Block> blocks;
+	vector<uchar> raw;
+	uint baseId = 0; // 0: no base yet
+};
+
+#endif // _SNAPSHOT_H
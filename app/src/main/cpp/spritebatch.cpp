@@ -0,0 +1,83 @@
+#include "template.h"
+
+// -----------------------------------------------------------
+// Sprite batch
+// -----------------------------------------------------------
+
+int SpriteBatch::AddSprite( Sprite* sprite )
+{
+	// batches always draw from the run-length representation
+	if (!sprite->IsCompiled()) sprite->Compile();
+	sprites.push_back( sprite );
+	spriteWidth.push_back( sprite->GetWidth() );
+	spriteHeight.push_back( sprite->GetHeight() );
+	return (int)sprites.size() - 1;
+}
+
+void SpriteBatch::Add( int count, const int* px, const int* py, const ushort* spriteId, const ushort* spriteFrame, const ushort* drawFlags )
+{
+	x.insert( x.end(), px, px + count );
+	y.insert( y.end(), py, py + count );
+	id.insert( id.end(), spriteId, spriteId + count );
+	frame.insert( frame.end(), spriteFrame, spriteFrame + count );
+	flags.insert( flags.end(), drawFlags, drawFlags + count );
+}
+
+void SpriteBatch::Draw( Surface* target )
+{
+	PROFILE_ZONE( "SpriteBatch" );
+	const int n = Count(), w = target->width, h = target->height;
+	// cull: the index is always written, the count only advances for visible instances
+	const int* px = x.data(), * py = y.data(), * sw = spriteWidth.data(), * sh = spriteHeight.data();
+	const ushort* sid = id.data();
+	visible.resize( n );
+	uint count = 0;
+	for (int i = 0; i < n; i++)
+	{
+		visible[count] = i;
+		count += (px[i] > -sw[sid[i]]) & (px[i] < w) & (py[i] > -sh[sid[i]]) & (py[i] < h);
+	}
+	// group per sprite with a stable counting sort on the sprite id
+	first.assign( sprites.size() + 1, 0 );
+	for (uint i = 0; i < count; i++) first[sid[visible[i]] + 1]++;
+	for (size_t s = 1; s < first.size(); s++) first[s] += first[s - 1];
+	order.resize( count );
+	for (uint i = 0; i < count; i++) order[first[sid[visible[i]]]++] = visible[i];
+	if (target->dirty && count > 0)
+	{
+		// one rectangle around all visible instances; bands draw without marking
+		int x1 = w, y1 = h, x2 = 0, y2 = 0;
+		for (uint i : order)
+		{
+			x1 = min( x1, px[i] ), y1 = min( y1, py[i] );
+			x2 = max( x2, px[i] + sw[sid[i]] ), y2 = max( y2, py[i] + sh[sid[i]] );
+		}
+		target->MarkDirty( x1, y1, x2, y2 );
+	}
+	// draw; bands do not overlap, so they can be drawn in parallel
+	JobManager* jm = JobManager::GetJobManager();
+	if (count < PARALLEL || jm->NumThreads() < 2) { DrawBand( target, 0, h ); return; }
+	jobs.resize( (h + BANDHEIGHT - 1) / BANDHEIGHT );
+	for (int b = 0; b < (int)jobs.size(); b++)
+	{
+		jobs[b].batch = this, jobs[b].target = target;
+		jobs[b].y1 = b * BANDHEIGHT, jobs[b].y2 = min( h, (b + 1) * BANDHEIGHT );
+		jm->AddJob( &jobs[b] );
+	}
+	jm->RunJobs();
+}
+
+void SpriteBatch::DrawBand( Surface* target, int y1, int y2 )
+{
+	// draw the visible instances, clipped to the target width and to rows [y1,y2)
+	const int w = target->width;
+	for (uint i : order)
+	{
+		const int sy = y[i], sh = spriteHeight[id[i]];
+		if (sy >= y2 || sy + sh <= y1) continue;
+		const int sx = x[i], sw = spriteWidth[id[i]];
+		const int u1 = max( 0, -sx ), u2 = min( sw, w - sx ), v1 = max( 0, y1 - sy ), v2 = min( sh, y2 - sy );
+		Pixel* dst = target->buffer + (sy + v1) * w + sx + u1;
+		sprites[id[i]]->DrawSpans( dst, w, u1, u2, v1, v2, frame[i], (flags[i] & Sprite::FLARE) != 0 );
+	}
+}
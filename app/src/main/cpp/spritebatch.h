@@ -0,0 +1,45 @@
+#ifndef _SPRITEBATCH_H
+#define _SPRITEBATCH_H
+
+// sprite batch: draws many instances of a small set of sprites in one call. Instance data is
+// kept as separate arrays (structure of arrays), so games can update positions in place and
+// culling runs over tightly packed coordinates. Draw culls off-screen instances, groups the
+// rest per sprite (counting sort, submission order is kept within a sprite) and draws them
+// in horizontal bands on the job manager. Instances of different sprites are therefore not
+// drawn in submission order; use one batch per layer when overlap order matters.
+
+class SpriteBatch
+{
+public:
+	enum { BANDHEIGHT = 16, PARALLEL = 512 }; // below PARALLEL visible instances, draw on the caller
+	int AddSprite( Sprite* sprite ); // returns the sprite id; the sprite is compiled if needed
+	void Clear() { x.clear(), y.clear(), id.clear(), frame.clear(), flags.clear(); }
+	void Add( int px, int py, uint spriteId, uint spriteFrame = 0, uint drawFlags = 0 )
+	{
+		x.push_back( px ), y.push_back( py ), id.push_back( (ushort)spriteId );
+		frame.push_back( (ushort)spriteFrame ), flags.push_back( (ushort)drawFlags );
+	}
+	void Add( int count, const int* px, const int* py, const ushort* spriteId, const ushort* spriteFrame, const ushort* drawFlags );
+	void Draw( Surface* target );
+	int Count() const { return (int)x.size(); }
+	int Drawn() const { return (int)order.size(); } // visible instances in the last Draw
+	// instance data; all arrays have Count() elements
+	vector<int> x, y;
+	vector<ushort> id, frame, flags;
+private:
+	class BandJob : public Job
+	{
+	public:
+		void Main() { batch->DrawBand( target, y1, y2 ); }
+		SpriteBatch* batch;
+		Surface* target;
+		int y1, y2;
+	};
+	void DrawBand( Surface* target, int y1, int y2 );
+	vector<Sprite*> sprites;
+	vector<int> spriteWidth, spriteHeight;
+	vector<uint> visible, order, first;
+	vector<BandJob> jobs;
+};
+
+#endif // _SPRITEBATCH_H
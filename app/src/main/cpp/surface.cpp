@@ -1,4 +1,254 @@
 #include "template.h"
+#include "zlib.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define ROWKERNELS_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define ROWKERNELS_NEON
+#if !defined(__aarch64__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#endif
+
+// -----------------------------------------------------------
+// Row kernels
+// -----------------------------------------------------------
+
+static void AddBlendRow( Pixel* d, const Pixel* s, int n ) { for (int i = 0; i < n; i++) d[i] = AddBlend( d[i], s[i] ); }
+static void SubBlendRow( Pixel* d, const Pixel* s, int n ) { for (int i = 0; i < n; i++) d[i] = SubBlend( d[i], s[i] ); }
+static void CopyKeyedRow( Pixel* d, const Pixel* s, int n ) { for (int i = 0; i < n; i++) if (s[i] & 0xffffff) d[i] = s[i]; }
+static void AddBlendKeyedRow( Pixel* d, const Pixel* s, int n ) { for (int i = 0; i < n; i++) if (s[i] & 0xffffff) d[i] = AddBlend( s[i], d[i] ); }
+
+static const RowKernels scalarKernels = { AddBlendRow, SubBlendRow, CopyKeyedRow, AddBlendKeyedRow, "scalar" };
+RowKernels rowKernels = scalarKernels;
+static bool simdRows = false; // SIMD png unfiltering and pixel conversion, see SelectRowKernels
+static bool VerifyUnfilter();
+static bool simdResize = false; // SIMD bilinear resize rows
+static bool VerifyResize();
+static bool simdIndexed = false; // NEON palette lookups
+static bool VerifyIndexed();
+
+// AddBlend and SubBlend are per-channel saturating operations that clear alpha, which maps
+// directly on 8-bit saturating vector arithmetic followed by a mask. Tails use the scalar code.
+#if defined(ROWKERNELS_SSE2)
+
+static void AddBlendRowSSE2( Pixel* d, const Pixel* s, int n )
+{
+	const __m128i rgb = _mm_set1_epi32( 0xffffff );
+	int i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		const __m128i a = _mm_loadu_si128( (__m128i*)(d + i) ), b = _mm_loadu_si128( (const __m128i*)(s + i) );
+		_mm_storeu_si128( (__m128i*)(d + i), _mm_and_si128( _mm_adds_epu8( a, b ), rgb ) );
+	}
+	AddBlendRow( d + i, s + i, n - i );
+}
+
+static void SubBlendRowSSE2( Pixel* d, const Pixel* s, int n )
+{
+	const __m128i rgb = _mm_set1_epi32( 0xffffff );
+	int i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		const __m128i a = _mm_loadu_si128( (__m128i*)(d + i) ), b = _mm_loadu_si128( (const __m128i*)(s + i) );
+		_mm_storeu_si128( (__m128i*)(d + i), _mm_and_si128( _mm_subs_epu8( a, b ), rgb ) );
+	}
+	SubBlendRow( d + i, s + i, n - i );
+}
+
+static void CopyKeyedRowSSE2( Pixel* d, const Pixel* s, int n )
+{
+	const __m128i rgb = _mm_set1_epi32( 0xffffff ), zero = _mm_setzero_si128();
+	int i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		const __m128i a = _mm_loadu_si128( (__m128i*)(d + i) ), b = _mm_loadu_si128( (const __m128i*)(s + i) );
+		const __m128i key = _mm_cmpeq_epi32( _mm_and_si128( b, rgb ), zero );
+		_mm_storeu_si128( (__m128i*)(d + i), _mm_or_si128( _mm_and_si128( key, a ), _mm_andnot_si128( key, b ) ) );
+	}
+	CopyKeyedRow( d + i, s + i, n - i );
+}
+
+static void AddBlendKeyedRowSSE2( Pixel* d, const Pixel* s, int n )
+{
+	const __m128i rgb = _mm_set1_epi32( 0xffffff ), zero = _mm_setzero_si128();
+	int i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		const __m128i a = _mm_loadu_si128( (__m128i*)(d + i) ), b = _mm_loadu_si128( (const __m128i*)(s + i) );
+		const __m128i key = _mm_cmpeq_epi32( _mm_and_si128( b, rgb ), zero );
+		const __m128i sum = _mm_and_si128( _mm_adds_epu8( a, b ), rgb );
+		_mm_storeu_si128( (__m128i*)(d + i), _mm_or_si128( _mm_and_si128( key, a ), _mm_andnot_si128( key, sum ) ) );
+	}
+	AddBlendKeyedRow( d + i, s + i, n - i );
+}
+
+static const RowKernels simdKernels = { AddBlendRowSSE2, SubBlendRowSSE2, CopyKeyedRowSSE2, AddBlendKeyedRowSSE2, "sse2" };
+
+#elif defined(ROWKERNELS_NEON)
+
+#define U8(x) vreinterpretq_u8_u32( x )
+#define U32(x) vreinterpretq_u32_u8( x )
+
+static void AddBlendRowNEON( Pixel* d, const Pixel* s, int n )
+{
+	const uint32x4_t rgb = vdupq_n_u32( 0xffffff );
+	int i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		const uint32x4_t a = vld1q_u32( d + i ), b = vld1q_u32( s + i );
+		vst1q_u32( d + i, vandq_u32( U32( vqaddq_u8( U8( a ), U8( b ) ) ), rgb ) );
+	}
+	AddBlendRow( d + i, s + i, n - i );
+}
+
+static void SubBlendRowNEON( Pixel* d, const Pixel* s, int n )
+{
+	const uint32x4_t rgb = vdupq_n_u32( 0xffffff );
+	int i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		const uint32x4_t a = vld1q_u32( d + i ), b = vld1q_u32( s + i );
+		vst1q_u32( d + i, vandq_u32( U32( vqsubq_u8( U8( a ), U8( b ) ) ), rgb ) );
+	}
+	SubBlendRow( d + i, s + i, n - i );
+}
+
+static void CopyKeyedRowNEON( Pixel* d, const Pixel* s, int n )
+{
+	const uint32x4_t rgb = vdupq_n_u32( 0xffffff );
+	int i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		const uint32x4_t a = vld1q_u32( d + i ), b = vld1q_u32( s + i );
+		vst1q_u32( d + i, vbslq_u32( vtstq_u32( b, rgb ), b, a ) );
+	}
+	CopyKeyedRow( d + i, s + i, n - i );
+}
+
+static void AddBlendKeyedRowNEON( Pixel* d, const Pixel* s, int n )
+{
+	const uint32x4_t rgb = vdupq_n_u32( 0xffffff );
+	int i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		const uint32x4_t a = vld1q_u32( d + i ), b = vld1q_u32( s + i );
+		const uint32x4_t sum = vandq_u32( U32( vqaddq_u8( U8( a ), U8( b ) ) ), rgb );
+		vst1q_u32( d + i, vbslq_u32( vtstq_u32( b, rgb ), sum, a ) );
+	}
+	AddBlendKeyedRow( d + i, s + i, n - i );
+}
+
+#undef U8
+#undef U32
+
+static const RowKernels simdKernels = { AddBlendRowNEON, SubBlendRowNEON, CopyKeyedRowNEON, AddBlendKeyedRowNEON, "neon" };
+
+#endif
+
+static bool CPUHasSIMD()
+{
+#if defined(ROWKERNELS_SSE2) && (defined(_M_X64) || defined(__x86_64__))
+	return true; // SSE2 is part of x86-64
+#elif defined(ROWKERNELS_SSE2)
+	return __builtin_cpu_supports( "sse2" );
+#elif defined(ROWKERNELS_NEON) && defined(__aarch64__)
+	return true; // NEON is mandatory on ARMv8
+#elif defined(ROWKERNELS_NEON)
+	return (getauxval( AT_HWCAP ) & HWCAP_NEON) != 0;
+#else
+	return false;
+#endif
+}
+
+static bool VerifyRowKernels( const RowKernels& k )
+{
+	// bit-exactness check against the scalar kernels; odd row length exercises the tails,
+	// and every third source pixel is made transparent for the keyed kernels
+	enum { N = 67 };
+	Pixel s[N], d0[N], d1[N];
+	uint seed = 0x2545f491;
+	const RowKernel test[4] = { k.addBlend, k.subBlend, k.copyKeyed, k.addBlendKeyed };
+	const RowKernel ref[4] = { scalarKernels.addBlend, scalarKernels.subBlend, scalarKernels.copyKeyed, scalarKernels.addBlendKeyed };
+	for (int j = 0; j < 4; j++) for (int pass = 0; pass < 4; pass++)
+	{
+		for (int i = 0; i < N; i++)
+		{
+			seed ^= seed << 13, seed ^= seed >> 17, seed ^= seed << 5, s[i] = seed;
+			seed ^= seed << 13, seed ^= seed >> 17, seed ^= seed << 5, d0[i] = d1[i] = seed;
+			if (i % 3 == pass % 3) s[i] &= 0xff000000;
+		}
+		ref[j]( d0, s, N );
+		test[j]( d1, s, N );
+		if (memcmp( d0, d1, sizeof( d0 ) )) return false;
+	}
+	return true;
+}
+
+bool SelectRowKernels( bool allowSIMD )
+{
+	rowKernels = scalarKernels;
+#if defined(ROWKERNELS_SSE2) || defined(ROWKERNELS_NEON)
+	if (allowSIMD && CPUHasSIMD() && VerifyRowKernels( simdKernels )) rowKernels = simdKernels;
+	simdRows = rowKernels.addBlend != scalarKernels.addBlend && VerifyUnfilter();
+	simdResize = rowKernels.addBlend != scalarKernels.addBlend && VerifyResize();
+	simdIndexed = rowKernels.addBlend != scalarKernels.addBlend && VerifyIndexed();
+#endif
+	return rowKernels.addBlend != scalarKernels.addBlend;
+}
+
+// -----------------------------------------------------------
+// Dirty region
+// -----------------------------------------------------------
+
+void DirtyRegion::Add( int x1, int y1, int x2, int y2 )
+{
+	Rect r = { x1, y1, x2, y2 };
+	// absorb every rectangle that overlaps or touches r; a merged r may reach new ones
+	for (int i = 0; i < count;)
+	{
+		const Rect& q = rect[i];
+		if (q.x1 > r.x2 || q.x2 < r.x1 || q.y1 > r.y2 || q.y2 < r.y1) { i++; continue; }
+		r.x1 = min( r.x1, q.x1 ), r.y1 = min( r.y1, q.y1 ), r.x2 = max( r.x2, q.x2 ), r.y2 = max( r.y2, q.y2 );
+		rect[i] = rect[--count], i = 0;
+	}
+	if (count < MAXRECTS) { rect[count++] = r; return; }
+	// full: grow the rectangle that needs the smallest increase in area
+	int best = 0;
+	int64_t bestGrowth = INT64_MAX;
+	for (int i = 0; i < count; i++)
+	{
+		const Rect& q = rect[i];
+		const int64_t w = max( q.x2, r.x2 ) - min( q.x1, r.x1 ), h = max( q.y2, r.y2 ) - min( q.y1, r.y1 );
+		const int64_t growth = w * h - (int64_t)(q.x2 - q.x1) * (q.y2 - q.y1);
+		if (growth < bestGrowth) bestGrowth = growth, best = i;
+	}
+	const Rect q = rect[best];
+	rect[best] = rect[--count];
+	Add( min( q.x1, r.x1 ), min( q.y1, r.y1 ), max( q.x2, r.x2 ), max( q.y2, r.y2 ) );
+}
+
+int DirtyRegion::Rows( int* y1, int* y2 ) const
+{
+	// project the rectangles on the y-axis: sort by top row, then merge touching ranges
+	int order[MAXRECTS], n = 0;
+	for (int i = 0; i < count; i++)
+	{
+		int j = i;
+		for (; j > 0 && rect[order[j - 1]].y1 > rect[i].y1; j--) order[j] = order[j - 1];
+		order[j] = i;
+	}
+	for (int i = 0; i < count; i++)
+	{
+		const Rect& r = rect[order[i]];
+		if (n > 0 && r.y1 <= y2[n - 1]) y2[n - 1] = max( y2[n - 1], r.y2 );
+		else y1[n] = r.y1, y2[n] = r.y2, n++;
+	}
+	return n;
+}
 
 // -----------------------------------------------------------
 // True-color surface class implementation
@@ -9,29 +259,32 @@ Surface::Surface( const char* file )
 	LoadPNGImage( file );
 }
 
-void Surface::LoadPNGImage( const char* file )
+void Surface::LoadPNGImage( const char* file, bool direct )
 {
+	Asset png( file );
+	if (!png.IsValid() || (direct && decodePNGDirect( png.Data(), png.Size() ))) return;
+	// interlaced images and bit depths other than 8 take the generic decoder
 	vector<uchar> pixels;
 	uint w = 0, h = 0;
-	if (LoadPNGFile( file, w, h, pixels ))
-	{
-		width = w, height = h;
-		buffer = new Pixel[w * h];
-		uchar* s = pixels.data();
-		for (uint i = 0; i < w * h; i++) buffer[i] = (s[i * 4 + 0] << 16) + (s[i * 4 + 1] << 8) + s[i * 4 + 2] + (255 << 24);
-	}
+	if (decodePNG( pixels, w, h, png.Data(), png.Size() ) != 0) return;
+	width = w, height = h, flags |= OWNER;
+	buffer = new Pixel[w * h];
+	uchar* s = pixels.data();
+	for (uint i = 0; i < w * h; i++) buffer[i] = (s[i * 4 + 0] << 16) + (s[i * 4 + 1] << 8) + s[i * 4 + 2] + (255 << 24);
 }
 
 Surface::~Surface()
 {
+	delete mip;
 	if ((flags & OWNER) == 0) return; // only delete if the buffer was not passed to us
-	delete buffer;
+	delete[] buffer;
 }
 
 void Surface::Clear( Pixel color )
 {
 	int s = width * height;
 	for (int i = 0; i < s; i++) buffer[i] = color;
+	MarkDirty( 0, 0, width, height );
 }
 
 void Surface::Centre( const char* s, int y1, Pixel color )
@@ -42,63 +295,44 @@ void Surface::Centre( const char* s, int y1, Pixel color )
 
 void Surface::Print( const char* s, int x1, int y1, Pixel color )
 {
-	if (!fontInitialized)
-	{
-		InitCharset();
-		fontInitialized = true;
-	}
-	Pixel* t = buffer + x1 + y1 * width;
-	for (int i = 0; i < (int)(strlen( s )); i++, t += 6)
-	{
-		long pos = 0;
-		if ((s[i] >= 'A') && (s[i] <= 'Z')) pos = transl[(unsigned short)(s[i] - ('A' - 'a'))];
-		else pos = transl[(unsigned short)s[i]];
-		Pixel* a = t;
-		char* c = (char*)font[pos];
-		for (int v = 0; v < 5; v++, c++, a += width)
-			for (int h = 0; h < 5; h++) if (*c++ == 'o') *(a + h) = color, * (a + h + width) = 0;
-	}
-}
-
-void Surface::Resize( Surface* orig )
-{
-	Pixel* src = orig->buffer, * dst = buffer;
-	int u, v, owidth = orig->width, oheight = orig->height;
-	int dx = (owidth << 10) / width, dy = (oheight << 10) / height;
-	for (v = 0; v < height; v++)
+	const int l = (int)strlen( s );
+	MarkDirty( x1, y1, x1 + l * 6, y1 + 6 ); // 5 rows plus shadow
+	// rows [v1,v2) of the 6 glyph rows are visible; characters are clipped as a whole
+	// when possible, and otherwise by masking their columns
+	const int v1 = max( 0, -y1 ), v2 = min( 6, height - y1 );
+	if (v1 >= v2) return;
+	Pixel* row = buffer + (y1 + v1) * width;
+	for (int i = 0; i < l; i++, x1 += 6)
 	{
-		for (u = 0; u < width; u++)
+		if (x1 >= width) break;
+		if (x1 + 5 <= 0) continue;
+		const uchar* on = fontOn[transl[(uchar)s[i]]], * off = fontOff[transl[(uchar)s[i]]];
+		Pixel* a = row + x1;
+		if (x1 >= 0 && x1 + 5 <= width && v1 == 0 && v2 == 6) for (int v = 0; v < 5; v++, a += width)
 		{
-			int su = u * dx, sv = v * dy;
-			Pixel* s = src + (su >> 10) + (sv >> 10) * owidth;
-			int ufrac = su & 1023, vfrac = sv & 1023;
-			int w4 = (ufrac * vfrac) >> 12;
-			int w3 = ((1023 - ufrac) * vfrac) >> 12;
-			int w2 = (ufrac * (1023 - vfrac)) >> 12;
-			int w1 = ((1023 - ufrac) * (1023 - vfrac)) >> 12;
-			int x2 = ((su + dx) > ( (owidth - 1) << 10 )) ? 0 : 1;
-			int y2 = ((sv + dy) > ((oheight - 1) << 10)) ? 0 : 1;
-			Pixel p1 = *s, p2 = *(s + x2), p3 = *(s + owidth * y2), p4 = *(s + owidth * y2 + x2);
-			unsigned int r = (((p1 & REDMASK) * w1 + (p2 & REDMASK) * w2 + (p3 & REDMASK) * w3 + (p4 & REDMASK) * w4) >> 8) & REDMASK;
-			unsigned int g = (((p1 & GREENMASK) * w1 + (p2 & GREENMASK) * w2 + (p3 & GREENMASK) * w3 + (p4 & GREENMASK) * w4) >> 8) & GREENMASK;
-			unsigned int b = (((p1 & BLUEMASK) * w1 + (p2 & BLUEMASK) * w2 + (p3 & BLUEMASK) * w3 + (p4 & BLUEMASK) * w4) >> 8) & BLUEMASK;
-			*(dst + u + v * width) = (Pixel)(r + g + b);
+			// whole character: pixels and their shadows, row by row
+			const uint c = on[v];
+			if (c) for (int h = 0; h < 5; h++) if (c & (1 << h)) a[h] = color, a[h + width] = 0;
+		}
+		else
+		{
+			const uint visible = (31 << max( 0, -x1 )) & ((1 << min( 5, width - x1 )) - 1);
+			for (int v = v1; v < v2; v++, a += width) for (int h = 0; h < 5; h++)
+				if (on[v] & visible & (1 << h)) a[h] = color; else if (off[v] & visible & (1 << h)) a[h] = 0;
 		}
 	}
 }
 
-
-void Surface::Line( float x1, float y1, float x2, float y2, Pixel c )
+bool Surface::ClipLine( float& x1, float& y1, float& x2, float& y2 ) const
 {
 #define OUTCODE(x,y) (((x)<xmin)?1:(((x)>xmax)?2:0))+(((y)<ymin)?4:(((y)>ymax)?8:0))
 	// clip (Cohen-Sutherland, https://en.wikipedia.org/wiki/Cohen%E2%80%93Sutherland_algorithm)
 	const float xmin = 0, ymin = 0, xmax = width - 1.f, ymax = height - 1.f;
 	int c0 = OUTCODE( x1, y1 ), c1 = OUTCODE( x2, y2 );
-	bool accept = false;
 	while (1)
 	{
-		if (!(c0 | c1)) { accept = true; break; }
-		else if (c0 & c1) break; else
+		if (!(c0 | c1)) return true;
+		else if (c0 & c1) return false; else
 		{
 			float x, y;
 			const int co = c0 ? c0 : c1;
@@ -110,45 +344,182 @@ void Surface::Line( float x1, float y1, float x2, float y2, Pixel c )
 			else x2 = x, y2 = y, c1 = OUTCODE( x2, y2 );
 		}
 	}
-	if (!accept) return;
-	float b = x2 - x1;
-	float h = y2 - y1;
-	float l = fabsf( b );
-	if (fabsf( h ) > l) l = fabsf( h );
-	int il = (int)l;
-	float dx = b / (float)l;
-	float dy = h / (float)l;
-	for (int i = 0; i <= il; i++)
+#undef OUTCODE
+}
+
+void Surface::Line( float x1, float y1, float x2, float y2, Pixel c, int row1, int row2 )
+{
+	if (!ClipLine( x1, y1, x2, y2 )) return;
+	const int ix1 = (int)x1, iy1 = (int)y1, ix2 = (int)x2, iy2 = (int)y2;
+	MarkDirty( min( ix1, ix2 ), max( min( iy1, iy2 ), row1 ), max( ix1, ix2 ) + 1, min( max( iy1, iy2 ) + 1, row2 ) );
+	LineInt( ix1, iy1, ix2, iy2, c, row1, row2 );
+}
+
+void Surface::LineInt( int x1, int y1, int x2, int y2, Pixel c, int row1, int row2 )
+{
+	// Bresenham between pixels inside the surface, always stepping down, so that the pixel
+	// set does not depend on the row range; pixel i of an x-major line is on row
+	// y1 + (2 * i * dy + dx) / (2 * dx), which lets a row range start at its first row
+	if (y1 > y2) swap( x1, x2 ), swap( y1, y2 );
+	const int ya = max( y1, row1 ), yb = min( y2, row2 - 1 );
+	if (ya > yb) return;
+	const int dx = abs( x2 - x1 ), dy = y2 - y1, sx = x2 < x1 ? -1 : 1;
+	Pixel* a = buffer + ya * width;
+	if (dy == 0) // horizontal
+	{
+		a += min( x1, x2 );
+		for (int i = 0; i <= dx; i++) a[i] = c;
+	}
+	else if (dx == 0) // vertical
+	{
+		for (a += x1; a <= buffer + yb * width + x1; a += width) *a = c;
+	}
+	else if (dx == dy) // diagonal
+	{
+		const int step = width + sx;
+		a += x1 + sx * (ya - y1);
+		for (int y = ya; y <= yb; y++, a += step) *a = c;
+	}
+	else if (dy > dx) // y-major: one pixel per row
+	{
+		const int n = 2 * (ya - y1) * dx + dy;
+		int err = n % (2 * dy);
+		a += x1 + sx * (n / (2 * dy));
+		for (int y = ya; y <= yb; y++, a += width)
+		{
+			*a = c;
+			if ((err += 2 * dx) >= 2 * dy) err -= 2 * dy, a += sx;
+		}
+	}
+	else // x-major: one pixel per column
+	{
+		int i = ya == y1 ? 0 : ((2 * (ya - y1) - 1) * dx + 2 * dy - 1) / (2 * dy);
+		int err = (2 * i * dy + dx) % (2 * dx);
+		for (a += x1 + sx * i; i <= dx; i++, a += sx)
+		{
+			*a = c;
+			if ((err += 2 * dy) >= 2 * dx)
+			{
+				err -= 2 * dx, a += width;
+				if (a >= buffer + (yb + 1) * width) break;
+			}
+		}
+	}
+}
+
+static inline Pixel BlendCoverage( Pixel d, Pixel c, uint a )
+{
+	// d + (c - d) * a / 256 per color channel, a in [0,256]; keeps the alpha of d
+	const uint rb = (((c & 0xff00ff) * a + (d & 0xff00ff) * (256 - a)) >> 8) & 0xff00ff;
+	const uint g = (((c & 0xff00) * a + (d & 0xff00) * (256 - a)) >> 8) & 0xff00;
+	return (d & 0xff000000) + rb + g;
+}
+
+void Surface::LineAA( float x1, float y1, float x2, float y2, Pixel c, int row1, int row2 )
+{
+	if (!ClipLine( x1, y1, x2, y2 )) return;
+	row1 = max( row1, 0 ), row2 = min( row2, height );
+	// the rounded start can put the line up to half a pixel outside the clipped endpoints
+	MarkDirty( (int)min( x1, x2 ) - 1, max( (int)min( y1, y2 ) - 1, row1 ), (int)max( x1, x2 ) + 3, min( (int)max( y1, y2 ) + 3, row2 ) );
+	// Xiaolin Wu: integer coordinates are pixel centres; every step along the major axis
+	// covers the two pixels that straddle the line, weighted by their distance to it
+	const bool steep = fabsf( y2 - y1 ) > fabsf( x2 - x1 );
+	if (steep) swap( x1, y1 ), swap( x2, y2 );
+	if (x1 > x2) swap( x1, x2 ), swap( y1, y2 );
+	const float grad = x2 > x1 ? (y2 - y1) / (x2 - x1) : 0;
+	int xa = (int)(x1 + 0.5f), xb = (int)(x2 + 0.5f);
+	int yf = (int)lroundf( (y1 + grad * (xa - x1)) * 65536 );
+	const int dyf = (int)lroundf( grad * 65536 );
+	if (steep)
+	{
+		// x is the row here, so the row range limits the loop
+		if (xa < row1) yf += (row1 - xa) * dyf, xa = row1;
+		xb = min( xb, row2 - 1 );
+		for (int y = xa; y <= xb; y++, yf += dyf)
+		{
+			const int x = yf >> 16;
+			const uint f = (yf >> 8) & 255;
+			Pixel* a = buffer + y * width + x;
+			if (x >= 0) a[0] = BlendCoverage( a[0], c, 256 - f );
+			if (f && x + 1 >= 0 && x + 1 < width) a[1] = BlendCoverage( a[1], c, f );
+		}
+	}
+	else for (int x = xa; x <= xb; x++, yf += dyf)
 	{
-		*(buffer + (int)x1 + (int)y1 * width) = c;
-		x1 += dx, y1 += dy;
+		const int y = yf >> 16;
+		const uint f = (yf >> 8) & 255;
+		Pixel* a = buffer + y * width + x;
+		if (y >= row1 && y < row2) a[0] = BlendCoverage( a[0], c, 256 - f );
+		if (f && y + 1 >= row1 && y + 1 < row2) a[width] = BlendCoverage( a[width], c, f );
 	}
 }
 
+void Surface::LineList( const float* xy, int count, Pixel c, bool aa )
+{
+	// count lines of 4 floats each; one dirty rectangle for the batch instead of one per line
+	PROFILE_ZONE( "LineList" );
+	DirtyRegion* region = dirty;
+	float x1 = 1e30f, y1 = 1e30f, x2 = -1e30f, y2 = -1e30f;
+	dirty = 0;
+	for (int i = 0; i < count; i++, xy += 4)
+	{
+		if (aa) LineAA( xy[0], xy[1], xy[2], xy[3], c ); else Line( xy[0], xy[1], xy[2], xy[3], c );
+		x1 = min( x1, min( xy[0], xy[2] ) ), x2 = max( x2, max( xy[0], xy[2] ) );
+		y1 = min( y1, min( xy[1], xy[3] ) ), y2 = max( y2, max( xy[1], xy[3] ) );
+	}
+	dirty = region;
+	if (count > 0) MarkDirty( (int)max( x1, -1.f ) - 1, (int)max( y1, -1.f ) - 1, (int)min( x2, (float)width ) + 3, (int)min( y2, (float)height ) + 3 );
+}
+
+void Surface::Polyline( const float* xy, int points, Pixel c, bool closed, bool aa )
+{
+	// points pairs of floats; connects consecutive points, and the last to the first if closed
+	PROFILE_ZONE( "Polyline" );
+	DirtyRegion* region = dirty;
+	float x1 = 1e30f, y1 = 1e30f, x2 = -1e30f, y2 = -1e30f;
+	dirty = 0;
+	for (int i = 0; i < points; i++)
+	{
+		const float* p = xy + 2 * i, * q = i + 1 < points ? p + 2 : closed && points > 2 ? xy : 0;
+		if (q) { if (aa) LineAA( p[0], p[1], q[0], q[1], c ); else Line( p[0], p[1], q[0], q[1], c ); }
+		x1 = min( x1, p[0] ), x2 = max( x2, p[0] ), y1 = min( y1, p[1] ), y2 = max( y2, p[1] );
+	}
+	dirty = region;
+	if (points > 1) MarkDirty( (int)max( x1, -1.f ) - 1, (int)max( y1, -1.f ) - 1, (int)min( x2, (float)width ) + 3, (int)min( y2, (float)height ) + 3 );
+}
+
 void Surface::HLine( int x, int y, int l, Pixel color )
 {
 	uint* a = buffer + x + y * width;
 	for (int i = 0; i < l; i++) a[i] = color;
+	MarkDirty( x, y, x + l, y + 1 );
 }
 
 void Surface::VLine( int x, int y, int l, Pixel color )
 {
 	uint* a = buffer + x + y * width;
 	for (int i = 0; i < l; i++, a += width) *a = color;
+	MarkDirty( x, y, x + 1, y + l );
 }
 
 void Surface::Plot( int x, int y, Pixel c )
 {
 	if ((x >= 0) && (y >= 0) && (x < width) && (y < height))
-		buffer[x + y * width] = c;
+		buffer[x + y * width] = c, MarkDirty( x, y, x + 1, y + 1 );
 }
 
 void Surface::Box( int x1, int y1, int x2, int y2, Pixel c )
 {
-	Line( (float)x1, (float)y1, (float)x2, (float)y1, c );
-	Line( (float)x2, (float)y1, (float)x2, (float)y2, c );
-	Line( (float)x1, (float)y2, (float)x2, (float)y2, c );
-	Line( (float)x1, (float)y1, (float)x1, (float)y2, c );
+	// outline of [x1,x2] x [y1,y2], clipped once; edges outside the surface are skipped
+	if (x1 > x2) swap( x1, x2 );
+	if (y1 > y2) swap( y1, y2 );
+	if (x2 < 0 || y2 < 0 || x1 >= width || y1 >= height) return;
+	const int cx1 = max( x1, 0 ), cy1 = max( y1, 0 ), cx2 = min( x2, width - 1 ), cy2 = min( y2, height - 1 );
+	if (y1 >= 0) LineInt( cx1, y1, cx2, y1, c );
+	if (y2 < height) LineInt( cx1, y2, cx2, y2, c );
+	if (x1 >= 0) LineInt( x1, cy1, x1, cy2, c );
+	if (x2 < width) LineInt( x2, cy1, x2, cy2, c );
+	MarkDirty( cx1, cy1, cx2 + 1, cy2 + 1 );
 }
 
 void Surface::Bar( int x1, int y1, int x2, int y2, Pixel c )
@@ -159,6 +530,7 @@ void Surface::Bar( int x1, int y1, int x2, int y2, Pixel c )
 		for (int x = 0; x <= (x2 - x1); x++) a[x] = c;
 		a += width;
 	}
+	MarkDirty( x1, y1, x2 + 1, y2 + 1 );
 }
 
 void Surface::CopyTo( Surface* dst, int x, int y )
@@ -173,10 +545,11 @@ void Surface::CopyTo( Surface* dst, int x, int y )
 	if ((srcwidth + x) > dstwidth) srcwidth = dstwidth - x;
 	if ((srcheight + y) > dstheight) srcheight = dstheight - y;
 	if (x < 0) s -= x, srcwidth += x, x = 0;
-	if (y < 0) s -= y * srcwidth, srcheight += y, y = 0;
+	if (y < 0) s -= y * width, srcheight += y, y = 0;
 	if (srcwidth <= 0 || srcheight <= 0) return;
 	d += x + dstwidth * y;
-	for (int l = 0; l < srcheight; l++, d += dstwidth, s += srcwidth) memcpy( d, s, srcwidth * 4 );
+	for (int l = 0; l < srcheight; l++, d += dstwidth, s += width) memcpy( d, s, srcwidth * 4 );
+	dst->MarkDirty( x, y, x + srcwidth, y + srcheight );
 }
 
 void Surface::BlendCopyTo( Surface* dst, int x, int y )
@@ -191,15 +564,12 @@ void Surface::BlendCopyTo( Surface* dst, int x, int y )
 	if ((srcwidth + x) > dstwidth) srcwidth = dstwidth - x;
 	if ((srcheight + y) > dstheight) srcheight = dstheight - y;
 	if (x < 0) s -= x, srcwidth += x, x = 0;
-	if (y < 0) s -= y * srcwidth, srcheight += y, y = 0;
+	if (y < 0) s -= y * width, srcheight += y, y = 0;
 	if ((srcwidth > 0) && (srcheight > 0))
 	{
 		d += x + dstwidth * y;
-		for (int y = 0; y < srcheight; y++)
-		{
-			for (int x = 0; x < srcwidth; x++) d[x] = AddBlend( d[x], s[x] );
-			d += dstwidth, s += srcwidth;
-		}
+		for (int y = 0; y < srcheight; y++, d += dstwidth, s += width) rowKernels.addBlend( d, s, srcwidth );
+		dst->MarkDirty( x, y, x + srcwidth, y + srcheight );
 	}
 }
 
@@ -268,6 +638,19 @@ void Surface::InitCharset()
 	int i;
 	for (i = 0; i < 256; i++) transl[i] = 45;
 	for (i = 0; i < 50; i++) transl[(unsigned char)c[i]] = i;
+	for (i = 0; i < 26; i++) transl['A' + i] = transl['a' + i];
+	// row masks (bit h is column h): pixels drawn in the text color, and the shadow pixels
+	// below them that are cleared, as if rows were drawn top to bottom
+	for (int g = 0; g < 51; g++) for (int v = 0; v < 6; v++)
+	{
+		uint on = 0, above = 0;
+		for (int h = 0; h < 5; h++)
+		{
+			if (v < 5 && font[g][v][h] == 'o') on |= 1 << h;
+			if (v > 0 && font[g][v - 1][h] == 'o') above |= 1 << h;
+		}
+		fontOn[g][v] = (uchar)on, fontOff[g][v] = (uchar)(above & ~on);
+	}
 }
 
 void Surface::ScaleColor( unsigned int scale )
@@ -280,6 +663,7 @@ void Surface::ScaleColor( unsigned int scale )
 		unsigned int g = (((c & GREENMASK) * scale) >> 5) & GREENMASK;
 		buffer[i] = rb + g;
 	}
+	MarkDirty( 0, 0, width, height );
 }
 
 int Surface::decodePNG( vector<uchar>& out_image, uint& imgw, uint& imgh, const uchar* in_png, size_t in_size, bool convert_to_rgba32 )
@@ -782,16 +1166,944 @@ int Surface::decodePNG( vector<uchar>& out_image, uint& imgw, uint& imgh, const
 	return d.error;
 }
 
-bool Surface::LoadPNGFile( const char* fileName, uint& w, uint& h, vector<uchar>& image )
+// -----------------------------------------------------------
+// Indexed surfaces: palette lookups per row, with a pair table
+// for 4-bit data and NEON table lookups on ARMv8
+// -----------------------------------------------------------
+
+static void ExpandRow8( Pixel* d, const uchar* s, int n, const Pixel* pal, int i = 0 )
+{
+	for (; i + 4 <= n; i += 4)
+	{
+		const Pixel p0 = pal[s[i]], p1 = pal[s[i + 1]], p2 = pal[s[i + 2]], p3 = pal[s[i + 3]];
+		d[i] = p0, d[i + 1] = p1, d[i + 2] = p2, d[i + 3] = p3;
+	}
+	for (; i < n; i++) d[i] = pal[s[i]];
+}
+
+static void ExpandRow4( Pixel* d, const uchar* s, int u, int n, const Pixel* pal )
+{
+	// n pixels starting at pixel u of row s; the left pixel of a byte is in the low nibble
+	for (int i = 0; i < n; i++, u++) d[i] = pal[(s[u >> 1] >> ((u & 1) * 4)) & 15];
+}
+
+static void ExpandRow4Pairs( Pixel* d, const uchar* s, int u, int n, const Pixel (*pairs)[2] )
+{
+	// like ExpandRow4, with one lookup per byte in a table of 256 pixel pairs
+	int i = 0;
+	if (u & 1) d[i++] = pairs[s[u >> 1]][1];
+	for (const uchar* b = s + ((u + i) >> 1); i + 2 <= n; i += 2, b++) memcpy( d + i, pairs[*b], 8 );
+	if (i < n) d[i] = pairs[s[(u + i) >> 1]][0];
+}
+
+static void KeyedRow4( Pixel* d, const uchar* s, int u, int n, const Pixel* pal, int key )
+{
+	// ExpandRow4 skipping index key, a byte at a time
+	int i = u & 1;
+	if (i && (s[u >> 1] >> 4) != key) d[0] = pal[s[u >> 1] >> 4];
+	for (const uchar* b = s + ((u + i) >> 1); i + 2 <= n; i += 2, b++)
+	{
+		const int lo = *b & 15, hi = *b >> 4;
+		if (lo != key) d[i] = pal[lo];
+		if (hi != key) d[i + 1] = pal[hi];
+	}
+	if (i < n && (s[(u + i) >> 1] & 15) != key) d[i] = pal[s[(u + i) >> 1] & 15];
+}
+
+#if defined(ROWKERNELS_NEON) && defined(__aarch64__)
+
+struct PalettePlanes { uint8x16x4_t t[4][4]; }; // byte plane c of entries [64k,64k+64) in t[c][k]
+
+static void SplitPalette( PalettePlanes& p, const Pixel* pal, int entries )
+{
+	uchar planes[4][256] = {};
+	for (int i = 0; i < entries; i++) for (int c = 0; c < 4; c++) planes[c][i] = (uchar)(pal[i] >> (c * 8));
+	for (int c = 0; c < 4; c++) for (int k = 0; k < 4; k++) p.t[c][k] = vld1q_u8_x4( planes[c] + k * 64 );
+}
+
+static inline uint8x16_t Lookup256( const uint8x16x4_t* t, uint8x16_t idx )
+{
+	// vqtbx leaves lanes with out of range indices alone, so four 64-entry lookups cover 256
+	const uint8x16_t s64 = vdupq_n_u8( 64 );
+	uint8x16_t r = vqtbl4q_u8( t[0], idx );
+	r = vqtbx4q_u8( r, t[1], idx = vsubq_u8( idx, s64 ) );
+	r = vqtbx4q_u8( r, t[2], idx = vsubq_u8( idx, s64 ) );
+	return vqtbx4q_u8( r, t[3], vsubq_u8( idx, s64 ) );
+}
+
+static int ExpandRow8SIMD( Pixel* d, const uchar* s, int n, const PalettePlanes& p )
+{
+	int i = 0;
+	for (; i + 16 <= n; i += 16)
+	{
+		const uint8x16_t idx = vld1q_u8( s + i );
+		const uint8x16x4_t px = { { Lookup256( p.t[0], idx ), Lookup256( p.t[1], idx ), Lookup256( p.t[2], idx ), Lookup256( p.t[3], idx ) } };
+		vst4q_u8( (uchar*)(d + i), px );
+	}
+	return i;
+}
+
+static int ExpandRow4SIMD( Pixel* d, const uchar* s, int u, int n, const PalettePlanes& p )
+{
+	// even start only; 32 pixels per iteration from 16 bytes, with the 16-entry tables
+	if (u & 1) return 0;
+	int i = 0;
+	s += u >> 1;
+	const uint8x16_t low = vdupq_n_u8( 15 );
+	for (; i + 32 <= n; i += 32, s += 16)
+	{
+		const uint8x16_t b = vld1q_u8( s );
+		const uint8x16x2_t idx = vzipq_u8( vandq_u8( b, low ), vshrq_n_u8( b, 4 ) );
+		for (int h = 0; h < 2; h++)
+		{
+			const uint8x16x4_t px = { { vqtbl1q_u8( p.t[0][0].val[0], idx.val[h] ), vqtbl1q_u8( p.t[1][0].val[0], idx.val[h] ),
+				vqtbl1q_u8( p.t[2][0].val[0], idx.val[h] ), vqtbl1q_u8( p.t[3][0].val[0], idx.val[h] ) } };
+			vst4q_u8( (uchar*)(d + i + h * 16), px );
+		}
+	}
+	return i;
+}
+
+static bool VerifyIndexed()
+{
+	// same idea as VerifyRowKernels, for both depths and odd lengths
+	enum { N = 77 };
+	Pixel pal[256], d0[N], d1[N];
+	uchar s[N];
+	uint seed = 0x1b873593;
+	for (int i = 0; i < 256; i++) seed ^= seed << 13, seed ^= seed >> 17, seed ^= seed << 5, pal[i] = seed;
+	for (int i = 0; i < N; i++) seed ^= seed << 13, seed ^= seed >> 17, seed ^= seed << 5, s[i] = (uchar)seed;
+	PalettePlanes p;
+	SplitPalette( p, pal, 256 );
+	ExpandRow8( d0, s, N, pal );
+	ExpandRow8( d1, s, N, pal, ExpandRow8SIMD( d1, s, N, p ) );
+	if (memcmp( d0, d1, sizeof( d0 ) )) return false;
+	ExpandRow4( d0, s, 0, N, pal );
+	const int done = ExpandRow4SIMD( d1, s, 0, N, p );
+	ExpandRow4( d1 + done, s, done, N - done, pal );
+	return !memcmp( d0, d1, sizeof( d0 ) );
+}
+
+#else
+
+static bool VerifyIndexed() { return true; }
+
+#endif
+
+IndexedSurface::IndexedSurface( int w, int h, int bits ) : width( w ), height( h ), bits( bits == 4 ? 4 : 8 )
+{
+	pitch = this->bits == 8 ? w : (w + 1) / 2;
+	buffer = new uchar[pitch * h]();
+	memset( palette, 0, sizeof( palette ) );
+}
+
+IndexedSurface::IndexedSurface( const Surface* src, int bits ) : IndexedSurface( src->width, src->height, bits )
+{
+	// colors get palette entries in order of appearance; once the palette is full, further
+	// colors map to the nearest entry (squared rgb distance, no dithering)
+	const int entries = 1 << this->bits;
+	unordered_map<Pixel, uint> index;
+	int used = 0;
+	for (int y = 0; y < height; y++) for (int x = 0; x < width; x++)
+	{
+		const Pixel p = src->buffer[x + y * width];
+		auto it = index.find( p );
+		uint e;
+		if (it != index.end()) e = it->second;
+		else if (used < entries) palette[used] = p, e = index[p] = used++;
+		else
+		{
+			int best = INT_MAX;
+			e = 0;
+			for (int i = 0; i < used; i++)
+			{
+				const int dr = (int)((p >> 16) & 255) - (int)((palette[i] >> 16) & 255);
+				const int dg = (int)((p >> 8) & 255) - (int)((palette[i] >> 8) & 255), db = (int)(p & 255) - (int)(palette[i] & 255);
+				if (dr * dr + dg * dg + db * db < best) best = dr * dr + dg * dg + db * db, e = i;
+			}
+			index[p] = e;
+		}
+		Set( x, y, e );
+	}
+}
+
+IndexedSurface::~IndexedSurface()
+{
+	delete[] buffer;
+}
+
+void IndexedSurface::CyclePalette( int first, int count, int steps )
+{
+	// rotate entries [first,first+count) by steps; positive steps move colors up
+	if (count < 2 || first < 0 || first + count > 256) return;
+	steps %= count;
+	if (steps < 0) steps += count;
+	rotate( palette + first, palette + first + count - steps, palette + first + count );
+}
+
+void IndexedSurface::CopyTo( Surface* dst, int x, int y, const Pixel* pal ) const
+{
+	Blit( dst, x, y, pal ? pal : palette, -1 );
+}
+
+void IndexedSurface::CopyToKeyed( Surface* dst, int x, int y, uint key, const Pixel* pal ) const
+{
+	Blit( dst, x, y, pal ? pal : palette, (int)key );
+}
+
+void IndexedSurface::Blit( Surface* dst, int x, int y, const Pixel* pal, int key ) const
+{
+	PROFILE_ZONE( "IndexedBlit" );
+	// clip like Surface::CopyTo; u is the first visible source column
+	int w = min( width, dst->width - x ), h = min( height, dst->height - y ), u = 0, v = 0;
+	if (x < 0) u = -x, w += x, x = 0;
+	if (y < 0) v = -y, h += y, y = 0;
+	if (w <= 0 || h <= 0) return;
+	dst->MarkDirty( x, y, x + w, y + h );
+	Pixel* d = dst->buffer + x + y * dst->width;
+	const uchar* s = buffer + v * pitch;
+	if (key >= 0)
+	{
+		// keyed: per pixel, as the transparent pixels are typically spread out
+		for (int j = 0; j < h; j++, d += dst->width, s += pitch)
+			if (bits == 8) { for (int i = 0; i < w; i++) if (s[u + i] != key) d[i] = pal[s[u + i]]; }
+			else KeyedRow4( d, s, u, w, pal, key );
+		return;
+	}
+	// large blits prepare a table once: byte planes for NEON, or pixel pairs for 4-bit data
+	const bool prepare = w * h >= 1024;
+#if defined(ROWKERNELS_NEON) && defined(__aarch64__)
+	if (prepare && simdIndexed)
+	{
+		PalettePlanes p;
+		SplitPalette( p, pal, 1 << bits );
+		for (int j = 0; j < h; j++, d += dst->width, s += pitch)
+			if (bits == 8) ExpandRow8( d, s + u, w, pal, ExpandRow8SIMD( d, s + u, w, p ) ); else
+			{
+				const int done = ExpandRow4SIMD( d, s, u, w, p );
+				ExpandRow4( d + done, s, u + done, w - done, pal );
+			}
+		return;
+	}
+#endif
+	if (bits == 8) for (int j = 0; j < h; j++, d += dst->width, s += pitch) ExpandRow8( d, s + u, w, pal );
+	else if (prepare)
+	{
+		Pixel pairs[256][2];
+		for (int b = 0; b < 256; b++) pairs[b][0] = pal[b & 15], pairs[b][1] = pal[b >> 4];
+		for (int j = 0; j < h; j++, d += dst->width, s += pitch) ExpandRow4Pairs( d, s, u, w, pairs );
+	}
+	else for (int j = 0; j < h; j++, d += dst->width, s += pitch) ExpandRow4( d, s, u, w, pal );
+}
+
+// -----------------------------------------------------------
+// Triangle rasterization: half-space edge functions, evaluated
+// per 8x8 block with trivial accept and reject
+// -----------------------------------------------------------
+
+// attribute planes: value( px, py ) = a + dx * px + dy * py, at pixel centres (px + 0.5, py + 0.5)
+struct RasterPlane
+{
+	RasterPlane() = default;
+	RasterPlane( const vec2* v, float a0, float a1, float a2 )
+	{
+		const float x1 = v[1].x - v[0].x, y1 = v[1].y - v[0].y, x2 = v[2].x - v[0].x, y2 = v[2].y - v[0].y;
+		const float det = x1 * y2 - x2 * y1, r = det != 0 ? 1 / det : 0;
+		dx = ((a1 - a0) * y2 - (a2 - a0) * y1) * r, dy = ((a2 - a0) * x1 - (a1 - a0) * x2) * r;
+		a = a0 - dx * (v[0].x - 0.5f) - dy * (v[0].y - 0.5f);
+	}
+	int At( int x, int y ) const { return (int)((a + dx * x + dy * y) * 65536); } // 16.16
+	int Step() const { return (int)(dx * 65536); }
+	float a = 0, dx = 0, dy = 0;
+};
+
+struct FlatSpan
+{
+	void operator()( Pixel* d, int, int, int n ) const { for (int i = 0; i < n; i++) d[i] = color; }
+	Pixel color;
+};
+
+struct GouraudSpan
+{
+	void operator()( Pixel* d, int x, int y, int n ) const
+	{
+		int r = p[0].At( x, y ), g = p[1].At( x, y ), b = p[2].At( x, y );
+		const int dr = p[0].Step(), dg = p[1].Step(), db = p[2].Step();
+		for (int i = 0; i < n; i++, r += dr, g += dg, b += db)
+			d[i] = (min( max( r >> 16, 0 ), 255 ) << 16) + (min( max( g >> 16, 0 ), 255 ) << 8) + min( max( b >> 16, 0 ), 255 );
+	}
+	RasterPlane p[3];
+};
+
+struct TexturedSpan
+{
+	void operator()( Pixel* d, int x, int y, int n ) const
+	{
+		// affine: u and v are linear in screen space; texels are clamped to the texture
+		int u = p[0].At( x, y ), v = p[1].At( x, y );
+		const int du = p[0].Step(), dv = p[1].Step(), w = texture->width, h = texture->height;
+		const Pixel* t = texture->buffer;
+		for (int i = 0; i < n; i++, u += du, v += dv) d[i] = t[min( max( v >> 16, 0 ), h - 1 ) * w + min( max( u >> 16, 0 ), w - 1 )];
+	}
+	RasterPlane p[2];
+	const Surface* texture;
+};
+
+template <class S> static void RasterTriangle( Surface* s, const vec2* v, const S& span, int row1, int row2 )
+{
+	// vertices in 28.4 fixed point, limited to a guard band of 16384 pixels, so that edge
+	// values fit 64 bits and their changes within a block fit 32 bits
+	enum { SUB = 16, BLOCK = 8, GUARD = 16384 * SUB };
+	int64_t X[3], Y[3];
+	for (int i = 0; i < 3; i++)
+		X[i] = min( max( llroundf( v[i].x * SUB ), (long long)-GUARD ), (long long)GUARD ),
+		Y[i] = min( max( llroundf( v[i].y * SUB ), (long long)-GUARD ), (long long)GUARD );
+	const int64_t area = (X[1] - X[0]) * (Y[2] - Y[0]) - (Y[1] - Y[0]) * (X[2] - X[0]);
+	if (area == 0) return;
+	if (area < 0) swap( X[1], X[2] ), swap( Y[1], Y[2] );
+	// bounds of the pixel centres inside the bounding box, clipped to the surface and the row range
+	const int x1 = (int)max( (int64_t)0, (min( X[0], min( X[1], X[2] ) ) + SUB / 2 - 1) >> 4 );
+	const int y1 = (int)max( (int64_t)max( row1, 0 ), (min( Y[0], min( Y[1], Y[2] ) ) + SUB / 2 - 1) >> 4 );
+	const int x2 = (int)min( (int64_t)s->width - 1, (max( X[0], max( X[1], X[2] ) ) - SUB / 2) >> 4 );
+	const int y2 = (int)min( (int64_t)min( row2, s->height ) - 1, (max( Y[0], max( Y[1], Y[2] ) ) - SUB / 2) >> 4 );
+	if (x1 > x2 || y1 > y2) return;
+	// edge i runs from vertex i to vertex i + 1; e = a * px + b * py + c is >= 0 inside for
+	// sub-pixel positions (px,py). Pixels exactly on an edge belong to top and left edges only.
+	int64_t a[3], b[3], c[3];
+	for (int i = 0; i < 3; i++)
+	{
+		const int j = (i + 1) % 3;
+		a[i] = Y[i] - Y[j], b[i] = X[j] - X[i], c[i] = -a[i] * X[i] - b[i] * Y[i];
+		if (!(a[i] > 0 || (a[i] == 0 && b[i] > 0))) c[i]--;
+	}
+	s->MarkDirty( x1, y1, x2 + 1, y2 + 1 );
+	for (int by = y1 & ~(BLOCK - 1); by <= y2; by += BLOCK) for (int bx = x1 & ~(BLOCK - 1); bx <= x2; bx += BLOCK)
+	{
+		// edge values at the centre of the top-left pixel, and their extremes over the block
+		int64_t e[3];
+		bool reject = false, accept = true;
+		for (int i = 0; i < 3; i++)
+		{
+			e[i] = a[i] * (bx * SUB + SUB / 2) + b[i] * (by * SUB + SUB / 2) + c[i];
+			const int64_t ax = a[i] * (BLOCK - 1) * SUB, bY = b[i] * (BLOCK - 1) * SUB;
+			reject |= e[i] + max( ax, (int64_t)0 ) + max( bY, (int64_t)0 ) < 0;
+			accept &= e[i] + min( ax, (int64_t)0 ) + min( bY, (int64_t)0 ) >= 0;
+		}
+		if (reject) continue;
+		const int u1 = max( bx, x1 ), u2 = min( bx + BLOCK - 1, x2 ), v1 = max( by, y1 ), v2 = min( by + BLOCK - 1, y2 );
+		Pixel* row = s->buffer + v1 * s->width;
+		if (accept)
+		{
+			for (int y = v1; y <= v2; y++, row += s->width) span( row + u1, u1, y, u2 - u1 + 1 );
+			continue;
+		}
+		// partially covered: the covered pixels of a row are contiguous, as the triangle is convex;
+		// clamp the edge values, edges that pass the whole block then stay positive
+		const int stepx[3] = { (int)(a[0] * SUB), (int)(a[1] * SUB), (int)(a[2] * SUB) };
+		int rowe[3];
+		for (int i = 0; i < 3; i++)
+			rowe[i] = (int)min( max( e[i] + a[i] * (u1 - bx) * SUB + b[i] * (v1 - by) * SUB, (int64_t)-(1 << 30) ), (int64_t)(1 << 30) );
+		for (int y = v1; y <= v2; y++, row += s->width)
+		{
+			int first = -1, last = -1;
+			for (int x = u1, e0 = rowe[0], e1 = rowe[1], e2 = rowe[2]; x <= u2; x++, e0 += stepx[0], e1 += stepx[1], e2 += stepx[2])
+				if ((e0 | e1 | e2) >= 0) { if (first < 0) first = x; last = x; } else if (first >= 0) break;
+			if (first >= 0) span( row + first, first, y, last - first + 1 );
+			for (int i = 0; i < 3; i++) rowe[i] += (int)(b[i] * SUB);
+		}
+	}
+}
+
+void Surface::Triangle( const vec2& v0, const vec2& v1, const vec2& v2, Pixel color, int row1, int row2 )
 {
-	vector<uchar> buffer;
-	loadBinaryFile( buffer, fileName );
-	return decodePNG( image, w, h, &buffer[0], (uint)buffer.size() ) == 0;
+	const vec2 v[3] = { v0, v1, v2 };
+	RasterTriangle( this, v, FlatSpan{ color }, row1, row2 );
 }
 
-Sprite::Sprite( Surface* s, unsigned int frames ) :
+void Surface::Triangle( const vec2& v0, const vec2& v1, const vec2& v2, const vec3& c0, const vec3& c1, const vec3& c2, int row1, int row2 )
+{
+	const vec2 v[3] = { v0, v1, v2 };
+	GouraudSpan span;
+	span.p[0] = RasterPlane( v, c0.x * 255, c1.x * 255, c2.x * 255 );
+	span.p[1] = RasterPlane( v, c0.y * 255, c1.y * 255, c2.y * 255 );
+	span.p[2] = RasterPlane( v, c0.z * 255, c1.z * 255, c2.z * 255 );
+	RasterTriangle( this, v, span, row1, row2 );
+}
+
+void Surface::Triangle( const vec2& v0, const vec2& v1, const vec2& v2, const vec2& t0, const vec2& t1, const vec2& t2, const Surface* texture, int row1, int row2 )
+{
+	const vec2 v[3] = { v0, v1, v2 };
+	TexturedSpan span;
+	span.p[0] = RasterPlane( v, t0.x, t1.x, t2.x );
+	span.p[1] = RasterPlane( v, t0.y, t1.y, t2.y );
+	span.texture = texture;
+	RasterTriangle( this, v, span, row1, row2 );
+}
+
+void Surface::Polygon( const vec2* v, int n, Pixel color, int row1, int row2 )
+{
+	// convex polygons only, drawn as a fan; the fill rule keeps the inner edges seamless
+	for (int i = 2; i < n; i++) Triangle( v[0], v[i - 1], v[i], color, row1, row2 );
+}
+
+// -----------------------------------------------------------
+// Direct PNG decoding: zlib inflate streamed per IDAT chunk,
+// rows unfiltered in place and written as Pixels
+// -----------------------------------------------------------
+
+static inline uchar Paeth( int a, int b, int c )
+{
+	const int pa = abs( b - c ), pb = abs( a - c ), pc = abs( a + b - 2 * c );
+	return (uchar)(pa <= pb && pa <= pc ? a : pb <= pc ? b : c);
+}
+
+static void UnfilterRow( uchar* r, const uchar* p, int filter, int bpp, int len )
+{
+	// p is the previous reconstructed row; all zeros for the first row
+	switch (filter)
+	{
+	case 1: for (int i = bpp; i < len; i++) r[i] += r[i - bpp]; break;
+	case 2: for (int i = 0; i < len; i++) r[i] += p[i]; break;
+	case 3:
+		for (int i = 0; i < bpp; i++) r[i] += p[i] >> 1;
+		for (int i = bpp; i < len; i++) r[i] += (r[i - bpp] + p[i]) >> 1;
+		break;
+	case 4:
+		for (int i = 0; i < bpp; i++) r[i] += p[i];
+		for (int i = bpp; i < len; i++) r[i] += Paeth( r[i - bpp], p[i], p[i - bpp] );
+		break;
+	}
+}
+
+// Sub, Avg and Paeth depend on the reconstructed pixel to the left, so the vector code handles
+// all channels of one pixel per step, as libpng does. Up is plain 16-byte addition.
+// 3-byte pixels are assembled in registers; a 3-byte memcpy goes through the stack.
+template <int bpp> static inline uint ReadPx( const uchar* p )
+{
+	uint v;
+	if (bpp == 4) memcpy( &v, p, 4 ); else { unsigned short lo; memcpy( &lo, p, 2 ); v = lo | (p[2] << 16); }
+	return v;
+}
+template <int bpp> static inline void WritePx( uchar* p, uint v )
+{
+	if (bpp == 4) memcpy( p, &v, 4 ); else { const unsigned short lo = (unsigned short)v; memcpy( p, &lo, 2 ); p[2] = (uchar)(v >> 16); }
+}
+
+#if defined(ROWKERNELS_SSE2)
+
+template <int bpp> static inline __m128i LoadPx( const uchar* p ) { return _mm_cvtsi32_si128( ReadPx<bpp>( p ) ); }
+template <int bpp> static inline void StorePx( uchar* p, __m128i v ) { WritePx<bpp>( p, _mm_cvtsi128_si32( v ) ); }
+static inline __m128i Abs16( __m128i x ) { const __m128i n = _mm_srai_epi16( x, 15 ); return _mm_sub_epi16( _mm_xor_si128( x, n ), n ); }
+static inline __m128i Select( __m128i m, __m128i a, __m128i b ) { return _mm_or_si128( _mm_and_si128( m, a ), _mm_andnot_si128( m, b ) ); }
+
+template <int bpp> static void UnfilterPixelsSIMD( uchar* r, const uchar* p, int filter, int len )
+{
+	const __m128i zero = _mm_setzero_si128(), one = _mm_set1_epi8( 1 );
+	__m128i a = zero, c = zero;
+	if (filter == 1) for (int i = 0; i < len; i += bpp) a = _mm_add_epi8( LoadPx<bpp>( r + i ), a ), StorePx<bpp>( r + i, a );
+	else if (filter == 3) for (int i = 0; i < len; i += bpp)
+	{
+		// _mm_avg_epu8 rounds up; the png average rounds down
+		const __m128i b = LoadPx<bpp>( p + i );
+		const __m128i avg = _mm_sub_epi8( _mm_avg_epu8( a, b ), _mm_and_si128( _mm_xor_si128( a, b ), one ) );
+		a = _mm_add_epi8( LoadPx<bpp>( r + i ), avg );
+		StorePx<bpp>( r + i, a );
+	}
+	else if (filter == 4) for (int i = 0; i < len; i += bpp)
+	{
+		// 16-bit lanes; the byte add wraps like the scalar code and leaves the high bytes zero
+		const __m128i b = _mm_unpacklo_epi8( LoadPx<bpp>( p + i ), zero );
+		const __m128i pa = _mm_sub_epi16( b, c ), pb = _mm_sub_epi16( a, c );
+		const __m128i pc = Abs16( _mm_add_epi16( pa, pb ) ), aa = Abs16( pa ), ab = Abs16( pb );
+		const __m128i m = _mm_min_epi16( aa, _mm_min_epi16( ab, pc ) );
+		const __m128i pred = Select( _mm_cmpeq_epi16( aa, m ), a, Select( _mm_cmpeq_epi16( ab, m ), b, c ) );
+		a = _mm_add_epi8( _mm_unpacklo_epi8( LoadPx<bpp>( r + i ), zero ), pred ), c = b;
+		StorePx<bpp>( r + i, _mm_packus_epi16( a, a ) );
+	}
+}
+
+static bool UnfilterRowSIMD( uchar* r, const uchar* p, int filter, int bpp, int len )
+{
+	if (filter == 2)
+	{
+		int i = 0;
+		for (; i + 16 <= len; i += 16)
+			_mm_storeu_si128( (__m128i*)(r + i), _mm_add_epi8( _mm_loadu_si128( (__m128i*)(r + i) ), _mm_loadu_si128( (const __m128i*)(p + i) ) ) );
+		for (; i < len; i++) r[i] += p[i];
+		return true;
+	}
+	if (bpp == 3) UnfilterPixelsSIMD<3>( r, p, filter, len );
+	else if (bpp == 4) UnfilterPixelsSIMD<4>( r, p, filter, len );
+	else return false;
+	return true;
+}
+
+static int ConvertRGBASIMD( Pixel* d, const uchar* s, int w )
+{
+	// RGBA bytes to 0xffRRGGBB: swap the 16-bit halves of the R/B pair
+	const __m128i rb = _mm_set1_epi32( 0xff00ff ), g = _mm_set1_epi32( 0xff00 ), a = _mm_set1_epi32( 0xff000000 );
+	int i = 0;
+	for (; i + 4 <= w; i += 4)
+	{
+		const __m128i x = _mm_loadu_si128( (const __m128i*)(s + i * 4) );
+		__m128i br = _mm_and_si128( x, rb );
+		br = _mm_shufflehi_epi16( _mm_shufflelo_epi16( br, 0xb1 ), 0xb1 );
+		_mm_storeu_si128( (__m128i*)(d + i), _mm_or_si128( _mm_or_si128( br, _mm_and_si128( x, g ) ), a ) );
+	}
+	return i;
+}
+
+#elif defined(ROWKERNELS_NEON)
+
+template <int bpp> static inline uint8x8_t LoadPx( const uchar* p ) { return vreinterpret_u8_u32( vdup_n_u32( ReadPx<bpp>( p ) ) ); }
+template <int bpp> static inline void StorePx( uchar* p, uint8x8_t v ) { WritePx<bpp>( p, vget_lane_u32( vreinterpret_u32_u8( v ), 0 ) ); }
+
+template <int bpp> static void UnfilterPixelsSIMD( uchar* r, const uchar* p, int filter, int len )
+{
+	uint8x8_t a = vdup_n_u8( 0 ), c = a;
+	if (filter == 1) for (int i = 0; i < len; i += bpp) a = vadd_u8( LoadPx<bpp>( r + i ), a ), StorePx<bpp>( r + i, a );
+	else if (filter == 3) for (int i = 0; i < len; i += bpp)
+		a = vadd_u8( LoadPx<bpp>( r + i ), vhadd_u8( a, LoadPx<bpp>( p + i ) ) ), StorePx<bpp>( r + i, a );
+	else if (filter == 4) for (int i = 0; i < len; i += bpp)
+	{
+		const uint8x8_t b = LoadPx<bpp>( p + i );
+		const uint16x8_t pa = vabdl_u8( b, c ), pb = vabdl_u8( a, c ), pc = vabdq_u16( vaddl_u8( a, b ), vaddl_u8( c, c ) );
+		const uint8x8_t useA = vmovn_u16( vandq_u16( vcleq_u16( pa, pb ), vcleq_u16( pa, pc ) ) );
+		const uint8x8_t useB = vmovn_u16( vcleq_u16( pb, pc ) );
+		a = vadd_u8( LoadPx<bpp>( r + i ), vbsl_u8( useA, a, vbsl_u8( useB, b, c ) ) ), c = b;
+		StorePx<bpp>( r + i, a );
+	}
+}
+
+static bool UnfilterRowSIMD( uchar* r, const uchar* p, int filter, int bpp, int len )
+{
+	if (filter == 2)
+	{
+		int i = 0;
+		for (; i + 16 <= len; i += 16) vst1q_u8( r + i, vaddq_u8( vld1q_u8( r + i ), vld1q_u8( p + i ) ) );
+		for (; i < len; i++) r[i] += p[i];
+		return true;
+	}
+	if (bpp == 3) UnfilterPixelsSIMD<3>( r, p, filter, len );
+	else if (bpp == 4) UnfilterPixelsSIMD<4>( r, p, filter, len );
+	else return false;
+	return true;
+}
+
+static int ConvertRGBASIMD( Pixel* d, const uchar* s, int w )
+{
+	int i = 0;
+	for (; i + 16 <= w; i += 16)
+	{
+		const uint8x16x4_t x = vld4q_u8( s + i * 4 );
+		const uint8x16x4_t y = { { x.val[2], x.val[1], x.val[0], vdupq_n_u8( 255 ) } };
+		vst4q_u8( (uchar*)(d + i), y );
+	}
+	return i;
+}
+
+static int ConvertRGBSIMD( Pixel* d, const uchar* s, int w )
+{
+	int i = 0;
+	for (; i + 16 <= w; i += 16)
+	{
+		const uint8x16x3_t x = vld3q_u8( s + i * 3 );
+		const uint8x16x4_t y = { { x.val[2], x.val[1], x.val[0], vdupq_n_u8( 255 ) } };
+		vst4q_u8( (uchar*)(d + i), y );
+	}
+	return i;
+}
+
+#endif
+
+static void Unfilter( uchar* r, const uchar* p, int filter, int bpp, int len )
+{
+#if defined(ROWKERNELS_SSE2) || defined(ROWKERNELS_NEON)
+	if (simdRows && UnfilterRowSIMD( r, p, filter, bpp, len )) return;
+#endif
+	UnfilterRow( r, p, filter, bpp, len );
+}
+
+static void ConvertRow( Pixel* d, const uchar* s, int colorType, int w, const Pixel* palette )
+{
+	// alpha is not used by the surface code; all pixels get 255, like the generic path
+	int i = 0;
+	switch (colorType)
+	{
+	case 0: for (; i < w; i++) d[i] = 0xff000000 + s[i] * 0x10101; break;
+	case 2:
+	#if defined(ROWKERNELS_NEON)
+		if (simdRows) i = ConvertRGBSIMD( d, s, w );
+	#endif
+		for (; i < w; i++) d[i] = 0xff000000 + (s[i * 3] << 16) + (s[i * 3 + 1] << 8) + s[i * 3 + 2];
+		break;
+	case 3: for (; i < w; i++) d[i] = palette[s[i]]; break;
+	case 4: for (; i < w; i++) d[i] = 0xff000000 + s[i * 2] * 0x10101; break;
+	case 6:
+	#if defined(ROWKERNELS_SSE2) || defined(ROWKERNELS_NEON)
+		if (simdRows) i = ConvertRGBASIMD( d, s, w );
+	#endif
+		for (; i < w; i++) d[i] = 0xff000000 + (s[i * 4] << 16) + (s[i * 4 + 1] << 8) + s[i * 4 + 2];
+		break;
+	}
+}
+
+static bool VerifyUnfilter()
+{
+#if defined(ROWKERNELS_SSE2) || defined(ROWKERNELS_NEON)
+	// same idea as VerifyRowKernels: compare against the scalar code for all filters
+	enum { N = 4 * 37 };
+	uchar p[N], r0[N], r1[N];
+	uint seed = 0x9e3779b9;
+	for (int bpp = 3; bpp <= 4; bpp++) for (int filter = 1; filter <= 4; filter++)
+	{
+		const int len = (N / bpp) * bpp;
+		for (int i = 0; i < N; i++)
+		{
+			seed ^= seed << 13, seed ^= seed >> 17, seed ^= seed << 5;
+			p[i] = (uchar)seed, r0[i] = r1[i] = (uchar)(seed >> 8);
+		}
+		UnfilterRow( r0, p, filter, bpp, len );
+		if (UnfilterRowSIMD( r1, p, filter, bpp, len ) && memcmp( r0, r1, len )) return false;
+	}
+#endif
+	return true;
+}
+
+bool Surface::decodePNGDirect( const uchar* in, size_t size )
+{
+	// non-interlaced 8-bit images only; returns false for anything else, so the caller can
+	// use the generic decoder. Chunk CRCs are not checked, as in decodePNG.
+	static const uchar signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+	static const int channels[7] = { 1, 0, 3, 1, 2, 0, 4 };
+	auto read32 = []( const uchar* p ) { return ((uint)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]; };
+	if (size < 33 || memcmp( in, signature, 8 ) || memcmp( in + 12, "IHDR", 4 )) return false;
+	const uint w = read32( in + 16 ), h = read32( in + 20 ), ct = in[25];
+	if (in[24] != 8 || ct > 6 || !channels[ct] || in[26] || in[27] || in[28]) return false;
+	if (w == 0 || h == 0 || w > 32768 || h > 32768) return false;
+	const uint bpp = channels[ct], stride = w * bpp;
+	Pixel palette[256];
+	for (int i = 0; i < 256; i++) palette[i] = 0xff000000;
+	// filter byte plus scanline, for the current and the previous row; inflate writes to cur
+	vector<uchar> rows( 2 * (stride + 1) );
+	uchar* cur = rows.data(), * prev = cur + stride + 1;
+	z_stream zs = {};
+	if (inflateInit( &zs ) != Z_OK) return false;
+	Pixel* pixels = new Pixel[w * h];
+	zs.next_out = cur, zs.avail_out = stride + 1;
+	uint y = 0;
+	bool ok = true;
+	for (size_t pos = 8; ok && y < h && pos + 12 <= size;)
+	{
+		const uint len = read32( in + pos );
+		const uchar* type = in + pos + 4, * data = in + pos + 8;
+		if (len > size - pos - 12) break;
+		pos += len + 12;
+		if (!memcmp( type, "PLTE", 4 ))
+		{
+			for (uint i = 0; i < len / 3 && i < 256; i++)
+				palette[i] = 0xff000000 + (data[i * 3] << 16) + (data[i * 3 + 1] << 8) + data[i * 3 + 2];
+		}
+		else if (!memcmp( type, "IDAT", 4 ))
+		{
+			zs.next_in = (Bytef*)data, zs.avail_in = len;
+			while (y < h)
+			{
+				const int r = inflate( &zs, Z_NO_FLUSH );
+				if (zs.avail_out == 0)
+				{
+					// a complete scanline: reconstruct it in place and convert it
+					if (cur[0] > 4) { ok = false; break; }
+					Unfilter( cur + 1, prev + 1, cur[0], bpp, stride );
+					ConvertRow( pixels + y * w, cur + 1, ct, w, palette );
+					swap( cur, prev ), y++;
+					zs.next_out = cur, zs.avail_out = stride + 1;
+					continue;
+				}
+				if (r == Z_STREAM_END || zs.avail_in == 0) break; // on to the next IDAT
+				if (r != Z_OK) { ok = false; break; }
+			}
+		}
+		else if (!memcmp( type, "IEND", 4 )) break;
+	}
+	inflateEnd( &zs );
+	if (!ok || y < h) { delete[] pixels; return false; }
+	width = w, height = h, flags |= OWNER;
+	buffer = pixels;
+	return true;
+}
+
+// -----------------------------------------------------------
+// Resize filters and mip maps
+// -----------------------------------------------------------
+
+// bilinear weights are 7-bit, so both passes fit 16-bit lanes (and NEON 8-bit multiplies):
+// each channel becomes (a * (128 - f) + b * f + 64) >> 7. Red/blue and alpha/green are done
+// two at a time in the scalar version, which is bit-exact with the SIMD versions.
+static inline Pixel Lerp7( Pixel a, Pixel b, uint f )
+{
+	const uint rb = ((a & 0xff00ff) * (128 - f) + (b & 0xff00ff) * f + 0x400040) >> 7;
+	const uint ag = (((a >> 8) & 0xff00ff) * (128 - f) + ((b >> 8) & 0xff00ff) * f + 0x400040) >> 7;
+	return (rb & 0xff00ff) + ((ag & 0xff00ff) << 8);
+}
+
+// vertical pass: d = lerp( a, b, f ) for n pixels
+static void LerpRow( Pixel* d, const Pixel* a, const Pixel* b, uint f, int n, int i = 0 )
+{
+	for (; i < n; i++) d[i] = Lerp7( a[i], b[i], f );
+}
+
+// horizontal pass: d[i] = lerp( s[x0[i]], s[x0[i] + 1], f ), with f replicated in the 4 bytes of w[i]
+static void GatherRow( Pixel* d, const Pixel* s, const int* x0, const uint* w, int n, int i = 0 )
+{
+	for (; i < n; i++) d[i] = Lerp7( s[x0[i]], s[x0[i] + 1], w[i] & 127 );
+}
+
+#if defined(ROWKERNELS_SSE2)
+
+static int LerpRowSIMD( Pixel* d, const Pixel* a, const Pixel* b, uint f, int n )
+{
+	const __m128i zero = _mm_setzero_si128(), half = _mm_set1_epi16( 64 );
+	const __m128i wa = _mm_set1_epi16( (short)(128 - f) ), wb = _mm_set1_epi16( (short)f );
+	int i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		const __m128i x = _mm_loadu_si128( (const __m128i*)(a + i) ), y = _mm_loadu_si128( (const __m128i*)(b + i) );
+		const __m128i lo = _mm_add_epi16( _mm_mullo_epi16( _mm_unpacklo_epi8( x, zero ), wa ), _mm_mullo_epi16( _mm_unpacklo_epi8( y, zero ), wb ) );
+		const __m128i hi = _mm_add_epi16( _mm_mullo_epi16( _mm_unpackhi_epi8( x, zero ), wa ), _mm_mullo_epi16( _mm_unpackhi_epi8( y, zero ), wb ) );
+		_mm_storeu_si128( (__m128i*)(d + i), _mm_packus_epi16( _mm_srli_epi16( _mm_add_epi16( lo, half ), 7 ), _mm_srli_epi16( _mm_add_epi16( hi, half ), 7 ) ) );
+	}
+	return i;
+}
+
+static int GatherRowSIMD( Pixel* d, const Pixel* s, const int* x0, const uint* w, int n )
+{
+	const __m128i zero = _mm_setzero_si128(), half = _mm_set1_epi16( 64 ), one = _mm_set1_epi16( 128 );
+	int i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		const Pixel* p0 = s + x0[i], * p1 = s + x0[i + 1], * p2 = s + x0[i + 2], * p3 = s + x0[i + 3];
+		const __m128i x = _mm_setr_epi32( p0[0], p1[0], p2[0], p3[0] ), y = _mm_setr_epi32( p0[1], p1[1], p2[1], p3[1] );
+		const __m128i f = _mm_loadu_si128( (const __m128i*)(w + i) );
+		const __m128i flo = _mm_unpacklo_epi8( f, zero ), fhi = _mm_unpackhi_epi8( f, zero );
+		const __m128i lo = _mm_add_epi16( _mm_mullo_epi16( _mm_unpacklo_epi8( x, zero ), _mm_sub_epi16( one, flo ) ), _mm_mullo_epi16( _mm_unpacklo_epi8( y, zero ), flo ) );
+		const __m128i hi = _mm_add_epi16( _mm_mullo_epi16( _mm_unpackhi_epi8( x, zero ), _mm_sub_epi16( one, fhi ) ), _mm_mullo_epi16( _mm_unpackhi_epi8( y, zero ), fhi ) );
+		_mm_storeu_si128( (__m128i*)(d + i), _mm_packus_epi16( _mm_srli_epi16( _mm_add_epi16( lo, half ), 7 ), _mm_srli_epi16( _mm_add_epi16( hi, half ), 7 ) ) );
+	}
+	return i;
+}
+
+#elif defined(ROWKERNELS_NEON)
+
+static int LerpRowSIMD( Pixel* d, const Pixel* a, const Pixel* b, uint f, int n )
+{
+	// vrshrn adds the 64 before shifting, which matches the scalar rounding
+	const uint8x8_t wa = vdup_n_u8( (uchar)(128 - f) ), wb = vdup_n_u8( (uchar)f );
+	int i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		const uint8x16_t x = vld1q_u8( (const uchar*)(a + i) ), y = vld1q_u8( (const uchar*)(b + i) );
+		const uint16x8_t lo = vmlal_u8( vmull_u8( vget_low_u8( x ), wa ), vget_low_u8( y ), wb );
+		const uint16x8_t hi = vmlal_u8( vmull_u8( vget_high_u8( x ), wa ), vget_high_u8( y ), wb );
+		vst1q_u8( (uchar*)(d + i), vcombine_u8( vrshrn_n_u16( lo, 7 ), vrshrn_n_u16( hi, 7 ) ) );
+	}
+	return i;
+}
+
+static int GatherRowSIMD( Pixel* d, const Pixel* s, const int* x0, const uint* w, int n )
+{
+	const uint8x8_t one = vdup_n_u8( 128 );
+	int i = 0;
+	for (; i + 2 <= n; i += 2)
+	{
+		const Pixel* p0 = s + x0[i], * p1 = s + x0[i + 1];
+		const uint8x8_t x = vcreate_u8( p0[0] | ((uint64_t)p1[0] << 32) ), y = vcreate_u8( p0[1] | ((uint64_t)p1[1] << 32) );
+		const uint8x8_t f = vld1_u8( (const uchar*)(w + i) );
+		vst1_u8( (uchar*)(d + i), vrshrn_n_u16( vmlal_u8( vmull_u8( x, vsub_u8( one, f ) ), y, f ), 7 ) );
+	}
+	return i;
+}
+
+#endif
+
+static bool VerifyResize()
+{
+#if defined(ROWKERNELS_SSE2) || defined(ROWKERNELS_NEON)
+	// same idea as VerifyRowKernels, for both bilinear passes and all weights
+	enum { N = 67 };
+	Pixel a[N + 1], b[N], d0[N], d1[N];
+	int x0[N];
+	uint w[N], seed = 0x68e31da4;
+	for (uint f = 0; f < 128; f++)
+	{
+		for (int i = 0; i <= N; i++)
+		{
+			seed ^= seed << 13, seed ^= seed >> 17, seed ^= seed << 5, a[i] = seed;
+			if (i < N) b[i] = ~seed * 0x9e3779b9, x0[i] = (seed >> 8) % N, w[i] = ((f + i) & 127) * 0x1010101;
+		}
+		LerpRow( d0, a, b, f, N );
+		LerpRow( d1, a, b, f, N, LerpRowSIMD( d1, a, b, f, N ) );
+		if (memcmp( d0, d1, sizeof( d0 ) )) return false;
+		GatherRow( d0, a, x0, w, N );
+		GatherRow( d1, a, x0, w, N, GatherRowSIMD( d1, a, x0, w, N ) );
+		if (memcmp( d0, d1, sizeof( d0 ) )) return false;
+	}
+#endif
+	return true;
+}
+
+static inline int CentreSample( int i, int src, int dst )
+{
+	// 16.16 source position of the centre of destination pixel i: (i + 0.5) * src / dst - 0.5,
+	// clamped to the first and last source pixel
+	const int64_t p = (((int64_t)(2 * i + 1) * src) << 16) / (2 * dst) - 32768;
+	return (int)min( max( p, (int64_t)0 ), (int64_t)(src - 1) << 16 );
+}
+
+void Surface::Resize( Surface* orig, int filter )
+{
+	PROFILE_ZONE( "Resize" );
+	const int sw = orig->width, sh = orig->height, dw = width, dh = height;
+	const Pixel* src = orig->buffer;
+	if (filter == NEAREST)
+	{
+		// pixel centres map to pixel centres; rows that sample the same source row are copied
+		vector<int> sx( dw );
+		for (int x = 0; x < dw; x++) sx[x] = (int)((int64_t)(2 * x + 1) * sw / (2 * dw));
+		for (int y = 0, prev = -1; y < dh; y++)
+		{
+			const int sy = (int)((int64_t)(2 * y + 1) * sh / (2 * dh));
+			Pixel* d = buffer + y * dw;
+			if (sy == prev) memcpy( d, d - dw, dw * sizeof( Pixel ) ); else
+			{
+				const Pixel* s = src + sy * sw;
+				for (int x = 0; x < dw; x++) d[x] = s[sx[x]];
+			}
+			prev = sy;
+		}
+	}
+	else if (filter == BOX && sw == 2 * dw && sh == 2 * dh)
+	{
+		// exact halving, as used for mips: 2x2 averages with two channels per register,
+		// which rounds the same as the general case below
+		for (int y = 0; y < dh; y++)
+		{
+			const Pixel* s0 = src + 2 * y * sw, * s1 = s0 + sw;
+			Pixel* d = buffer + y * dw;
+			for (int x = 0; x < dw; x++)
+			{
+				const Pixel a = s0[2 * x], b = s0[2 * x + 1], c = s1[2 * x], e = s1[2 * x + 1];
+				const uint rb = (a & 0xff00ff) + (b & 0xff00ff) + (c & 0xff00ff) + (e & 0xff00ff) + 0x20002;
+				const uint ag = ((a >> 8) & 0xff00ff) + ((b >> 8) & 0xff00ff) + ((c >> 8) & 0xff00ff) + ((e >> 8) & 0xff00ff) + 0x20002;
+				d[x] = ((rb >> 2) & 0xff00ff) + (((ag >> 2) & 0xff00ff) << 8);
+			}
+		}
+	}
+	else if (filter == BOX)
+	{
+		// area average: every source pixel lands in exactly one destination pixel, which
+		// covers [x * sw / dw, (x + 1) * sw / dw) (at least one pixel, so enlarging repeats
+		// pixels like NEAREST). Sums are divided by multiplying with a 32-bit reciprocal.
+		vector<int> x1( dw + 1 );
+		for (int x = 0; x <= dw; x++) x1[x] = (int)((int64_t)x * sw / dw);
+		int maxw = 1;
+		for (int x = 0; x < dw; x++) maxw = max( maxw, x1[x + 1] - x1[x] );
+		vector<uint> acc( dw * 4 ), rb( sw ), ag( sw );
+		vector<uint64_t> recip( maxw + 1 );
+		auto flush = [&]() // add the column sums to the destination pixel sums
+		{
+			uint* a = acc.data();
+			for (int x = 0; x < dw; x++, a += 4) for (int u = x1[x], u2 = max( u + 1, x1[x + 1] ); u < u2; u++)
+				a[0] += rb[u] & 0xffff, a[1] += ag[u] & 0xffff, a[2] += rb[u] >> 16, a[3] += ag[u] >> 16;
+			memset( rb.data(), 0, sw * sizeof( uint ) ), memset( ag.data(), 0, sw * sizeof( uint ) );
+		};
+		for (int y = 0; y < dh; y++)
+		{
+			// sum columns first, with blue/red and alpha/green in 16-bit halves; these
+			// cannot overflow for 256 rows, so they are flushed every 256 rows
+			const int y1 = (int)((int64_t)y * sh / dh), y2 = max( y1 + 1, (int)((int64_t)(y + 1) * sh / dh) );
+			memset( acc.data(), 0, acc.size() * sizeof( uint ) );
+			for (int sy = y1; sy < y2; sy++)
+			{
+				const Pixel* s = src + sy * sw;
+				for (int u = 0; u < sw; u++) rb[u] += s[u] & 0xff00ff, ag[u] += (s[u] >> 8) & 0xff00ff;
+				if ((sy - y1) % 256 == 255) flush();
+			}
+			flush();
+			for (int n = 1; n <= maxw; n++) recip[n] = (1ull << 32) / (n * (y2 - y1));
+			Pixel* d = buffer + y * dw;
+			const uint* a = acc.data();
+			for (int x = 0; x < dw; x++, a += 4)
+			{
+				const uint64_t r = recip[max( 1, x1[x + 1] - x1[x] )], round = 1u << 31;
+				d[x] = (Pixel)((a[0] * r + round) >> 32) + ((Pixel)((a[1] * r + round) >> 32) << 8) +
+					((Pixel)((a[2] * r + round) >> 32) << 16) + ((Pixel)((a[3] * r + round) >> 32) << 24);
+			}
+		}
+	}
+	else
+	{
+		// separable bilinear: blend two source rows into a temporary row, then blend pairs
+		// of pixels from that row; the temporary row repeats its last pixel, so the
+		// rightmost column can read x0 + 1
+		vector<int> x0( dw );
+		vector<uint> wx( dw );
+		vector<Pixel> row( sw + 1 );
+		for (int x = 0; x < dw; x++)
+		{
+			const int p = CentreSample( x, sw, dw );
+			x0[x] = p >> 16, wx[x] = ((p >> 9) & 127) * 0x1010101;
+		}
+		for (int y = 0; y < dh; y++)
+		{
+			const int p = CentreSample( y, sh, dh ), y0 = p >> 16, fy = (p >> 9) & 127;
+			const Pixel* r0 = src + y0 * sw, * r1 = src + min( y0 + 1, sh - 1 ) * sw;
+			Pixel* d = buffer + y * dw;
+			int i = 0, j = 0;
+		#if defined(ROWKERNELS_SSE2) || defined(ROWKERNELS_NEON)
+			if (simdResize) i = LerpRowSIMD( row.data(), r0, r1, fy, sw );
+		#endif
+			LerpRow( row.data(), r0, r1, fy, sw, i );
+			row[sw] = row[sw - 1];
+		#if defined(ROWKERNELS_SSE2) || defined(ROWKERNELS_NEON)
+			if (simdResize) j = GatherRowSIMD( d, row.data(), x0.data(), wx.data(), dw );
+		#endif
+			GatherRow( d, row.data(), x0.data(), wx.data(), dw, j );
+		}
+	}
+	MarkDirty( 0, 0, width, height );
+}
+
+void Surface::BuildMips()
+{
+	// each level is a box filtered half-size copy of the previous one, down to 1x1
+	delete mip;
+	mip = 0;
+	for (Surface* s = this; s->width > 1 || s->height > 1; s = s->mip)
+	{
+		s->mip = new Surface( max( 1, s->width / 2 ), max( 1, s->height / 2 ) );
+		s->mip->Resize( s, BOX );
+	}
+}
+
+Surface* Surface::Mip( int level )
+{
+	Surface* s = this;
+	while (level-- > 0 && s->mip) s = s->mip;
+	return s;
+}
+
+Surface* Surface::MipFor( int w, int h )
+{
+	Surface* s = this;
+	while (s->mip && s->mip->width >= w && s->mip->height >= h) s = s->mip;
+	return s;
+}
+
+Sprite::Sprite( Surface* s, unsigned int frames, bool compile ) :
 	width( s->width / frames ),
 	height( s->height ),
+	m_Pitch( s->width ),
 	numFrames( frames ),
 	currentFrame( 0 ),
 	flags( 0 ),
@@ -799,6 +2111,7 @@ Sprite::Sprite( Surface* s, unsigned int frames ) :
 	surface( s )
 {
 	InitializeStartData();
+	if (compile) Compile();
 }
 
 Sprite::~Sprite()
@@ -808,13 +2121,13 @@ Sprite::~Sprite()
 	delete start;
 }
 
-void Sprite::Draw( Surface* target, int x, int y )
+void Sprite::Draw( Surface* target, int x, int y, uint frame, uint drawFlags )
 {
 	if ((x < -width) || (x > ( target->width + width ))) return;
 	if ((y < -height) || (y > ( target->height + height ))) return;
 	int x1 = x, x2 = x + width;
 	int y1 = y, y2 = y + height;
-	Pixel* src = GetBuffer() + currentFrame * width;
+	Pixel* src = GetBuffer() + frame * width;
 	if (x1 < 0)
 	{
 		src += -x1;
@@ -832,50 +2145,132 @@ void Sprite::Draw( Surface* target, int x, int y )
 	const int dpitch = target->width;
 	if ((x2 > x1) && (y2 > y1))
 	{
+		target->MarkDirty( x1, y1, x2, y2 );
 		unsigned int addr = y1 * dpitch + x1;
+		if (IsCompiled())
+		{
+			DrawSpans( dest + addr, dpitch, x1 - x, x2 - x, y1 - y, y2 - y, frame, (drawFlags & FLARE) != 0 );
+			return;
+		}
 		const int width = x2 - x1;
-		const int height = y2 - y1;
-		for (int y = 0; y < height; y++)
+		const RowKernel row = (drawFlags & FLARE) ? rowKernels.addBlendKeyed : rowKernels.copyKeyed;
+		for (int line = y1 - y; line < y2 - y; line++)
 		{
-			const int line = y + (y1 - y);
-			const int lsx = start[currentFrame][line] + x;
-			if (flags & FLARE)
-			{
-				xs = (lsx > x1) ? lsx - x1 : 0;
-				for (int x = xs; x < width; x++)
-				{
-					const Pixel c1 = *(src + x);
-					if (c1 & 0xffffff)
-					{
-						const Pixel c2 = *(dest + addr + x);
-						*(dest + addr + x) = AddBlend( c1, c2 );
-					}
-				}
-			}
-			else
-			{
-				xs = (lsx > x1) ? lsx - x1 : 0;
-				for (int x = xs; x < width; x++)
-				{
-					const Pixel c1 = *(src + x);
-					if (c1 & 0xffffff) *(dest + addr + x) = c1;
-				}
-			}
+			const int lsx = start[frame][line] + x;
+			xs = (lsx > x1) ? lsx - x1 : 0;
+			row( dest + addr + xs, src + xs, width - xs );
 			addr += dpitch;
 			src += m_Pitch;
 		}
 	}
 }
 
+void Sprite::DrawSpans( Pixel* dst, int dpitch, int u1, int u2, int v1, int v2, uint frame, bool flare )
+{
+	// draw the visible part [u1,u2) x [v1,v2) of a frame; dst is the target pixel for (u1,v1)
+	const Pixel* src = GetBuffer() + frame * width + v1 * m_Pitch;
+	const int pitch = m_Pitch;
+	if (flare)
+	{
+		// one keyed blend over the extent of each row beats a kernel call per (short) run:
+		// keyed blending leaves the gaps untouched, so the result is the same
+		const RowKernel blend = rowKernels.addBlendKeyed;
+		const Span* e = extents.data() + frame * height;
+		for (int v = v1; v < v2; v++, dst += dpitch, src += pitch)
+		{
+			const int a = max( (int)e[v].skip, u1 ), b = min( e[v].skip + e[v].run, u2 );
+			if (b > a) blend( dst + a - u1, src + a, b - a );
+		}
+		return;
+	}
+	const uint* index = spanIndex.data() + frame * height;
+	for (int v = v1; v < v2; v++, dst += dpitch, src += pitch)
+	{
+		const Span* span = spans.data() + index[v], * last = spans.data() + index[v + 1];
+		for (int u = 0; span < last; span++)
+		{
+			const int a = max( u + span->skip, u1 );
+			u += span->skip + span->run;
+			const int b = min( u, u2 );
+			if (b > a) memcpy( dst + a - u1, src + a, (b - a) * sizeof( Pixel ) );
+			if (u >= u2) break;
+		}
+	}
+}
+
 void Sprite::DrawScaled( int x, int y, int w, int h, Surface* target )
 {
-	if ((w == 0) || (h == 0)) return;
-	for (int x = 0; x < w; x++) for (int y = 0; y < h; y++)
+	// stretch the current frame over [x,x+w) x [y,y+h); pixel centres are sampled
+	if (w <= 0 || h <= 0) return;
+	const float dudx = (float)width / w, dvdy = (float)height / h;
+	DrawAffine( target, (0.5f - x) * dudx, (0.5f - y) * dvdy, dudx, 0, 0, dvdy, x, y, x + w, y + h, currentFrame, (flags & FLARE) != 0 );
+}
+
+void Sprite::DrawTransformed( Surface* target, float x, float y, float angle, float sx, float sy, uint frame, uint drawFlags )
+{
+	// the inverse transform maps target pixels to frame pixels: uv = half + S^-1 R(-angle) (p - centre)
+	if (fabsf( sx ) < 1.0f / 1024 || fabsf( sy ) < 1.0f / 1024) return;
+	const float c = cosf( angle ), s = sinf( angle );
+	const float dudx = c / sx, dudy = s / sx, dvdx = -s / sy, dvdy = c / sy;
+	const float u0 = width * 0.5f + dudx * (0.5f - x) + dudy * (0.5f - y);
+	const float v0 = height * 0.5f + dvdx * (0.5f - x) + dvdy * (0.5f - y);
+	// target bounds: the transformed corners of the frame
+	const float ex = width * 0.5f, ey = height * 0.5f;
+	const float hx = fabsf( c * sx * ex ) + fabsf( s * sy * ey ), hy = fabsf( s * sx * ex ) + fabsf( c * sy * ey );
+	DrawAffine( target, u0, v0, dudx, dvdx, dudy, dvdy, (int)floorf( x - hx ), (int)floorf( y - hy ),
+		(int)ceilf( x + hx ), (int)ceilf( y + hy ), frame, (drawFlags & FLARE) != 0 );
+}
+
+static int64_t FloorDiv( int64_t a, int64_t b ) { return a / b - ((a % b != 0) && ((a < 0) != (b < 0))); }
+
+static void SpanLimits( int64_t a, int64_t step, int64_t hi, int& i1, int& i2 )
+{
+	// narrow [i1,i2] to the i for which 0 <= a + i * step <= hi
+	if (step == 0) { if (a < 0 || a > hi) i2 = i1 - 1; return; }
+	const int64_t lo = step > 0 ? -a : hi - a, up = step > 0 ? hi - a : -a;
+	i1 = (int)max( (int64_t)i1, -FloorDiv( -lo, step ) ), i2 = (int)min( (int64_t)i2, FloorDiv( up, step ) );
+}
+
+template <bool flare> static void AffineSpan( Pixel* d, const Pixel* src, int pitch, int u, int v, int du, int dv, int n )
+{
+	for (int i = 0; i < n; i++, u += du, v += dv)
+	{
+		const Pixel p = src[(u >> 16) + (v >> 16) * pitch];
+		if (p & 0xffffff) d[i] = flare ? AddBlend( p, d[i] ) : p;
+	}
+}
+
+void Sprite::DrawAffine( Surface* target, float u0, float v0, float dudx, float dvdx, float dudy, float dvdy, int x1, int y1, int x2, int y2, uint frame, bool flare )
+{
+	// uv at the centre of target pixel (px,py) is (u0 + px * dudx + py * dudy, v0 + px * dvdx + py * dvdy);
+	// draws the part of [x1,x2) x [y1,y2) that falls inside the target and the frame, in 16.16 fixed point
+	x1 = max( x1, 0 ), y1 = max( y1, 0 ), x2 = min( x2, target->width ), y2 = min( y2, target->height );
+	if (x1 >= x2 || y1 >= y2) return;
+	target->MarkDirty( x1, y1, x2, y2 );
+	// when the surface has mips, minify from the level where a target pixel covers less than
+	// two texels; levels are only usable while the frame size stays a multiple of the scale
+	const Surface* level = surface;
+	float footprint = max( dudx * dudx + dvdx * dvdx, dudy * dudy + dvdy * dvdy ), scale = 65536;
+	int fw = width, fh = height;
+	while (footprint >= 4 && level->mip && !(fw & 1) && !(fh & 1))
+		level = level->mip, fw >>= 1, fh >>= 1, scale *= 0.5f, footprint *= 0.25f;
+	const int64_t U0 = llroundf( u0 * scale ), V0 = llroundf( v0 * scale );
+	const int64_t dUx = llroundf( dudx * scale ), dVx = llroundf( dvdx * scale ), dUy = llroundf( dudy * scale ), dVy = llroundf( dvdy * scale );
+	const int64_t maxU = ((int64_t)fw << 16) - 1, maxV = ((int64_t)fh << 16) - 1;
+	const Pixel* src = level->buffer + frame * fw;
+	const int pitch = level->width;
+	for (int py = y1; py < y2; py++)
 	{
-		int u = (int)((float)x * ((float)width / (float)w));
-		int v = (int)((float)y * ((float)height / (float)h));
-		Pixel color = GetBuffer()[u + v * m_Pitch];
-		if (color & 0xffffff) target->buffer[x + x + ((y + y) * target->width)] = color;
+		// clip the scanline against the frame, so the inner loop needs no tests
+		const int64_t U = U0 + py * dUy, V = V0 + py * dVy;
+		int i1 = x1, i2 = x2 - 1;
+		SpanLimits( U, dUx, maxU, i1, i2 );
+		SpanLimits( V, dVx, maxV, i1, i2 );
+		if (i1 > i2) continue;
+		Pixel* d = target->buffer + py * target->width + i1;
+		const int u = (int)(U + i1 * dUx), v = (int)(V + i1 * dVx);
+		if (flare) AffineSpan<true>( d, src, pitch, u, v, (int)dUx, (int)dVx, i2 - i1 + 1 );
+		else AffineSpan<false>( d, src, pitch, u, v, (int)dUx, (int)dVx, i2 - i1 + 1 );
 	}
 }
 
@@ -890,7 +2285,7 @@ void Sprite::InitializeStartData()
 			Pixel* addr = GetBuffer() + f * width + y * m_Pitch;
 			for (int x = 0; x < width; ++x)
 			{
-				if (addr[x])
+				if (addr[x] & 0xffffff)
 				{
 					start[f][y] = x;
 					break;
@@ -900,19 +2295,52 @@ void Sprite::InitializeStartData()
 	}
 }
 
-Font::Font( char* file, char* chars )
+void Sprite::Compile()
 {
-	surface = new Surface( file );
+	// convert each frame to rows of (skip, run) spans so that Draw can copy or blend whole
+	// opaque runs and jump over transparent pixels; call again if the surface changes
+	spans.clear();
+	spanIndex.resize( numFrames * height + 1 );
+	extents.assign( numFrames * height, { 0, 0 } );
+	for (unsigned int f = 0; f < numFrames; f++) for (int y = 0; y < height; y++)
+	{
+		spanIndex[f * height + y] = (uint)spans.size();
+		const Pixel* addr = GetBuffer() + f * width + y * m_Pitch;
+		int x1 = width, x2 = 0; // extent of the opaque pixels
+		for (int x = 0, last = 0; x < width; )
+		{
+			while (x < width && !(addr[x] & 0xffffff)) x++;
+			if (x == width) break;
+			const int first = x;
+			while (x < width && (addr[x] & 0xffffff)) x++;
+			spans.push_back( { (unsigned short)(first - last), (unsigned short)(x - first) } );
+			x1 = min( x1, first ), x2 = last = x;
+		}
+		if (x2 == 0) continue;
+		// widen the extent over transparent pixels to a multiple of 4, so that SIMD row kernels
+		// don't fall back to their scalar tail
+		const int n = (x2 - x1 + 3) & ~3;
+		x2 = min( x1 + n, width ), x1 = max( x2 - n, 0 );
+		extents[f * height + y] = { (unsigned short)x1, (unsigned short)(x2 - x1) };
+	}
+	spanIndex[numFrames * height] = (uint)spans.size();
+}
+
+Font::Font( char* file, char* chars ) : Font( new Surface( file ), chars ) {}
+
+Font::Font( Surface* glyphs, const char* chars )
+{
+	surface = glyphs;
 	Pixel* b = surface->buffer;
 	int w = surface->width;
 	int h = surface->height;
+	const int count = (int)strlen( chars );
 	unsigned int charnr = 0, start = 0;
 	trans = new int[256];
 	memset( trans, 0, 1024 );
-	unsigned int i;
-	for (i = 0; i < strlen( chars ); i++) trans[(unsigned char)chars[i]] = i;
-	offset = new int[strlen( chars )];
-	width = new int[strlen( chars )];
+	for (int i = 0; i < count; i++) trans[(unsigned char)chars[i]] = i;
+	offset = new int[count](); // glyphs missing from the image stay empty
+	width = new int[count]();
 	height = h;
 	cy1 = 0, cy2 = 1024;
 	int x, y;
@@ -929,29 +2357,63 @@ Font::Font( char* file, char* chars )
 		{
 			width[charnr] = x - start;
 			offset[charnr] = start;
-			if (++charnr == strlen( chars )) break;
+			if (++charnr == (uint)count) break;
 		}
 		lastempty = empty;
 	}
+	// advances, and each glyph row as a list of opaque runs
+	for (int c = 0; c < 256; c++) advance[c] = c == ' ' ? 4 : width[trans[c]] + 2;
+	spanIndex.resize( count * height + 1 );
+	for (int g = 0; g < count; g++) for (y = 0; y < height; y++)
+	{
+		spanIndex[g * height + y] = (uint)spans.size();
+		const Pixel* p = b + offset[g] + y * w;
+		for (x = 0; x < width[g]; )
+		{
+			while (x < width[g] && !(p[x] & 0xffffff)) x++;
+			if (x == width[g]) break;
+			const int first = x;
+			while (x < width[g] && (p[x] & 0xffffff)) x++;
+			spans.push_back( { (unsigned short)first, (unsigned short)(x - first) } );
+		}
+	}
+	spanIndex[count * height] = (uint)spans.size();
 }
 
 Font::~Font()
 {
 	delete surface;
-	delete trans;
-	delete width;
-	delete offset;
+	delete[] trans;
+	delete[] width;
+	delete[] offset;
 }
 
-int Font::Width( char* text )
+const Font::Layout& Font::GetLayout( const char* text )
 {
-	int w = 0;
-	unsigned int i;
-	for (i = 0; i < strlen( text ); i++)
+	// FNV-1a hash of the text; the stored text resolves collisions
+	uint64_t hash = 14695981039346656037ull;
+	size_t n = 0;
+	for (; text[n]; n++) hash = (hash ^ (uchar)text[n]) * 1099511628211ull;
+	auto it = layouts.find( hash );
+	if (it != layouts.end() && it->second.text.size() == n && !memcmp( it->second.text.data(), text, n )) return it->second;
+	if (layouts.size() >= MAXLAYOUTS) layouts.clear();
+	Layout& l = layouts[hash];
+	l.text.assign( text, n ), l.glyphs.clear();
+	int x = 0;
+	for (size_t i = 0; i < n; i++)
 	{
-		unsigned char c = (unsigned char)text[i];
-		if (c == 32) w += 4; else w += width[trans[c]] + 2;
+		const uchar c = (uchar)text[i];
+		if (c != ' ') l.glyphs.push_back( { trans[c], x } );
+		x += advance[c];
 	}
+	l.width = x;
+	return l;
+}
+
+int Font::Width( char* text )
+{
+	int w = 0;
+	for (; *text; text++) w += advance[(uchar)*text];
 	return w;
 }
 
@@ -961,43 +2423,35 @@ void Font::Centre( Surface* target, char* text, int y )
 	Print( target, text, x, y );
 }
 
-void Font::Print( Surface* target, char* text, int x, int y, bool clip )
+void Font::Print( Surface* target, char* text, int x, int y, bool )
 {
-	Pixel* b = target->buffer + x + y * target->width;
-	Pixel* s = surface->buffer;
-	unsigned int i, cx;
-	int u, v;
-	if (((y + height) < cy1) || (y > cy2)) return;
-	for (cx = 0, i = 0; i < strlen( text ); i++)
+	// glyph rows [v1,v2) are inside both the YClip range and the target
+	const int v1 = max( cy1 - y, max( -y, 0 ) ), v2 = min( cy2 + 1 - y, min( target->height - y, height ) );
+	if (v1 >= v2) return;
+	const Layout& l = GetLayout( text );
+	target->MarkDirty( x, y + v1, x + l.width, y + v2 );
+	for (const Layout::Glyph& g : l.glyphs)
 	{
-		if (text[i] == ' ') cx += 4; else
+		// clip per glyph: skip it, draw it whole, or limit its spans to columns [u1,u2)
+		const int gx = x + g.x, gw = width[g.index];
+		if (gx >= target->width) break;
+		if (gx + gw <= 0) continue;
+		const int u1 = max( 0, -gx ), u2 = min( gw, target->width - gx );
+		const Pixel* src = surface->buffer + offset[g.index] + v1 * surface->width;
+		Pixel* dst = target->buffer + gx + (y + v1) * target->width;
+		const uint* index = spanIndex.data() + g.index * height;
+		for (int v = v1; v < v2; v++, src += surface->width, dst += target->width)
 		{
-			int c = trans[(unsigned char)text[i]];
-			Pixel* t = s + offset[c], * d = b + cx;
-			if (clip)
-			{
-				for (v = 0; v < height; v++)
-				{
-					if (((y + v) >= cy1) && ((y + v) <= cy2))
-					{
-						for (u = 0; u < width[c]; u++)
-							if ((t[u]) && ((x + (int)cx + u) < target->width))
-								d[u] = AddBlend( t[u], d[u] );
-					}
-					t += surface->width, d += target->width;
-				}
-			}
-			else
-			{
-				for (v = 0; v < height; v++)
-				{
-					if (((y + v) >= cy1) && ((y + v) <= cy2))
-						for (u = 0; u < width[c]; u++) if (t[u]) d[u] = AddBlend( t[u], d[u] );
-					t += surface->width, d += target->width;
-				}
-			}
-			cx += width[c] + 2;
-			if ((int)(cx + x) >= target->width) break;
+			// one keyed blend from the first to the last span of the row: the pixels between
+			// spans are black, so they are left alone. Widened to a multiple of 4 where the
+			// glyph allows, so that SIMD kernels have no scalar tail.
+			if (index[v] == index[v + 1]) continue;
+			const Span& first = spans[index[v]], & last = spans[index[v + 1] - 1];
+			int a = max( (int)first.u, u1 ), b = min( last.u + last.run, u2 );
+			if (b <= a) continue;
+			const int n = (b - a + 3) & ~3;
+			b = min( a + n, u2 ), a = max( b - n, u1 );
+			rowKernels.addBlendKeyed( dst + a, src + a, b - a );
 		}
 	}
-}
\ No newline at end of file
+}
@@ -30,10 +30,45 @@ inline Pixel SubBlend( Pixel color1, Pixel color2 )
 	return (Pixel)(red + green + blue);
 }
 
+// row kernels: process n pixels of a scanline; SIMD versions are picked by SelectRowKernels
+typedef void (*RowKernel)( Pixel* dst, const Pixel* src, int n );
+struct RowKernels
+{
+	RowKernel addBlend;			// dst = AddBlend( dst, src )
+	RowKernel subBlend;			// dst = SubBlend( dst, src )
+	RowKernel copyKeyed;		// dst = src, where src rgb != 0
+	RowKernel addBlendKeyed;	// dst = AddBlend( src, dst ), where src rgb != 0
+	const char* name;
+};
+extern RowKernels rowKernels;
+bool SelectRowKernels( bool allowSIMD = true ); // returns true if SIMD kernels are in use
+
+// dirty region: a short list of rectangles (half-open, [x1,x2) x [y1,y2)) covering all pixels
+// written since the last Clear. Overlapping or touching rectangles are merged; once the list
+// is full, a new rectangle is merged with the one whose bounding box grows least.
+class DirtyRegion
+{
+public:
+	enum { MAXRECTS = 8 };
+	struct Rect { int x1, y1, x2, y2; };
+	void Add( int x1, int y1, int x2, int y2 );
+	void Clear() { count = 0; }
+	bool IsEmpty() const { return count == 0; }
+	int Count() const { return count; }
+	const Rect& Get( int i ) const { return rect[i]; }
+	int Rows( int* y1, int* y2 ) const; // sorted disjoint row ranges [y1,y2); returns the count
+private:
+	Rect rect[MAXRECTS];
+	int count = 0;
+};
+
 class Surface
 {
 	enum { OWNER = 1 };
 public:
+	// resize filters: BILINEAR is meant for scale factors down to 1/2, BOX averages all
+	// covered source pixels and does not alias on larger downscales
+	enum { NEAREST = 0, BILINEAR, BOX };
 	// constructor / destructor
 	Surface() = default;
 	Surface( int w, int h, Pixel* b ) : width( w ), height( h ), buffer( b ) {}
@@ -41,37 +76,102 @@ public:
 	Surface( const char* file );
 	~Surface();
 	// public methods
-	void InitCharset();
-	void SetChar( int c, char* c1, char* c2, char* c3, char* c4, char* c5 );
+	static void InitCharset(); // glyphs for Print; called by TemplateInit
+	static void SetChar( int c, char* c1, char* c2, char* c3, char* c4, char* c5 );
 	void Centre( const char* s, int y1, Pixel color );
 	void Print( const char* s, int x1, int y1, Pixel color );
 	void Clear( Pixel color );
-	void Line( float x1, float y1, float x2, float y2, Pixel color );
+	// lines include both endpoints and are clipped to the surface; drawing can be limited to
+	// rows [row1,row2). LineAA blends an anti-aliased line over the existing pixels.
+	void Line( float x1, float y1, float x2, float y2, Pixel color, int row1 = 0, int row2 = INT_MAX );
+	void LineAA( float x1, float y1, float x2, float y2, Pixel color, int row1 = 0, int row2 = INT_MAX );
+	void LineList( const float* xy, int count, Pixel color, bool aa = false ); // count lines: x1,y1,x2,y2 each
+	void Polyline( const float* xy, int points, Pixel color, bool closed = false, bool aa = false ); // x,y per point
 	void HLine( int x1, int y1, int l, Pixel color );
 	void VLine( int x1, int y1, int l, Pixel color );
 	void Plot( int x, int y, Pixel c );
-	void LoadPNGImage( const char* file );
+	void LoadPNGImage( const char* file, bool direct = true ); // direct = false: always decodePNG and repack
 	void CopyTo( Surface* dst, int x, int y );
 	void BlendCopyTo( Surface* dst, int x, int y );
 	void ScaleColor( unsigned int scale );
 	void Box( int x1, int y1, int x2, int y2, Pixel color );
 	void Bar( int x1, int y1, int x2, int y2, Pixel color );
-	void Resize( Surface* orig );
+	// filled triangles and convex polygons. Vertices are in pixels, where pixel (x,y) covers
+	// [x,x+1) x [y,y+1) and is drawn when its centre is inside; shared edges are drawn once
+	// (top-left rule). Gouraud colors are rgb in [0,1], texture coordinates are in texels of
+	// the texture (clamped, affine). Drawing can be limited to rows [row1,row2).
+	void Triangle( const vec2& v0, const vec2& v1, const vec2& v2, Pixel color, int row1 = 0, int row2 = INT_MAX );
+	void Triangle( const vec2& v0, const vec2& v1, const vec2& v2, const vec3& c0, const vec3& c1, const vec3& c2, int row1 = 0, int row2 = INT_MAX );
+	void Triangle( const vec2& v0, const vec2& v1, const vec2& v2, const vec2& t0, const vec2& t1, const vec2& t2, const Surface* texture, int row1 = 0, int row2 = INT_MAX );
+	void Polygon( const vec2* v, int n, Pixel color, int row1 = 0, int row2 = INT_MAX );
+	void Resize( Surface* orig, int filter = BILINEAR ); // fills this surface with a scaled copy of orig
+	// mip chain: half-size box filtered copies down to 1x1, owned by this surface. MipFor
+	// returns the smallest level that is at least w x h (this surface if there is none), e.g.
+	// thumb.Resize( image.MipFor( thumb.width, thumb.height ) ) for a cheap, clean thumbnail.
+	// Levels are not updated when the surface changes; call BuildMips again.
+	void BuildMips();
+	Surface* Mip( int level ); // level 0 is this surface; clamped to the last level
+	Surface* MipFor( int w, int h );
+	// dirty tracking, when a region is attached; code that writes to buffer directly should
+	// call MarkDirty itself
+	void MarkDirty( int x1, int y1, int x2, int y2 )
+	{
+		if (!dirty) return;
+		x1 = max( x1, 0 ), y1 = max( y1, 0 ), x2 = min( x2, width ), y2 = min( y2, height );
+		if (x1 < x2 && y1 < y2) dirty->Add( x1, y1, x2, y2 );
+	}
 private:
 	// private methods
-	bool LoadPNGFile( const char* fileName, uint& w, uint& h, vector<uchar>& image );
+	bool ClipLine( float& x1, float& y1, float& x2, float& y2 ) const;
+	void LineInt( int x1, int y1, int x2, int y2, Pixel color, int row1 = 0, int row2 = INT_MAX ); // unclipped
+	bool decodePNGDirect( const uchar* in_png, size_t in_size );
 	int decodePNG( vector<uchar>& out_image, uint& image_width, uint& image_height, const uchar* in_png, size_t in_size, bool convert_to_rgba32 = true );
 public:
 	// public attributes
 	Pixel* buffer = 0;
 	int width = 0, height = 0, flags = 0;
+	DirtyRegion* dirty = 0; // not owned; 0 disables tracking
+	Surface* mip = 0; // next mip level, see BuildMips
 private:
 	// static attributes for the builtin font
 	inline static char font[51][5][6];
-	inline static bool fontInitialized = false;
+	inline static uchar fontOn[51][6], fontOff[51][6]; // per glyph row: bits drawn in color and in black
 	inline static int transl[256];
 };
 
+// indexed surface: 8 or 4 bits per pixel plus a palette of 256 or 16 colors, for a quarter
+// or an eighth of the memory of a Surface. 4-bit rows store the left pixel of each byte in
+// the low nibble. Blits look colors up in the palette, or in a palette passed to them, so
+// palette swaps and cycling never touch the pixel data.
+class IndexedSurface
+{
+public:
+	IndexedSurface( int w, int h, int bits = 8 );
+	IndexedSurface( const Surface* src, int bits = 8 ); // converts; surplus colors map to the nearest entry
+	~IndexedSurface();
+	uint Get( int x, int y ) const { return bits == 8 ? buffer[x + y * pitch] : (buffer[(x >> 1) + y * pitch] >> ((x & 1) * 4)) & 15; }
+	void Set( int x, int y, uint e )
+	{
+		if (bits == 8) buffer[x + y * pitch] = (uchar)e; else
+		{
+			uchar& b = buffer[(x >> 1) + y * pitch];
+			b = (x & 1) ? (uchar)((b & 15) | (e << 4)) : (uchar)((b & 0xf0) | (e & 15));
+		}
+	}
+	void CopyTo( Surface* dst, int x, int y, const Pixel* pal = 0 ) const;
+	void CopyToKeyed( Surface* dst, int x, int y, uint key = 0, const Pixel* pal = 0 ) const; // skips index key
+	void CyclePalette( int first, int count, int steps = 1 );
+	size_t Bytes() const { return (size_t)pitch * height + (sizeof( Pixel ) << bits); } // pixels plus palette
+	// public attributes
+	uchar* buffer = 0;
+	int width, height, bits, pitch; // pitch in bytes
+	Pixel palette[256];
+private:
+	IndexedSurface( const IndexedSurface& ) = delete;
+	IndexedSurface& operator = ( const IndexedSurface& ) = delete;
+	void Blit( Surface* dst, int x, int y, const Pixel* pal, int key ) const;
+};
+
 class Sprite
 {
 public:
@@ -91,22 +191,39 @@ public:
 	};
 
 	// Structors
-	Sprite( Surface* surface, unsigned int frames );
+	Sprite( Surface* surface, unsigned int frames, bool compile = false );
 	~Sprite();
 	// Methods
-	void Draw( Surface* target, int x, int y );
-	void DrawScaled( int x, int y, int w, int h, Surface* target );
+	void Compile();
+	void Draw( Surface* target, int x, int y ) { Draw( target, x, y, currentFrame, flags ); }
+	void Draw( Surface* target, int x, int y, uint frame, uint drawFlags );
+	void DrawScaled( int x, int y, int w, int h, Surface* target ); // current frame, stretched over [x,x+w) x [y,y+h)
+	// centred at (x,y), rotated by angle (radians) and scaled; negative scales flip the sprite.
+	// Both scaled draws use the mips of the sprite surface when shrinking by 2x or more, if
+	// GetSurface()->BuildMips() was called; mips blend transparent pixels into the edges.
+	void DrawTransformed( Surface* target, float x, float y, float angle, float sx, float sy, uint frame, uint drawFlags );
+	void DrawTransformed( Surface* target, float x, float y, float angle, float scale = 1 ) { DrawTransformed( target, x, y, angle, scale, scale, currentFrame, flags ); }
 	void SetFlags( uint f ) { flags = f; }
 	void SetFrame( uint i ) { currentFrame = i; }
+	unsigned int GetFrame() const { return currentFrame; }
 	unsigned int GetFlags() const { return flags; }
 	int GetWidth() { return width; }
 	int GetHeight() { return height; }
 	Pixel* GetBuffer() { return surface->buffer; }
 	unsigned int Frames() { return numFrames; }
 	Surface* GetSurface() { return surface; }
+	bool IsCompiled() const { return !spanIndex.empty(); }
 private:
+	friend class SpriteBatch;
 	// Methods
 	void InitializeStartData();
+	void DrawSpans( Pixel* dst, int dpitch, int u1, int u2, int v1, int v2, uint frame, bool flare );
+	void DrawAffine( Surface* target, float u0, float v0, float dudx, float dvdx, float dudy, float dvdy, int x1, int y1, int x2, int y2, uint frame, bool flare );
+	// compiled sprite data: each row is a list of (skip, run) spans of opaque pixels
+	struct Span { unsigned short skip, run; };
+	vector<Span> spans;
+	vector<uint> spanIndex; // first span of row v of frame f is at spanIndex[f * height + v]
+	vector<Span> extents; // per row of each frame: (first, count) covering all opaque pixels; for FLARE
 	// Attributes
 	int width = 0, height = 0, m_Pitch;
 	unsigned int numFrames = 1;
@@ -116,20 +233,39 @@ private:
 	Surface* surface = 0;
 };
 
+// bitmap font: glyphs are found as columns of non-black pixels in an image, one per
+// character of chars. Glyph rows are stored as runs of opaque pixels, and Print keeps
+// the layout of recently printed strings, so static text costs a hash lookup plus the
+// blits. Print is not thread-safe for a single Font.
 class Font
 {
 public:
 	Font() = default;
 	Font( char* file, char* chars );
+	Font( Surface* glyphs, const char* chars ); // takes ownership of glyphs
 	~Font();
-	void Print( Surface* target, char* text, int x, int y, bool clip = false );
+	void Print( Surface* target, char* text, int x, int y, bool clip = false ); // always clips; clip is ignored
 	void Centre( Surface* target, char* text, int y );
 	int Width( char* text );
 	int Height() { return surface->height; }
 	void YClip( int y1, int y2 ) { cy1 = y1; cy2 = y2; }
 private:
+	enum { MAXLAYOUTS = 256 }; // the cache is emptied when it is full
+	struct Span { unsigned short u, run; };
+	struct Layout
+	{
+		struct Glyph { int index, x; };
+		string text;
+		vector<Glyph> glyphs; // spaces are left out
+		int width;
+	};
+	const Layout& GetLayout( const char* text );
 	Surface* surface = 0;
 	int* offset = 0, * width = 0, * trans = 0, height, cy1, cy2;
+	int advance[256];
+	vector<Span> spans;
+	vector<uint> spanIndex; // first span of row v of glyph g is at spanIndex[g * height + v]
+	unordered_map<uint64_t, Layout> layouts;
 };
 
 #endif
\ No newline at end of file
@@ -7,9 +7,157 @@ typedef unsigned int uint;
 // namespace
 using namespace std;
 
+// math
+
+mat4 mat4::rotate( const vec3 l, const float a )
+{
+	// http://inside.mines.edu/fs_home/gmurray/ArbitraryAxisRotation
+	mat4 M;
+	const float u = l.x, v = l.y, w = l.z, ca = cosf( a ), sa = sinf( a );
+	M.cell[0] = u * u + (v * v + w * w) * ca, M.cell[1] = u * v * (1 - ca) - w * sa;
+	M.cell[2] = u * w * (1 - ca) + v * sa, M.cell[4] = u * v * (1 - ca) + w * sa;
+	M.cell[5] = v * v + (u * u + w * w) * ca, M.cell[6] = v * w * (1 - ca) - u * sa;
+	M.cell[8] = u * w * (1 - ca) - v * sa, M.cell[9] = v * w * (1 - ca) + u * sa;
+	M.cell[10] = w * w + (u * u + v * v) * ca;
+	return M;
+}
+
+mat4 mat4::rotatex( const float a )
+{
+	mat4 M;
+	const float ca = cosf( a ), sa = sinf( a );
+	M.cell[5] = ca, M.cell[6] = -sa, M.cell[9] = sa, M.cell[10] = ca;
+	return M;
+}
+
+mat4 mat4::rotatey( const float a )
+{
+	mat4 M;
+	const float ca = cosf( a ), sa = sinf( a );
+	M.cell[0] = ca, M.cell[2] = sa, M.cell[8] = -sa, M.cell[10] = ca;
+	return M;
+}
+
+mat4 mat4::rotatez( const float a )
+{
+	mat4 M;
+	const float ca = cosf( a ), sa = sinf( a );
+	M.cell[0] = ca, M.cell[1] = -sa, M.cell[4] = sa, M.cell[5] = ca;
+	return M;
+}
+
+void mat4::invert()
+{
+	// Laplace expansion over 2x2 sub-determinants of the top and bottom rows; a third of
+	// the multiplications of the full cofactor expansion
+	const float* a = cell;
+	const float s0 = a[0] * a[5] - a[4] * a[1], s1 = a[0] * a[6] - a[4] * a[2], s2 = a[0] * a[7] - a[4] * a[3];
+	const float s3 = a[1] * a[6] - a[5] * a[2], s4 = a[1] * a[7] - a[5] * a[3], s5 = a[2] * a[7] - a[6] * a[3];
+	const float c5 = a[10] * a[15] - a[14] * a[11], c4 = a[9] * a[15] - a[13] * a[11], c3 = a[9] * a[14] - a[13] * a[10];
+	const float c2 = a[8] * a[15] - a[12] * a[11], c1 = a[8] * a[14] - a[12] * a[10], c0 = a[8] * a[13] - a[12] * a[9];
+	const float det = s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0;
+	if (det == 0) return;
+	const float r = 1.0f / det;
+	const float inv[16] = {
+		(a[5] * c5 - a[6] * c4 + a[7] * c3) * r, (-a[1] * c5 + a[2] * c4 - a[3] * c3) * r,
+		(a[13] * s5 - a[14] * s4 + a[15] * s3) * r, (-a[9] * s5 + a[10] * s4 - a[11] * s3) * r,
+		(-a[4] * c5 + a[6] * c2 - a[7] * c1) * r, (a[0] * c5 - a[2] * c2 + a[3] * c1) * r,
+		(-a[12] * s5 + a[14] * s2 - a[15] * s1) * r, (a[8] * s5 - a[10] * s2 + a[11] * s1) * r,
+		(a[4] * c4 - a[5] * c2 + a[7] * c0) * r, (-a[0] * c4 + a[1] * c2 - a[3] * c0) * r,
+		(a[12] * s4 - a[13] * s2 + a[15] * s0) * r, (-a[8] * s4 + a[9] * s2 - a[11] * s0) * r,
+		(-a[4] * c3 + a[5] * c1 - a[6] * c0) * r, (a[0] * c3 - a[1] * c1 + a[2] * c0) * r,
+		(-a[12] * s3 + a[13] * s1 - a[14] * s0) * r, (a[8] * s3 - a[9] * s1 + a[10] * s0) * r
+	};
+	memcpy( cell, inv, sizeof( inv ) );
+}
+
+mat4 operator * ( const mat4& a, const mat4& b )
+{
+	mat4 r;
+#ifdef TMPL8_SIMD
+	// row i of the product: the rows of b, weighted by row i of a
+	for (int i = 0; i < 4; i++)
+		r.row[i] = qadd( qadd( qadd( qmul( qset( a.cell[i * 4] ), b.row[0] ), qmul( qset( a.cell[i * 4 + 1] ), b.row[1] ) ),
+			qmul( qset( a.cell[i * 4 + 2] ), b.row[2] ) ), qmul( qset( a.cell[i * 4 + 3] ), b.row[3] ) );
+#else
+	for (int i = 0; i < 4; i++) for (int j = 0; j < 4; j++)
+		r.cell[i * 4 + j] = a.cell[i * 4] * b.cell[j] + a.cell[i * 4 + 1] * b.cell[4 + j] + a.cell[i * 4 + 2] * b.cell[8 + j] + a.cell[i * 4 + 3] * b.cell[12 + j];
+#endif
+	return r;
+}
+
+// the batched transforms evaluate each sum in the same order as the scalar tails and
+// operator * ( vec4, mat4 ), so the vector and scalar paths give identical results
+
+void TransformPoints( const mat4& M, const float* x, const float* y, const float* z, float* ox, float* oy, float* oz, int n )
+{
+	const float* m = M.cell;
+	int i = 0;
+#ifdef TMPL8_SIMD
+	quad c[12];
+	for (int k = 0; k < 12; k++) c[k] = qset( m[k] );
+	for (; i + 4 <= n; i += 4)
+	{
+		const quad px = qload( x + i ), py = qload( y + i ), pz = qload( z + i );
+		qstore( ox + i, qadd( qadd( qadd( qmul( px, c[0] ), qmul( py, c[1] ) ), qmul( pz, c[2] ) ), c[3] ) );
+		qstore( oy + i, qadd( qadd( qadd( qmul( px, c[4] ), qmul( py, c[5] ) ), qmul( pz, c[6] ) ), c[7] ) );
+		qstore( oz + i, qadd( qadd( qadd( qmul( px, c[8] ), qmul( py, c[9] ) ), qmul( pz, c[10] ) ), c[11] ) );
+	}
+#endif
+	for (; i < n; i++)
+	{
+		const float px = x[i], py = y[i], pz = z[i];
+		ox[i] = px * m[0] + py * m[1] + pz * m[2] + m[3];
+		oy[i] = px * m[4] + py * m[5] + pz * m[6] + m[7];
+		oz[i] = px * m[8] + py * m[9] + pz * m[10] + m[11];
+	}
+}
+
+void ProjectPoints( const mat4& M, const float* x, const float* y, const float* z, float* sx, float* sy, int n )
+{
+	const float* m = M.cell;
+	int i = 0;
+#ifdef TMPL8_SIMD
+	quad c[16];
+	for (int k = 0; k < 16; k++) c[k] = qset( m[k] );
+	const quad one = qset( 1 );
+	for (; i + 4 <= n; i += 4)
+	{
+		const quad px = qload( x + i ), py = qload( y + i ), pz = qload( z + i );
+		const quad r = qdiv( one, qadd( qadd( qadd( qmul( px, c[12] ), qmul( py, c[13] ) ), qmul( pz, c[14] ) ), c[15] ) );
+		qstore( sx + i, qmul( qadd( qadd( qadd( qmul( px, c[0] ), qmul( py, c[1] ) ), qmul( pz, c[2] ) ), c[3] ), r ) );
+		qstore( sy + i, qmul( qadd( qadd( qadd( qmul( px, c[4] ), qmul( py, c[5] ) ), qmul( pz, c[6] ) ), c[7] ), r ) );
+	}
+#endif
+	for (; i < n; i++)
+	{
+		const float px = x[i], py = y[i], pz = z[i];
+		const float r = 1.0f / (px * m[12] + py * m[13] + pz * m[14] + m[15]);
+		sx[i] = (px * m[0] + py * m[1] + pz * m[2] + m[3]) * r;
+		sy[i] = (px * m[4] + py * m[5] + pz * m[6] + m[7]) * r;
+	}
+}
+
+void TransformVectors( const mat4& M, const vec4* v, vec4* out, int n )
+{
+#ifdef TMPL8_SIMD
+	// the columns of M, weighted by the components of v
+	const float* m = M.cell;
+	vec4 col[4];
+	for (int j = 0; j < 4; j++) col[j] = vec4( m[j], m[4 + j], m[8 + j], m[12 + j] );
+	for (int i = 0; i < n; i++)
+	{
+		const vec4 p = v[i];
+		out[i] = vec4( qadd( qadd( qadd( qmul( qset( p.x ), col[0].m4 ), qmul( qset( p.y ), col[1].m4 ) ), qmul( qset( p.z ), col[2].m4 ) ), qmul( qset( p.w ), col[3].m4 ) ) );
+	}
+#else
+	for (int i = 0; i < n; i++) out[i] = v[i] * M;
+#endif
+}
+
 // game objects
 static Game game;
-GLuint pixels = -1, shader = -1, basic = -1;
+GLuint pixels = -1, basic = -1;
 
 // error reporting
 Surface* errorSurf = 0;
@@ -31,8 +179,54 @@ void FatalError( const char* err )
 		y += 8, offs += 53;
 	}
 	errorSurf->Print( err + offs, 1, y, 0xffffffff );
+#ifdef TMPL8_HEADLESS
+	fprintf( stderr, "error: %s\n", err );
+#endif
+}
+
+// files
+
+void loadBinaryFile( vector<uchar>& buffer, const string& filename )
+{
+	// prefer Asset for read-only access; this copies the mapped file once
+	Asset asset( filename.c_str() );
+	buffer.assign( asset.Data(), asset.Data() + asset.Size() );
+}
+
+int nativeWidth = 1024, nativeHeight = 640;
+
+// frame timing: deltaTime is the duration of the previous frame in ms; the simulation runs
+// in fixed steps, see GameLoop
+static Timer frameTimer;
+static float deltaTime = 0;
+
+void GameTick()
+{
+	PROFILE_ZONE( "Tick" );
+	game.loader->Update();
+	for (int steps = GameLoop::Advance( deltaTime ); steps > 0; steps--)
+	{
+		PROFILE_ZONE( "Step" );
+		game.Step( GameLoop::StepTime() );
+	}
+	game.Tick( deltaTime, GameLoop::Alpha() );
+}
+
+void FrameDone( bool presented )
+{
+	// pace to GameLoop::targetRate; idle frames that were not presented wait as well
+	{
+		PROFILE_ZONE( "Pace" );
+		GameLoop::Pace( 1000.0f * frameTimer.elapsed(), presented );
+	}
+	deltaTime = min( 500.0f, 1000.0f * frameTimer.elapsed() );
+	frameTimer.reset();
+	GameLoop::FrameDone( deltaTime );
+	Profiler::FrameDone( deltaTime );
 }
 
+#ifndef TMPL8_HEADLESS
+
 // functions
 
 GLuint CreateTexture( uint* pixels, int w, int h )
@@ -119,51 +313,6 @@ GLuint CompileShader( const char* vtext, const char* ftext )
 	return retVal;
 }
 
-GLuint PostprocShader()
-{
-#ifdef _WIN64
-	const char vsText[] = "#version 330\nlayout(location=0)in vec3 pos;\nlayout(location=1)in "
-		"vec2 uv;\nout vec2 t;\nvoid main(){t=uv;gl_Position=vec4(pos,1);}";
-	char fsText[4096] = "#version 330\nuniform sampler2D C;\nin vec2 t;\nvec2 r=vec2(320,192);\n";
-#else
-	char vsText[] = "attribute vec4 pos;\nattribute vec2 uv;\nvarying vec2 t; \n"
-		"void main(){gl_Position=pos;t=uv;}";
-	char fsText[4096] = "precision mediump float;\nuniform sampler2D C;\nvarying vec2 t;\n"
-		"const vec2 r=vec2(320,192);\n";
-#endif
-#ifdef _WIN64
-	// full version; expensive on mobile
-	char fsBody[] = // by Timothy Lottes, https://www.shadertoy.com/view/ls2SRD
-		"float ToLinear1(float c){return(c<=0.04045)?c/12.92:pow((c+0.055)/1.055,2.4);}vec3 ToL(vec"
-		"3 c){return vec3(ToLinear1(c.r),ToLinear1(c.g),ToLinear1(c.b));}float srgb1(float c){retur"
-		"n(c<0.0031308?c*12.92:1.055*pow(c,0.41666)-0.055);}vec3 srgb(vec3 c){return vec3(srgb1(c.r"
-		"),srgb1(c.g),srgb1(c.b));}vec3 F(vec2 p,vec2 o){p=(p*r+o)/r;if(max(abs(p.x-0.5),abs(p.y-0."
-		"5))>1.)return vec3(0);return ToL(texture2D(C,p,-16.).rgb);}vec2 D(vec2 p){p=p*r;return -(("
-		"p-floor(p))-vec2(0.5));}float G(float p,float s){return exp2(s*pow(abs(p),3.));}vec3 H5(ve"
-		"c2 p,float o){vec3 a=F(p,vec2(-2.,o)),b=F(p,vec2(-1.,o)),c=F(p,vec2(0.,o));vec3 d=F(p,vec2"
-		"(1.,o)),e=F(p,vec2(2.,o));float l=D(p).x,wa=G(l-2.,-4.),wb=G(l-1.,-4.),wc=G(l,-4.),wd=G(l+"
-		"1.,-4.),we=G(l+2.,-4.);return(a*wa+b*wb+c*wc+d*wd+e*we)/(wa+wb+wc+wd+we);}vec3 H7(vec2 p,f"
-		"loat o){vec3 a=F(p,vec2(-3.,o)),b=F(p,vec2(-2.,o)),c=F(p,vec2(-1.,o)),d=F(p,vec2(0.,o));ve"
-		"c3 e=F(p,vec2(1.,o)),f=F(p,vec2(2.,o)),g=F(p,vec2(3.,o));float l=D(p).x,wa=G(l-3.,-4.),wb="
-		"G(l-2.,-4.);float wc=G(l-1.,-4.),wd=G(l,-4.),we=G(l+1.,-4.),wf=G(l+2.,-4.),wg=G(l+3.,-4.);"
-		"return(a*wa+b*wb+c*wc+d*wd+e*we+f*wf+g*wg)/(wa+wb+wc+wd+we+wf+wg);}float S(vec2 p,float o)"
-		"{return G(D(p).y+o,-24.);}vec3 Tri(vec2 p){return (H5(p,-2.)*S(p,-2.)+H7(p,-1.)*S(p,-1.)+H"
-		"7(p,0.)*S(p,0.)+H7(p,1.)*S(p,1.)+H5(p,2.)*S(p,2.))*1.25;}vec3 M(vec2 p){p.x+=p.y*3.;vec3 m"
-		"=vec3(0.65);p.x=fract(p.x/6.);if(p.x<.333)m.r=1.35;else if(p.x<0.666)m.g=1.35;else m.b=1.3"
-		"5;return m;}void main(){gl_FragColor=vec4(srgb(Tri(t)*M(t*vec2(1024,640))).bgr,1);}";
-#else
-	// my cheap approximation
-	char fsBody[] =
-		"vec3 M(vec2 p){p.x+=p.y*3.;vec3 m=vec3(0.8);p.x=fract(p.x/6.);if(p.x<.333)m.r=1.2;else if("
-		"p.x<0.666)m.g=1.2;else m.b=1.2;return m;}void main(){vec2 p=t*vec2(320,192);float o=abs(p."
-		"y-floor(p.y)-0.5);float s=min(1.,1./(3.*o+0.3));vec2 d=vec2(s/640.,0.);vec4 pl=texture2D(C"
-		",t-d),pr=texture2D(C,t+d),p0=texture2D(C,t);gl_FragColor=vec4((pl*0.25+p0*0.5+pr*0.25).bgr"
-		"*s*M(t*vec2(1024,640)),1);}";
-#endif
-	strcat( fsText, fsBody );
-	return CompileShader( vsText, fsText );
-}
-
 GLuint LoadTexture( const char* fileName, uint** data = 0 )
 {
 	Surface t( fileName );
@@ -242,26 +391,91 @@ GLuint LoadShader()
 	return CompileShader( vsText, fsText );
 }
 
-// files
+// screen upload: the texture storage is allocated once; each frame is copied into one of a
+// ring of pixel unpack buffers, from which the driver updates the texture asynchronously.
+// A fence per buffer prevents overwriting a buffer that the GPU is still reading from.
+#define UPLOAD_BUFFERS 3
+static GLuint uploadBuffer[UPLOAD_BUFFERS];
+static GLsync uploadFence[UPLOAD_BUFFERS];
+static int uploadIdx = 0;
+static bool pboAvailable = true;	// false on OpenGL ES 2.0 devices
+bool usePBO = true;					// can be accessed as extern; false selects the old glTexImage2D path
+float uploadTime = 0;				// smoothed cost of the upload in ms, can be accessed as extern
+uint uploadedBytes = 0;				// bytes uploaded for the last presented frame, can be accessed as extern
+uint skippedFrames = 0;				// frames without changes, which were not presented; can be accessed as extern
+static DirtyRegion screenDirty;		// changes to game.screen since the last upload
+static bool fullRedraw = true;		// upload everything on the next frame, e.g. after (re)initialization
+static Surface* overlay = 0;		// profiler overlay, composited over the screen at upload time
+static Surface* composed = 0;		// uploaded rows of the screen with the overlay on top
+static int overlayRows = 0;			// height of the overlay in the last upload; 0 if hidden
+static int64_t overlayTime = 0;		// last overlay refresh, in ns
+void ShowUploadTime();
 
-void loadBinaryFile( vector<uchar>& buffer, const string& filename )
+void InitUpload()
 {
-#ifdef _WIN64
-	FILE* f = fopen( filename.c_str(), "rb" );
-#else
-	FILE* f = android_fopen( filename.c_str(), "rb" );
-#endif
-	buffer.clear();
-	char t[1028];
-	while (!feof( f ))
+	if (!pboAvailable) return;
+	glGenBuffers( UPLOAD_BUFFERS, uploadBuffer );
+	for (int i = 0; i < UPLOAD_BUFFERS; i++)
 	{
-		uint bytes = (uint)fread( t, 1, 1024, f );
-		for (uint i = 0; i < bytes; i++) buffer.push_back( t[i] );
+		glBindBuffer( GL_PIXEL_UNPACK_BUFFER, uploadBuffer[i] );
+		glBufferData( GL_PIXEL_UNPACK_BUFFER, 320 * 192 * 4, 0, GL_STREAM_DRAW );
+		uploadFence[i] = 0;
 	}
-	fclose( f );
+	glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
 }
 
-int nativeWidth = 1024, nativeHeight = 640;
+void UploadScreen( const Pixel* pixels, int ranges = 1, const int* y1 = 0, const int* y2 = 0 )
+{
+	// upload row ranges [y1,y2) of a 320x192 pixel buffer to the currently bound texture;
+	// without ranges, the full buffer is uploaded
+	PROFILE_ZONE( "Upload" );
+	const auto start = chrono::high_resolution_clock::now();
+	static const int all1 = 0, all2 = 192;
+	if (!y1) ranges = 1, y1 = &all1, y2 = &all2;
+	uploadedBytes = 0;
+	for (int i = 0; i < ranges; i++) uploadedBytes += (y2[i] - y1[i]) * 320 * 4;
+	if (!usePBO || !pboAvailable)
+	{
+		if (uploadedBytes == 320 * 192 * 4) glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA, 320, 192, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels );
+		else for (int i = 0; i < ranges; i++)
+			glTexSubImage2D( GL_TEXTURE_2D, 0, 0, y1[i], 320, y2[i] - y1[i], GL_RGBA, GL_UNSIGNED_BYTE, pixels + y1[i] * 320 );
+	}
+	else
+	{
+		GLsync& fence = uploadFence[uploadIdx];
+		if (fence)
+		{
+			// normally signaled long ago; only blocks if the GPU is UPLOAD_BUFFERS frames behind
+			glClientWaitSync( fence, GL_SYNC_FLUSH_COMMANDS_BIT, 100000000 /* 100ms */ );
+			glDeleteSync( fence );
+			fence = 0;
+		}
+		glBindBuffer( GL_PIXEL_UNPACK_BUFFER, uploadBuffer[uploadIdx] );
+		void* dst = glMapBufferRange( GL_PIXEL_UNPACK_BUFFER, 0, 320 * 192 * 4,
+			GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT );
+		if (dst)
+		{
+			// rows keep their offset in the buffer; the other rows are left undefined
+			for (int i = 0; i < ranges; i++) memcpy( (Pixel*)dst + y1[i] * 320, pixels + y1[i] * 320, (y2[i] - y1[i]) * 320 * 4 );
+			glUnmapBuffer( GL_PIXEL_UNPACK_BUFFER );
+			for (int i = 0; i < ranges; i++) glTexSubImage2D( GL_TEXTURE_2D, 0, 0, y1[i], 320, y2[i] - y1[i],
+				GL_RGBA, GL_UNSIGNED_BYTE, (void*)(size_t)(y1[i] * 320 * 4) /* offset in buffer */ );
+			glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
+		}
+		else
+		{
+			glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
+			for (int i = 0; i < ranges; i++)
+				glTexSubImage2D( GL_TEXTURE_2D, 0, 0, y1[i], 320, y2[i] - y1[i], GL_RGBA, GL_UNSIGNED_BYTE, pixels + y1[i] * 320 );
+		}
+		fence = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+		uploadIdx = (uploadIdx + 1) % UPLOAD_BUFFERS;
+	}
+	const float ms = chrono::duration<float, milli>( chrono::high_resolution_clock::now() - start ).count();
+	uploadTime = uploadTime * 0.95f + ms * 0.05f;
+	static int frame = 0;
+	if (++frame % 60 == 0) ShowUploadTime();
+}
 
 void TemplateInit()
 {
@@ -271,19 +485,52 @@ void TemplateInit()
 	glDisable( GL_CULL_FACE );
 	glEnable( GL_BLEND );
 	glBlendFunc( GL_SRC_ALPHA, GL_ONE );
+	// pick SSE2/NEON row kernels for surface blits, if available
+	SelectRowKernels();
+	// glyphs for Surface::Print
+	Surface::InitCharset();
+	// search assets.pak, if present, before individual asset files; see tools/packer. Mounted
+	// once; if it fails, the next (re)initialization tries again
+	static bool packMounted = false;
+	if (!packMounted) packMounted = Pack::Mount( "assets.pak" );
 	// game screen
 	game.screen = new Surface( 320, 192 );
+	// track changes to the screen, so that unchanged rows are not uploaded. Code that writes
+	// to game.screen->buffer directly must call game.screen->MarkDirty for the pixels it changes.
+	game.screen->dirty = &screenDirty;
+	screenDirty.Clear();
+	fullRedraw = true;
+	game.renderer = new Renderer( game.screen );
+	if (!game.loader) game.loader = new AssetLoader(); // workers survive a display re-init
 	errorSurf = new Surface( 320, 192 );
 	pixels = CreateTexture( game.screen->buffer, 320, 192 );
 	errorPixels = CreateTexture( errorSurf->buffer, 320, 192 );
-	shader = PostprocShader();
 	basic = BasicShader();
+	PostProcess::Init( pboAvailable );
+	InitUpload();
 	// initialize SoLoud
 	game.loud.init();
+	game.loud.mMixCallback = Profiler::MixCallback;
+}
+
+static int RefreshOverlay()
+{
+	// the profiler overlay is drawn into its own surface a few times per second, so that it
+	// neither overwrites game pixels nor forces an upload every frame; returns its height
+	if (!overlay) overlay = new Surface( 320, 192 ), composed = new Surface( 320, 192 );
+	const int64_t now = Profiler::Now();
+	if (overlayRows && now - overlayTime < 250000000) return overlayRows;
+	overlayTime = now;
+	overlay->Clear( 0 );
+	const int rows = min( 192, Profiler::DrawOverlay( overlay ) );
+	screenDirty.Add( 0, 0, 320, max( rows, overlayRows ) );
+	return rows;
 }
 
-void PostTick()
+bool PostTick()
 {
+	// returns false if nothing changed; the previous frame can then stay on screen
+	PROFILE_ZONE( "PostTick" );
 	if (error)
 	{
 		// display the error surface
@@ -291,22 +538,46 @@ void PostTick()
 		glDisable( GL_BLEND );
 		glActiveTexture( GL_TEXTURE0 );
 		glBindTexture( GL_TEXTURE_2D, errorPixels );
-		glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA, 320, 192, 0, GL_RGBA, GL_UNSIGNED_BYTE, errorSurf->buffer );
-
+		UploadScreen( errorSurf->buffer );
+		DrawQuad();
 	}
 	else
 	{
-		// render pixel buffer
-		glUseProgram( shader );
+		// finish deferred drawing, if any, and render pixel buffer
+		game.renderer->Flush();
+		game.capture.Frame( game.screen );
+		const int rows = Profiler::showOverlay ? RefreshOverlay() : 0;
+		if (rows < overlayRows) screenDirty.Add( 0, 0, 320, overlayRows ); // uncover the game pixels
+		overlayRows = rows;
+		if (fullRedraw) screenDirty.Add( 0, 0, 320, 192 ), fullRedraw = false;
+		if (screenDirty.IsEmpty()) { skippedFrames++; return false; }
+		int y1[DirtyRegion::MAXRECTS], y2[DirtyRegion::MAXRECTS];
+		const int ranges = screenDirty.Rows( y1, y2 );
+		screenDirty.Clear();
 		glDisable( GL_BLEND );
 		glActiveTexture( GL_TEXTURE0 );
 		glBindTexture( GL_TEXTURE_2D, pixels );
-		glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA, 320, 192, 0, GL_RGBA, GL_UNSIGNED_BYTE, game.screen->buffer );
+		const Pixel* src = game.screen->buffer;
+		if (overlayRows)
+		{
+			// the uploaded rows: the screen, with the non-black overlay pixels on top
+			for (int i = 0; i < ranges; i++)
+			{
+				memcpy( composed->buffer + y1[i] * 320, src + y1[i] * 320, (y2[i] - y1[i]) * 320 * 4 );
+				for (int y = y1[i]; y < min( y2[i], overlayRows ); y++)
+					rowKernels.copyKeyed( composed->buffer + y * 320, overlay->buffer + y * 320, 320 );
+			}
+			src = composed->buffer;
+		}
+		UploadScreen( src, ranges, y1, y2 );
+		PostProcess::Draw( pixels, nativeWidth, nativeHeight );
 	}
-	DrawQuad();
 	glEnable( GL_BLEND );
+	return true;
 }
 
+#endif // TMPL8_HEADLESS
+
 #ifdef _WIN64
 
 // internal vars
@@ -316,6 +587,15 @@ GLFWwindow* window = 0;
 // window handle access
 HWND GetWindowHandle() { return glfwGetWin32Window( window ); }
 
+// timing readout
+void ShowUploadTime()
+{
+	char t[128];
+	sprintf( t, "Tmpl8win - upload: %.3fms (%s), %uKB, %u frames skipped, post: %s %.2fms", uploadTime, usePBO ? "pbo" : "glTexImage2D",
+		uploadedBytes >> 10, skippedFrames, PostProcess::Name( PostProcess::Active() ), PostProcess::GpuTime() );
+	glfwSetWindowTitle( window, t );
+}
+
 // callback
 void ReshapeWindowCallback( GLFWwindow* window, int w, int h )
 {
@@ -324,6 +604,7 @@ void ReshapeWindowCallback( GLFWwindow* window, int w, int h )
 	nativeWidth = w, nativeHeight = h;
 	game.SetScreenSize( w, h );
 	glViewport( 0, 0, w, h );
+	fullRedraw = true; // the back buffer must be redrawn
 }
 
 // application entry point
@@ -334,10 +615,13 @@ int WinMain( HINSTANCE inst, HINSTANCE prev, LPSTR cmd, int show )
 	window = glfwCreateWindow( nativeWidth, nativeHeight, "Tmpl8win", NULL, NULL );
 	if (!window) { glfwTerminate(); return -1; }
 	glfwMakeContextCurrent( window );
-	glfwSwapInterval( 1 );
+	const GLFWvidmode* mode = glfwGetVideoMode( glfwGetPrimaryMonitor() );
+	glfwSwapInterval( GameLoop::SwapInterval( mode ? (float)mode->refreshRate : 60 ) );
 	gladLoadGLES2Loader( (GLADloadproc)glfwGetProcAddress );
 	glfwSetFramebufferSizeCallback( window, ReshapeWindowCallback );
-	// go to assets folder
+	// captures go to the start folder; then go to assets folder
+	char start[1024];
+	if (_getcwd( start, sizeof( start ) )) game.capture.folder = start;
 	_chdir( "../app/src/main/assets" );
 	// application initialization
 	TemplateInit();
@@ -365,18 +649,203 @@ int WinMain( HINSTANCE inst, HINSTANCE prev, LPSTR cmd, int show )
 			}
 		}
 		// tick
-		game.Tick( 0 /* for now */ );
-		PostTick();
-		// present
-		glfwSwapBuffers( window );
+		GameTick();
+		// present; an unchanged frame is not drawn, and FrameDone waits a frame period instead
+		const bool presented = PostTick();
+		if (presented)
+		{
+			PROFILE_ZONE( "Swap" );
+			glfwSwapBuffers( window );
+		}
 		glfwPollEvents();
+		FrameDone( presented );
 	}
+	game.capture.Close();
 	glfwTerminate();
 	return 0;
 }
 
 #include "glad/src/glad.c"
 
+#elif defined( TMPL8_HEADLESS )
+
+// headless backend: runs the game without a window, OpenGL or audio device, so that game
+// code, surfaces and audio can be tested and benchmarked on plain Linux. Usage:
+//   Tmpl8Headless [-frames n] [-dt ms] [-input file] [-dump prefix] [-every n]
+//                 [-assets dir] [-trace file.json] [-async] [-capture dir]
+//   Tmpl8Headless -bench [options]		runs the surface benchmarks instead, see bench.cpp
+// The asset folder defaults to TMPL8_ASSETS, which the CMake build points at src/main/assets.
+// Every frame advances the game by exactly dt ms (default 1000/60), and the SoLoud null driver
+// mixes the same amount of audio. Frames are not paced; the simulation still runs in fixed steps
+// of 1000/stepRate ms, so a dt other than the step time changes the number of steps per frame.
+// Unless -async is given, asset loads are completed before each tick, so that a run is deterministic. Input scripts have one event per line:
+//   <frame> pos <x> <y>		pen position in window pixels (1024x640)
+//   <frame> down			pen down
+//   <frame> up				pen up
+// Lines starting with # are ignored. -dump writes every n-th frame as a binary PPM file;
+// -capture records every n-th frame as a JPEG file in dir through Capture, off the main thread.
+
+FILE* android_fopen( const char* fname, const char* mode ) { return fopen( fname, mode ); }
+int RunBenchmarks( int argc, char** argv ); // see src/bench/bench.cpp
+
+// no OpenGL: textures and shaders are 0, drawing does nothing
+GLuint CreateTexture( uint* pixels, int w, int h ) { return 0; }
+void SetMagFilter( GLuint id, uint flag ) {}
+void DrawQuad( float u1, float v1, float u2, float v2 ) {}
+GLuint LoadShader() { return 0; }
+
+void TemplateInit()
+{
+	SelectRowKernels();
+	Surface::InitCharset();
+	static bool packMounted = false;
+	if (!packMounted) packMounted = Pack::Mount( "assets.pak" );
+	game.screen = new Surface( 320, 192 );
+	game.renderer = new Renderer( game.screen );
+	game.loader = new AssetLoader();
+	errorSurf = new Surface( 320, 192 );
+	game.loud.init( Soloud::CLIP_ROUNDOFF, Soloud::NULLDRIVER );
+	game.loud.mMixCallback = Profiler::MixCallback;
+}
+
+bool PostTick()
+{
+	PROFILE_ZONE( "PostTick" );
+	game.renderer->Flush();
+	game.capture.Frame( game.screen ); // no display, so no profiler overlay either
+	return true;
+}
+
+struct InputEvent { int frame, type, x, y; };
+enum { PENPOS = 0, PENDOWN, PENUP };
+
+static bool LoadInput( const char* fileName, vector<InputEvent>& events )
+{
+	FILE* f = fopen( fileName, "r" );
+	if (!f) return false;
+	char line[256], type[16];
+	while (fgets( line, sizeof( line ), f ))
+	{
+		InputEvent e = {};
+		if (line[0] == '#' || sscanf( line, "%d %15s %d %d", &e.frame, type, &e.x, &e.y ) < 2) continue;
+		if (!strcmp( type, "pos" )) e.type = PENPOS;
+		else if (!strcmp( type, "down" )) e.type = PENDOWN;
+		else if (!strcmp( type, "up" )) e.type = PENUP;
+		else continue;
+		events.push_back( e );
+	}
+	fclose( f );
+	stable_sort( events.begin(), events.end(), []( const InputEvent& a, const InputEvent& b ) { return a.frame < b.frame; } );
+	return true;
+}
+
+static bool DumpFrame( const char* prefix, int frame, const Surface* s )
+{
+	char name[1024];
+	snprintf( name, sizeof( name ), "%s%05d.ppm", prefix, frame );
+	FILE* f = fopen( name, "wb" );
+	if (!f) return false;
+	vector<uchar> rgb( s->width * s->height * 3 );
+	for (int i = 0; i < s->width * s->height; i++)
+		rgb[i * 3] = (uchar)(s->buffer[i] >> 16), rgb[i * 3 + 1] = (uchar)(s->buffer[i] >> 8), rgb[i * 3 + 2] = (uchar)s->buffer[i];
+	fprintf( f, "P6\n%d %d\n255\n", s->width, s->height );
+	const bool ok = fwrite( rgb.data(), 1, rgb.size(), f ) == rgb.size();
+	fclose( f );
+	return ok;
+}
+
+int main( int argc, char** argv )
+{
+	int frames = 600, every = 1;
+	float dt = 1000.0f / 60.0f;
+	const char* input = 0, * dump = 0, * assets = TMPL8_ASSETS, * trace = 0, * capture = 0;
+	bool async = false;
+	if (argc > 1 && !strcmp( argv[1], "-bench" )) return RunBenchmarks( argc - 2, argv + 2 );
+	for (int i = 1; i < argc; i++)
+	{
+		const bool arg = i + 1 < argc;
+		if (!strcmp( argv[i], "-frames" ) && arg) frames = atoi( argv[++i] );
+		else if (!strcmp( argv[i], "-dt" ) && arg) dt = (float)atof( argv[++i] );
+		else if (!strcmp( argv[i], "-input" ) && arg) input = argv[++i];
+		else if (!strcmp( argv[i], "-dump" ) && arg) dump = argv[++i];
+		else if (!strcmp( argv[i], "-every" ) && arg) every = max( 1, atoi( argv[++i] ) );
+		else if (!strcmp( argv[i], "-assets" ) && arg) assets = argv[++i];
+		else if (!strcmp( argv[i], "-trace" ) && arg) trace = argv[++i];
+		else if (!strcmp( argv[i], "-async" )) async = true;
+		else if (!strcmp( argv[i], "-capture" ) && arg) capture = argv[++i];
+		else
+		{
+			fprintf( stderr, "usage: %s [-frames n] [-dt ms] [-input file] [-dump prefix] [-every n] "
+				"[-assets dir] [-trace file.json] [-async] [-capture dir]\n", argv[0] );
+			return 2;
+		}
+	}
+	vector<InputEvent> events;
+	if (input && !LoadInput( input, events )) { fprintf( stderr, "can't read %s\n", input ); return 2; }
+	// paths in the input options stay relative to the start folder
+	char start[1024];
+	if (!getcwd( start, sizeof( start ) )) start[0] = 0;
+	string dumpPath = dump ? (dump[0] == '/' ? string( dump ) : string( start ) + "/" + dump) : "";
+	string tracePath = trace ? (trace[0] == '/' ? string( trace ) : string( start ) + "/" + trace) : "";
+	if (capture) game.capture.folder = capture[0] == '/' ? string( capture ) : string( start ) + "/" + capture;
+	if (chdir( assets ) != 0) fprintf( stderr, "can't open asset folder %s\n", assets );
+	// application initialization
+	TemplateInit();
+	game.SetScreenSize( nativeWidth, nativeHeight );
+	game.Init();
+	if (capture) game.capture.Start( every );
+	// application loop
+	const uint rate = game.loud.getBackendSamplerate(), channels = game.loud.getBackendChannels();
+	vector<float> mixBuffer( 512 * channels );
+	vector<float> frameTime( frames );
+	double samples = 0;
+	size_t next = 0;
+	int dumped = 0;
+	Timer total;
+	for (int frame = 0; frame < frames && !error; frame++)
+	{
+		Timer timer;
+		for (; next < events.size() && events[next].frame <= frame; next++)
+		{
+			const InputEvent& e = events[next];
+			if (e.type == PENPOS) game.PenPos( e.x, e.y );
+			else if (e.type == PENDOWN) game.PenDown(); else game.PenUp();
+		}
+		if (!async) game.loader->WaitAll();
+		deltaTime = dt;
+		GameTick();
+		PostTick();
+		// mix the audio for this frame, in blocks that fit the driver buffer
+		samples += rate * dt * 0.001;
+		for (uint todo = (uint)samples; todo > 0;)
+		{
+			const uint n = min( todo, 512u );
+			game.loud.mix( mixBuffer.data(), n );
+			todo -= n, samples -= n;
+		}
+		if (dump && frame % every == 0)
+		{
+			if (DumpFrame( dumpPath.c_str(), frame, game.screen )) dumped++;
+			else FatalError( "can't write frame dump" );
+		}
+		frameTime[frame] = 1000.0f * timer.elapsed();
+		GameLoop::FrameDone( frameTime[frame] );
+		Profiler::FrameDone( frameTime[frame] );
+	}
+	const float elapsed = 1000.0f * total.elapsed();
+	game.Shutdown();
+	game.capture.Close();
+	if (trace && !Profiler::ExportChromeTrace( tracePath.c_str() )) fprintf( stderr, "can't write %s\n", trace );
+	// report; frame times include the frame dumps
+	if (error) return 1;
+	sort( frameTime.begin(), frameTime.end() );
+	if (frames > 0) printf( "%d frames, %.3fms total; per frame: avg %.3fms, median %.3fms, p95 %.3fms, max %.3fms; %d dumped\n",
+		frames, elapsed, elapsed / frames, frameTime[frames / 2], frameTime[(frames * 95) / 100], frameTime[frames - 1], dumped );
+	if (capture) printf( "capture: %u frames, %u dropped, %u written, %u failed; encode %.3fms\n", game.capture.Captured(),
+		game.capture.Dropped(), game.capture.Written(), game.capture.Failed(), game.capture.EncodeTime() );
+	return 0;
+}
+
 #else
 
 // android file access
@@ -408,6 +877,11 @@ void android_fopen_set_asset_manager( AAssetManager* manager )
 	android_asset_manager = manager;
 }
 
+AAssetManager* android_get_asset_manager()
+{
+	return android_asset_manager;
+}
+
 FILE* android_fopen( const char* fname, const char* mode )
 {
 	if (mode[0] == 'w') return NULL;
@@ -416,6 +890,14 @@ FILE* android_fopen( const char* fname, const char* mode )
 	return funopen( asset, android_read, android_write, android_seek, android_close );
 }
 
+// timing readout
+
+void ShowUploadTime()
+{
+	__android_log_print( ANDROID_LOG_INFO, "Tmpl8", "upload: %.3fms (%s), %uKB, %u frames skipped, post: %s %.2fms", uploadTime, usePBO && pboAvailable ? "pbo" : "glTexImage2D",
+		uploadedBytes >> 10, skippedFrames, PostProcess::Name( PostProcess::Active() ), PostProcess::GpuTime() );
+}
+
 // engine
 
 struct saved_state { int32_t x; int32_t y; };
@@ -434,8 +916,8 @@ static struct android_app* theApp = 0; // for global access in this file
 
 static void engine_init_display( struct engine* engine )
 {
-	const EGLint attribs[] = { // from endless tunnel
-		EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT, // request OpenGL ES 2.0
+	EGLint attribs[] = { // from endless tunnel
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_ES3_BIT_KHR, // request OpenGL ES 3.0, for pixel unpack buffers
 		EGL_SURFACE_TYPE, EGL_WINDOW_BIT,
 		EGL_BLUE_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_RED_SIZE, 8,
 		EGL_DEPTH_SIZE, 16, EGL_NONE
@@ -447,10 +929,17 @@ static void engine_init_display( struct engine* engine )
 	EGLDisplay display = eglGetDisplay( EGL_DEFAULT_DISPLAY );
 	eglInitialize( display, 0, 0 );
 	eglChooseConfig( display, attribs, &config, 1, &numConfigs );
+	EGLint version = 3;
+	if (numConfigs == 0)
+	{
+		// fall back to OpenGL ES 2.0; screen uploads will use glTexImage2D
+		attribs[1] = EGL_OPENGL_ES2_BIT, version = 2, pboAvailable = false;
+		eglChooseConfig( display, attribs, &config, 1, &numConfigs );
+	}
 	eglGetConfigAttrib( display, config, EGL_NATIVE_VISUAL_ID, &format );
 	ANativeWindow_setBuffersGeometry( engine->app->window, 0, 0, format );
 	surface = eglCreateWindowSurface( display, config, engine->app->window, NULL );
-	EGLint attribList[] = { EGL_CONTEXT_CLIENT_VERSION, 2, EGL_NONE }; // OpenGL 2.0
+	EGLint attribList[] = { EGL_CONTEXT_CLIENT_VERSION, version, EGL_NONE };
 	context = eglCreateContext( display, config, NULL, attribList );
 	eglMakeCurrent( display, surface, surface, context );
 	eglQuerySurface( display, surface, EGL_WIDTH, &w );
@@ -467,9 +956,15 @@ static void engine_init_display( struct engine* engine )
 static void engine_draw_frame( struct engine* engine )
 {
 	if (engine->display == NULL) return;
-	game.Tick( 0 /* for now */ );
-	PostTick();
-	eglSwapBuffers( engine->display, engine->surface );
+	GameTick();
+	// an unchanged frame is not drawn or swapped; FrameDone waits a frame period instead
+	const bool presented = PostTick();
+	if (presented)
+	{
+		PROFILE_ZONE( "Swap" );
+		eglSwapBuffers( engine->display, engine->surface );
+	}
+	FrameDone( presented );
 }
 
 void engine_retrace()
@@ -518,6 +1013,7 @@ static int32_t engine_handle_input( struct android_app* app, AInputEvent* event
 
 static JNIEnv* jniEnv = 0;
 static android_app* androidApp;
+static float refreshRate = 60; // of the default display, read once in android_main
 char* dcimdir_int = new char[2048]; // to be queried as external
 char* localdir = 0;
 
@@ -577,6 +1073,27 @@ static JNIEnv* GetJniEnv()
 	return jniEnv;
 }
 
+static float GetRefreshRate( JNIEnv* env, android_app* app )
+{
+	// activity.getWindowManager().getDefaultDisplay().getRefreshRate()
+	jclass ac = env->FindClass( "android/app/NativeActivity" );
+	jclass wc = env->FindClass( "android/view/WindowManager" );
+	jclass dc = env->FindClass( "android/view/Display" );
+	jmethodID getWindowManager = env->GetMethodID( ac, "getWindowManager", "()Landroid/view/WindowManager;" );
+	jmethodID getDefaultDisplay = env->GetMethodID( wc, "getDefaultDisplay", "()Landroid/view/Display;" );
+	jmethodID getRefreshRate = env->GetMethodID( dc, "getRefreshRate", "()F" );
+	jobject windowManager = env->CallObjectMethod( app->activity->clazz, getWindowManager );
+	jobject display = env->CallObjectMethod( windowManager, getDefaultDisplay );
+	const float rate = env->CallFloatMethod( display, getRefreshRate );
+	// android_main is a native thread that never returns to Java: release the local refs
+	env->DeleteLocalRef( display );
+	env->DeleteLocalRef( windowManager );
+	env->DeleteLocalRef( dc );
+	env->DeleteLocalRef( wc );
+	env->DeleteLocalRef( ac );
+	return rate;
+}
+
 static void engine_handle_cmd( struct android_app* app, int32_t cmd )
 {
 	struct engine* engine = (struct engine*)app->userData;
@@ -589,6 +1106,7 @@ static void engine_handle_cmd( struct android_app* app, int32_t cmd )
 		if (engine->app->window != NULL)
 		{
 			engine_init_display( engine );
+			engine_swapinterval( GameLoop::SwapInterval( refreshRate ) );
 			TemplateInit();
 			game.Init();
 			engine_draw_frame( engine );
@@ -609,6 +1127,7 @@ static void engine_handle_cmd( struct android_app* app, int32_t cmd )
 		break;
 	case APP_CMD_PAUSE:
 		engine->animating = 0;
+		game.capture.Flush(); // the app may be killed while paused
 		break;
 	case APP_CMD_RESUME:
 		androidApp->activity->vm->AttachCurrentThread( &jniEnv, NULL );
@@ -633,6 +1152,7 @@ static void GetDCIMPath( JNIEnv* env, android_app* app, const char* param, char*
 	strcpy( dst, extStoragePathString );
 	env->ReleaseStringUTFChars( extStoragePath, extStoragePathString );
 	app->activity->vm->DetachCurrentThread();
+	jniEnv = 0; // no longer valid; GetJniEnv attaches again
 }
 
 void android_main( struct android_app* state )
@@ -641,6 +1161,7 @@ void android_main( struct android_app* state )
 	android_fopen_set_asset_manager( state->activity->assetManager );
 	androidApp = state;
 	SetImmersiveMode( GetJniEnv(), state );
+	refreshRate = GetRefreshRate( GetJniEnv(), state ); // while attached; GetDCIMPath detaches
 	GetDCIMPath( GetJniEnv(), state, "DIRECTORY_DCIM", dcimdir_int );
 	localdir = new char[strlen( state->activity->internalDataPath ) + 1];
 	strcpy( localdir, state->activity->internalDataPath );
@@ -650,6 +1171,8 @@ void android_main( struct android_app* state )
 	state->onAppCmd = engine_handle_cmd;
 	state->onInputEvent = engine_handle_input;
 	engine.app = state;
+	game.snapshot.baseFile = string( localdir ) + "/state.bin";
+	game.capture.folder = dcimdir_int, game.capture.fallback = localdir;
 	if (state->savedState != NULL) game.RestoreState( state->savedState, state->savedStateSize );
 	engine.animating = 1;
 	while (1)
@@ -663,6 +1186,7 @@ void android_main( struct android_app* state )
 			if (state->destroyRequested != 0)
 			{
 				game.Shutdown();
+				game.capture.Close();
 				engine_term_display( &engine );
 				return;
 			}
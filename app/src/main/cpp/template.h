@@ -2,11 +2,23 @@
 #define _TEMPLATE_H
 
 #include <errno.h>
+#include <limits.h>
 #include <string>
 #include <vector>
+#include <deque>
+#include <unordered_map>
+#include <algorithm>
+#include <queue>
+#include <memory>
+#include <functional>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include <malloc.h>
 #include <iostream>
 #include <fstream>
+#include <chrono>
 
 #ifdef _WIN64
 
@@ -25,19 +37,37 @@
 #define MALLOC64(x) _aligned_malloc(x,64)
 #define FREE64(x) _aligned_free(x)
 
+#elif defined( TMPL8_HEADLESS )
+
+// headless Linux build: no window, OpenGL or audio device, see template.cpp
+#include <unistd.h>
+#include <math.h>
+#include <string.h>
+
+typedef unsigned int GLuint;
+
+#ifndef TMPL8_ASSETS
+#define TMPL8_ASSETS "../app/src/main/assets" // set by the CMake build
+#endif
+
+#define MALLOC64(x) aligned_alloc(64,x)
+#define FREE64(x) free(x)
+
 #else
 
 #include <jni.h>
 #include <unistd.h>
 #include <sys/resource.h>
 #include <EGL/egl.h>
+#include <EGL/eglext.h>
 #include <GLES/gl.h>
-#include <GLES2/gl2.h>
+#include <GLES3/gl3.h>
 #include <android/sensor.h>
 #include <android/log.h>
 #include "android_native_app_glue.h"
 
 void android_fopen_set_asset_manager( AAssetManager* manager );
+AAssetManager* android_get_asset_manager();
 
 #define MALLOC64(x) aligned_alloc(x,64)
 #define FREE64(x) aligned_free(x)
@@ -48,16 +78,51 @@ using namespace std;
 
 typedef unsigned char uchar;
 typedef unsigned int uint;
+typedef unsigned short ushort;
 typedef unsigned int Pixel;
 
+// SIMD: vec3, vec4 and mat4 keep their floats in 128-bit registers where the target has them
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define TMPL8_SIMD
+typedef __m128 quad;
+inline quad qadd( const quad a, const quad b ) { return _mm_add_ps( a, b ); }
+inline quad qsub( const quad a, const quad b ) { return _mm_sub_ps( a, b ); }
+inline quad qmul( const quad a, const quad b ) { return _mm_mul_ps( a, b ); }
+inline quad qset( const float v ) { return _mm_set1_ps( v ); }
+inline quad qdiv( const quad a, const quad b ) { return _mm_div_ps( a, b ); }
+inline quad qload( const float* p ) { return _mm_loadu_ps( p ); }
+inline void qstore( float* p, const quad a ) { _mm_storeu_ps( p, a ); }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define TMPL8_SIMD
+typedef float32x4_t quad;
+inline quad qadd( const quad a, const quad b ) { return vaddq_f32( a, b ); }
+inline quad qsub( const quad a, const quad b ) { return vsubq_f32( a, b ); }
+inline quad qmul( const quad a, const quad b ) { return vmulq_f32( a, b ); }
+inline quad qset( const float v ) { return vdupq_n_f32( v ); }
+#ifdef __aarch64__
+inline quad qdiv( const quad a, const quad b ) { return vdivq_f32( a, b ); }
+#else
+inline quad qdiv( const quad a, const quad b ) // ARMv7 has no vector divide: refined reciprocal estimate
+{
+	quad r = vrecpeq_f32( b );
+	r = vmulq_f32( r, vrecpsq_f32( b, r ) ), r = vmulq_f32( r, vrecpsq_f32( b, r ) );
+	return vmulq_f32( a, r );
+}
+#endif
+inline quad qload( const float* p ) { return vld1q_f32( p ); }
+inline void qstore( float* p, const quad a ) { vst1q_f32( p, a ); }
+#endif
+
 // vectors
 class vec2 // adapted from https://github.com/dcow/RayTracer
 {
 public:
 	union { struct { float x, y; }; float cell[2]; };
 	vec2() = default;
-	vec2( float v ) : x( v ), y( v ) {}
-	vec2( float x, float y ) : x( x ), y( y ) {}
+	constexpr vec2( float v ) : x( v ), y( v ) {}
+	constexpr vec2( float x, float y ) : x( x ), y( y ) {}
 	vec2 operator - () const { return vec2( -x, -y ); }
 	vec2 operator + ( const vec2& addOperand ) const { return vec2( x + addOperand.x, y + addOperand.y ); }
 	vec2 operator - ( const vec2& operand ) const { return vec2( x - operand.x, y - operand.y ); }
@@ -79,11 +144,28 @@ public:
 class vec3
 {
 public:
-	union { struct { float x, y, z, dummy; }; float cell[4]; };
+	union
+	{
+		struct { float x, y, z, dummy; };
+		float cell[4];
+#ifdef TMPL8_SIMD
+		quad m4;
+#endif
+	};
 	vec3() = default;
-	vec3( float v ) : x( v ), y( v ), z( v ) {}
-	vec3( float x, float y, float z ) : x( x ), y( y ), z( z ) {}
+	constexpr vec3( float v ) : x( v ), y( v ), z( v ), dummy( 0 ) {}
+	constexpr vec3( float x, float y, float z ) : x( x ), y( y ), z( z ), dummy( 0 ) {}
 	vec3 operator - () const { return vec3( -x, -y, -z ); }
+#ifdef TMPL8_SIMD
+	vec3( const quad a ) : m4( a ) {}
+	vec3 operator + ( const vec3& addOperand ) const { return vec3( qadd( m4, addOperand.m4 ) ); }
+	vec3 operator - ( const vec3& operand ) const { return vec3( qsub( m4, operand.m4 ) ); }
+	vec3 operator * ( const vec3& operand ) const { return vec3( qmul( m4, operand.m4 ) ); }
+	void operator -= ( const vec3& a ) { m4 = qsub( m4, a.m4 ); }
+	void operator += ( const vec3& a ) { m4 = qadd( m4, a.m4 ); }
+	void operator *= ( const vec3& a ) { m4 = qmul( m4, a.m4 ); }
+	void operator *= ( const float a ) { m4 = qmul( m4, qset( a ) ); }
+#else
 	vec3 operator + ( const vec3& addOperand ) const { return vec3( x + addOperand.x, y + addOperand.y, z + addOperand.z ); }
 	vec3 operator - ( const vec3& operand ) const { return vec3( x - operand.x, y - operand.y, z - operand.z ); }
 	vec3 operator * ( const vec3& operand ) const { return vec3( x * operand.x, y * operand.y, z * operand.z ); }
@@ -91,6 +173,7 @@ public:
 	void operator += ( const vec3& a ) { x += a.x; y += a.y; z += a.z; }
 	void operator *= ( const vec3& a ) { x *= a.x; y *= a.y; z *= a.z; }
 	void operator *= ( const float a ) { x *= a; y *= a; z *= a; }
+#endif
 	float operator [] ( const uint& idx ) const { return cell[idx]; }
 	float& operator [] ( const uint& idx ) { return cell[idx]; }
 	float length() const { return sqrtf( x * x + y * y + z * z ); }
@@ -108,12 +191,29 @@ public:
 class vec4
 {
 public:
-	union { struct { float x, y, z, w; }; struct { vec3 xyz; float w2; }; float cell[4]; };
+	union
+	{
+		struct { float x, y, z, w; };
+		float cell[4];
+#ifdef TMPL8_SIMD
+		quad m4;
+#endif
+	};
 	vec4() = default;
-	vec4( float v ) : x( v ), y( v ), z( v ), w( v ) {}
-	vec4( float x, float y, float z, float w ) : x( x ), y( y ), z( z ), w( w ) {}
-	vec4( vec3 a, float b ) : x( a.x ), y( a.y ), z( a.z ), w( b ) {}
+	constexpr vec4( float v ) : x( v ), y( v ), z( v ), w( v ) {}
+	constexpr vec4( float x, float y, float z, float w ) : x( x ), y( y ), z( z ), w( w ) {}
+	constexpr vec4( vec3 a, float b ) : x( a.x ), y( a.y ), z( a.z ), w( b ) {}
 	vec4 operator - () const { return vec4( -x, -y, -z, -w ); }
+#ifdef TMPL8_SIMD
+	vec4( const quad a ) : m4( a ) {}
+	vec4 operator + ( const vec4& addOperand ) const { return vec4( qadd( m4, addOperand.m4 ) ); }
+	vec4 operator - ( const vec4& operand ) const { return vec4( qsub( m4, operand.m4 ) ); }
+	vec4 operator * ( const vec4& operand ) const { return vec4( qmul( m4, operand.m4 ) ); }
+	void operator -= ( const vec4& a ) { m4 = qsub( m4, a.m4 ); }
+	void operator += ( const vec4& a ) { m4 = qadd( m4, a.m4 ); }
+	void operator *= ( const vec4& a ) { m4 = qmul( m4, a.m4 ); }
+	void operator *= ( float a ) { m4 = qmul( m4, qset( a ) ); }
+#else
 	vec4 operator + ( const vec4& addOperand ) const { return vec4( x + addOperand.x, y + addOperand.y, z + addOperand.z, w + addOperand.w ); }
 	vec4 operator - ( const vec4& operand ) const { return vec4( x - operand.x, y - operand.y, z - operand.z, w - operand.w ); }
 	vec4 operator * ( const vec4& operand ) const { return vec4( x * operand.x, y * operand.y, z * operand.z, w * operand.w ); }
@@ -121,6 +221,7 @@ public:
 	void operator += ( const vec4& a ) { x += a.x; y += a.y; z += a.z; w += a.w; }
 	void operator *= ( const vec4& a ) { x *= a.x; y *= a.y; z *= a.z; w *= a.w; }
 	void operator *= ( float a ) { x *= a; y *= a; z *= a; w *= a; }
+#endif
 	float& operator [] ( const int idx ) { return cell[idx]; }
 	float operator [] ( const uint& idx ) const { return cell[idx]; }
 	float length() { return sqrtf( x * x + y * y + z * z + w * w ); }
@@ -131,21 +232,28 @@ public:
 	float dot( const vec4& operand ) const { return x * operand.x + y * operand.y + z * operand.z + w * operand.w; }
 };
 
-vec3 normalize( const vec3& v );
-vec3 cross( const vec3& a, const vec3& b );
-float dot( const vec3& a, const vec3& b );
-vec3 operator * ( const float& s, const vec3& v );
-vec3 operator * ( const vec3& v, const float& s );
-vec4 operator * ( const float& s, const vec4& v );
-vec4 operator * ( const vec4& v, const float& s );
+inline vec3 normalize( const vec3& v ) { return v.normalized(); }
+inline vec3 cross( const vec3& a, const vec3& b ) { return a.cross( b ); }
+inline float dot( const vec3& a, const vec3& b ) { return a.dot( b ); }
+#ifdef TMPL8_SIMD
+inline vec3 operator * ( const float& s, const vec3& v ) { return vec3( qmul( qset( s ), v.m4 ) ); }
+inline vec3 operator * ( const vec3& v, const float& s ) { return vec3( qmul( v.m4, qset( s ) ) ); }
+inline vec4 operator * ( const float& s, const vec4& v ) { return vec4( qmul( qset( s ), v.m4 ) ); }
+inline vec4 operator * ( const vec4& v, const float& s ) { return vec4( qmul( v.m4, qset( s ) ) ); }
+#else
+inline vec3 operator * ( const float& s, const vec3& v ) { return vec3( s * v.x, s * v.y, s * v.z ); }
+inline vec3 operator * ( const vec3& v, const float& s ) { return vec3( v.x * s, v.y * s, v.z * s ); }
+inline vec4 operator * ( const float& s, const vec4& v ) { return vec4( s * v.x, s * v.y, s * v.z, s * v.w ); }
+inline vec4 operator * ( const vec4& v, const float& s ) { return vec4( v.x * s, v.y * s, v.z * s, v.w * s ); }
+#endif
 
 class uint4
 {
 public:
 	union { struct { uint x, y, z, w; }; uint cell[4]; };
 	uint4() = default;
-	uint4( int v ) : x( v ), y( v ), z( v ), w( v ) {}
-	uint4( int x, int y, int z, int w ) : x( x ), y( y ), z( z ), w( w ) {}
+	constexpr uint4( int v ) : x( v ), y( v ), z( v ), w( v ) {}
+	constexpr uint4( int x, int y, int z, int w ) : x( x ), y( y ), z( z ), w( w ) {}
 	uint4 operator + ( const uint4& addOperand ) const { return uint4( x + addOperand.x, y + addOperand.y, z + addOperand.z, w + addOperand.w ); }
 	uint4 operator - ( const uint4& operand ) const { return uint4( x - operand.x, y - operand.y, z - operand.z, w - operand.w ); }
 	uint4 operator * ( const uint4& operand ) const { return uint4( x * operand.x, y * operand.y, z * operand.z, w * operand.w ); }
@@ -162,8 +270,8 @@ class int4
 public:
 	union { struct { int x, y, z, w; }; int cell[4]; };
 	int4() = default;
-	int4( int v ) : x( v ), y( v ), z( v ), w( v ) {}
-	int4( int x, int y, int z, int w ) : x( x ), y( y ), z( z ), w( w ) {}
+	constexpr int4( int v ) : x( v ), y( v ), z( v ), w( v ) {}
+	constexpr int4( int x, int y, int z, int w ) : x( x ), y( y ), z( z ), w( w ) {}
 	int4 operator - () const { return int4( -x, -y, -z, -w ); }
 	int4 operator + ( const int4& addOperand ) const { return int4( x + addOperand.x, y + addOperand.y, z + addOperand.z, w + addOperand.w ); }
 	int4 operator - ( const int4& operand ) const { return int4( x - operand.x, y - operand.y, z - operand.z, w - operand.w ); }
@@ -176,78 +284,78 @@ public:
 	int& operator [] ( const int idx ) { return cell[idx]; }
 };
 
+// 4x4 matrix, row major: cell[3], cell[7] and cell[11] hold the translation, and vectors are
+// transformed as columns, i.e. M * v, which operator * ( vec4, mat4 ) computes for one vector
 class mat4
 {
 public:
-	mat4() { memset( cell, 0, 64 ); cell[0] = cell[5] = cell[10] = cell[15] = 1; }
+	constexpr mat4() : cell{ 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 } {}
+#ifdef TMPL8_SIMD
+	union { float cell[16]; quad row[4]; };
+#else
 	float cell[16];
+#endif
 	float& operator [] ( const int idx ) { return cell[idx]; }
-	static mat4 identity() { mat4 r; memset( r.cell, 0, 64 ); r.cell[0] = r.cell[5] = r.cell[10] = r.cell[15] = 1.0f; return r; }
+	static mat4 identity() { return mat4(); }
 	static mat4 rotate( vec3 v, float a );
 	static mat4 rotatex( const float a );
 	static mat4 rotatey( const float a );
 	static mat4 rotatez( const float a );
-	void invert()
-	{
-		// from MESA, via http://stackoverflow.com/questions/1148309/inverting-a-4x4-matrix
-		const float inv[16] = {
-			 cell[5]  * cell[10] * cell[15] - cell[5]  * cell[11] * cell[14] - cell[9]  * cell[6]  * cell[15] +
-			 cell[9]  * cell[7]  * cell[14] + cell[13] * cell[6]  * cell[11] - cell[13] * cell[7]  * cell[10],
-			-cell[1]  * cell[10] * cell[15] + cell[1]  * cell[11] * cell[14] + cell[9]  * cell[2]  * cell[15] -
-			 cell[9]  * cell[3]  * cell[14] - cell[13] * cell[2]  * cell[11] + cell[13] * cell[3]  * cell[10],
-			 cell[1]  * cell[6]  * cell[15] - cell[1]  * cell[7]  * cell[14] - cell[5]  * cell[2]  * cell[15] +
-			 cell[5]  * cell[3]  * cell[14] + cell[13] * cell[2]  * cell[7]  - cell[13] * cell[3]  * cell[6],
-			-cell[1]  * cell[6]  * cell[11] + cell[1]  * cell[7]  * cell[10] + cell[5]  * cell[2]  * cell[11] -
-			 cell[5]  * cell[3]  * cell[10] - cell[9]  * cell[2]  * cell[7]  + cell[9]  * cell[3]  * cell[6],
-			-cell[4]  * cell[10] * cell[15] + cell[4]  * cell[11] * cell[14] + cell[8]  * cell[6]  * cell[15] -
-			 cell[8]  * cell[7]  * cell[14] - cell[12] * cell[6]  * cell[11] + cell[12] * cell[7]  * cell[10],
-			 cell[0]  * cell[10] * cell[15] - cell[0]  * cell[11] * cell[14] - cell[8]  * cell[2]  * cell[15] +
-			 cell[8]  * cell[3]  * cell[14] + cell[12] * cell[2]  * cell[11] - cell[12] * cell[3]  * cell[10],
-			-cell[0]  * cell[6]  * cell[15] + cell[0]  * cell[7]  * cell[14] + cell[4]  * cell[2]  * cell[15] -
-			 cell[4]  * cell[3]  * cell[14] - cell[12] * cell[2]  * cell[7]  + cell[12] * cell[3]  * cell[6],
-			 cell[0]  * cell[6]  * cell[11] - cell[0]  * cell[7]  * cell[10] - cell[4]  * cell[2]  * cell[11] +
-			 cell[4]  * cell[3]  * cell[10] + cell[8]  * cell[2]  * cell[7]  - cell[8]  * cell[3]  * cell[6],
-			 cell[4]  * cell[9]  * cell[15] - cell[4]  * cell[11] * cell[13] - cell[8]  * cell[5]  * cell[15] +
-			 cell[8]  * cell[7]  * cell[13] + cell[12] * cell[5]  * cell[11] - cell[12] * cell[7]  * cell[9],
-			-cell[0]  * cell[9]  * cell[15] + cell[0]  * cell[11] * cell[13] + cell[8]  * cell[1]  * cell[15] -
-			 cell[8]  * cell[3]  * cell[13] - cell[12] * cell[1]  * cell[11] + cell[12] * cell[3]  * cell[9],
-			 cell[0]  * cell[5]  * cell[15] - cell[0]  * cell[7]  * cell[13] - cell[4]  * cell[1]  * cell[15] +
-			 cell[4]  * cell[3]  * cell[13] + cell[12] * cell[1]  * cell[7]  - cell[12] * cell[3]  * cell[5],
-			-cell[0]  * cell[5]  * cell[11] + cell[0]  * cell[7]  * cell[9]  + cell[4]  * cell[1]  * cell[11] -
-			 cell[4]  * cell[3]  * cell[9]  - cell[8]  * cell[1]  * cell[7]  + cell[8]  * cell[3]  * cell[5],
-			-cell[4]  * cell[9]  * cell[14] + cell[4]  * cell[10] * cell[13] + cell[8]  * cell[5]  * cell[14] -
-			 cell[8]  * cell[6]  * cell[13] - cell[12] * cell[5]  * cell[10] + cell[12] * cell[6]  * cell[9],
-			 cell[0]  * cell[9]  * cell[14] - cell[0]  * cell[10] * cell[13] - cell[8]  * cell[1]  * cell[14] +
-			 cell[8]  * cell[2]  * cell[13] + cell[12] * cell[1]  * cell[10] - cell[12] * cell[2]  * cell[9],
-			-cell[0]  * cell[5]  * cell[14] + cell[0]  * cell[6]  * cell[13] + cell[4]  * cell[1]  * cell[14] -
-			 cell[4]  * cell[2]  * cell[13] - cell[12] * cell[1]  * cell[6]  + cell[12] * cell[2]  * cell[5],
-			 cell[0]  * cell[5]  * cell[10] - cell[0]  * cell[6]  * cell[9]  - cell[4]  * cell[1]  * cell[10] +
-			 cell[4]  * cell[2]  * cell[9]  + cell[8]  * cell[1]  * cell[6]  - cell[8]  * cell[2]  * cell[5]
-		};
-		const float det = cell[0] * inv[0] + cell[1] * inv[4] + cell[2] * inv[8] + cell[3] * inv[12];
-		if (det != 0)
-		{
-			const float invdet = 1.0f / det;
-			for (int i = 0; i < 16; i++) cell[i] = inv[i] * invdet;
-		}
-	}
+	static mat4 translate( const vec3 t ) { mat4 r; r.cell[3] = t.x, r.cell[7] = t.y, r.cell[11] = t.z; return r; }
+	static mat4 scale( const float s ) { mat4 r; r.cell[0] = r.cell[5] = r.cell[10] = s; return r; }
+	void invert(); // leaves singular matrices unchanged
 };
 
-vec4 operator * ( const vec4& v, const mat4& M );
+inline vec4 operator * ( const vec4& v, const mat4& M )
+{
+	const float* m = M.cell;
+	return vec4( v.x * m[0] + v.y * m[1] + v.z * m[2] + v.w * m[3], v.x * m[4] + v.y * m[5] + v.z * m[6] + v.w * m[7],
+		v.x * m[8] + v.y * m[9] + v.z * m[10] + v.w * m[11], v.x * m[12] + v.y * m[13] + v.z * m[14] + v.w * m[15] );
+}
+mat4 operator * ( const mat4& a, const mat4& b );
+
+// batched transforms, for many points and one matrix. Points are given as separate x, y and
+// z arrays (structure of arrays) with an implicit w = 1, and are processed four at a time.
+// Outputs may alias the inputs. TransformPoints ignores the bottom row of M (affine);
+// ProjectPoints applies the full matrix and divides by w, e.g. to get screen coordinates.
+void TransformPoints( const mat4& M, const float* x, const float* y, const float* z, float* ox, float* oy, float* oz, int n );
+void ProjectPoints( const mat4& M, const float* x, const float* y, const float* z, float* sx, float* sy, int n );
+void TransformVectors( const mat4& M, const vec4* v, vec4* out, int n ); // out[i] = v[i] * M
+
+// timer
+struct Timer
+{
+	Timer() { reset(); }
+	float elapsed() const { return chrono::duration<float>( chrono::high_resolution_clock::now() - start ).count(); } // in seconds
+	void reset() { start = chrono::high_resolution_clock::now(); }
+	chrono::high_resolution_clock::time_point start;
+};
 
 #define BADFLOAT(x) ((*(uint*)&x & 0x7f000000) == 0x7f000000)
 
 FILE* android_fopen( const char* fname, const char* mode );
 GLuint LoadShader();
-GLuint PostprocShader();
 void DrawQuad( float u1 = 0, float v1 = 0, float u2 = 1, float v2 = 1 );
 GLuint CreateTexture( uint* pixels, int w, int h );
 void SetMagFilter( GLuint id, uint flag );
 void loadBinaryFile( std::vector<unsigned char>& buffer, const std::string& filename );
 
-#include "surface.h"
 #include "soloud.h"
 #include "soloud_wav.h"
+#include "soloud_file.h"
+#include "asset.h"
+#include "pack.h"
+#include "surface.h"
+#include "jobs.h"
+#include "renderer.h"
+#include "spritebatch.h"
+#include "tilemap.h"
+#include "profiler.h"
+#include "gameloop.h"
+#include "snapshot.h"
+#include "postproc.h"
+#include "capture.h"
+#include "loader.h"
 
 using namespace SoLoud;
 
@@ -0,0 +1,163 @@
+#include "template.h"
+
+// -----------------------------------------------------------
+// Tile map
+// -----------------------------------------------------------
+
+Tilemap::Tilemap( Surface* tileset, int tileSize, int w, int h, int layers ) :
+	tileset( tileset ), tileSize( tileSize ), width( w ), height( h ), layers( layers )
+{
+	chunksX = (w + CHUNK - 1) / CHUNK, chunksY = (h + CHUNK - 1) / CHUNK;
+	columns = tileset->width / tileSize, tileCount = min( (int)EMPTY, columns * (tileset->height / tileSize) );
+	tiles.assign( (size_t)chunksX * chunksY * layers * CELLS, (ushort)EMPTY );
+	chunks.resize( chunksX * chunksY );
+	animation.resize( tileCount );
+	// classify the tiles in the set, so upper layers can copy or skip whole tiles
+	kind.resize( tileCount );
+	for (int t = 0; t < tileCount; t++)
+	{
+		const Pixel* s = tileset->buffer + (t % columns) * tileSize + (t / columns) * tileSize * tileset->width;
+		int set = 0;
+		for (int y = 0; y < tileSize; y++) for (int x = 0; x < tileSize; x++) set += (s[x + y * tileset->width] & 0xffffff) != 0;
+		kind[t] = set == tileSize * tileSize ? OPAQUE : set == 0 ? CLEAR : MIXED;
+	}
+}
+
+Tilemap::~Tilemap()
+{
+	for (Chunk& c : chunks) delete c.surface;
+}
+
+void Tilemap::Set( int layer, int tx, int ty, ushort tile )
+{
+	if (!Inside( layer, tx, ty )) return;
+	ushort& t = tiles[Index( layer, tx, ty )];
+	if (t == tile) return;
+	t = tile;
+	// mark the cell; past a quarter of the chunk, composite the whole chunk instead
+	Chunk& c = chunks[(ty / CHUNK) * chunksX + tx / CHUNK];
+	if (!c.valid) return;
+	if (c.changed.size() >= CELLS / 4) c.valid = false, c.changed.clear();
+	else c.changed.push_back( (ushort)((ty % CHUNK) * CHUNK + tx % CHUNK) );
+}
+
+void Tilemap::SetAnimation( ushort tile, int frames, int period )
+{
+	if (tile >= tileCount) return;
+	frames = min( frames, tileCount - tile );
+	animation[tile].frames = (ushort)max( 0, frames ), animation[tile].period = (ushort)max( 1, period );
+	animated.erase( remove( animated.begin(), animated.end(), tile ), animated.end() );
+	if (frames > 1) animated.push_back( tile );
+	Invalidate(); // the lists of animated cells change
+}
+
+void Tilemap::SetTime( uint ticks )
+{
+	// a new stamp only when some animation shows a different frame
+	for (ushort t : animated) if ((ticks / animation[t].period) % animation[t].frames != (time / animation[t].period) % animation[t].frames)
+	{
+		stamp++;
+		break;
+	}
+	time = ticks;
+}
+
+void Tilemap::Invalidate()
+{
+	for (Chunk& c : chunks) c.valid = false;
+}
+
+void Tilemap::ComposeCell( Chunk& c, const ushort* t, int cell )
+{
+	// t holds the tiles of the chunk; draw the layers of one cell, starting at the topmost opaque tile
+	const int pitch = CHUNK * tileSize, sw = tileset->width;
+	Pixel* d = c.surface->buffer + (cell % CHUNK) * tileSize + (cell / CHUNK) * tileSize * pitch;
+	int l = layers - 1;
+	for (; l > 0; l--) if (t[l * CELLS + cell] < tileCount && kind[Frame( t[l * CELLS + cell] )] == OPAQUE) break;
+	for (; l < layers; l++)
+	{
+		int tile = t[l * CELLS + cell];
+		if (tile >= tileCount)
+		{
+			if (l == 0) for (int y = 0; y < tileSize; y++) for (int x = 0; x < tileSize; x++) d[x + y * pitch] = background;
+			continue;
+		}
+		tile = Frame( tile );
+		const Pixel* s = tileset->buffer + (tile % columns) * tileSize + (tile / columns) * tileSize * sw;
+		if (l == 0 || kind[tile] == OPAQUE) for (int y = 0; y < tileSize; y++) memcpy( d + y * pitch, s + y * sw, tileSize * sizeof( Pixel ) );
+		else if (kind[tile] == MIXED) for (int y = 0; y < tileSize; y++) for (int x = 0; x < tileSize; x++)
+		{
+			const Pixel p = s[x + y * sw];
+			if (p & 0xffffff) d[x + y * pitch] = p;
+		}
+	}
+	composited++;
+}
+
+bool Tilemap::Animated( const ushort* t, int cell ) const
+{
+	for (int l = 0; l < layers; l++) if (t[l * CELLS + cell] < tileCount && animation[t[l * CELLS + cell]].frames > 1) return true;
+	return false;
+}
+
+void Tilemap::Prepare( int index, int capacity )
+{
+	// make sure the chunk has a surface that shows its current tiles
+	Chunk& c = chunks[index];
+	c.used = frame;
+	if (!c.surface)
+	{
+		// take the surface of the least recently drawn chunk once the cache is full
+		int victim = -1;
+		if ((int)cached.size() >= capacity) for (int i = 0; i < (int)cached.size(); i++)
+			if (chunks[cached[i]].used != frame && (victim < 0 || chunks[cached[i]].used < chunks[cached[victim]].used)) victim = i;
+		if (victim >= 0)
+		{
+			Chunk& old = chunks[cached[victim]];
+			swap( c.surface, old.surface ), old.valid = false, cached[victim] = index;
+		}
+		else c.surface = new Surface( CHUNK * tileSize, CHUNK * tileSize ), cached.push_back( index );
+		c.valid = false;
+	}
+	const ushort* t = tiles.data() + (size_t)index * layers * CELLS;
+	if (!c.valid)
+	{
+		c.animated.clear(), c.changed.clear();
+		for (int cell = 0; cell < CELLS; cell++)
+		{
+			ComposeCell( c, t, cell );
+			if (Animated( t, cell )) c.animated.push_back( (ushort)cell );
+		}
+		c.valid = true;
+		c.stamp = stamp;
+		return;
+	}
+	// changed cells may have become animated; cells that stopped animating stay listed, which is harmless
+	for (ushort cell : c.changed) if (Animated( t, cell ) && find( c.animated.begin(), c.animated.end(), cell ) == c.animated.end()) c.animated.push_back( cell );
+	if (c.stamp != stamp) for (ushort cell : c.animated) ComposeCell( c, t, cell );
+	for (ushort cell : c.changed) ComposeCell( c, t, cell );
+	c.changed.clear();
+	c.stamp = stamp;
+}
+
+void Tilemap::Draw( Surface* target, int scrollX, int scrollY )
+{
+	PROFILE_ZONE( "Tilemap" );
+	composited = 0, frame++;
+	// visible map pixels, in map space
+	const int cs = CHUNK * tileSize;
+	const int x1 = max( 0, scrollX ), y1 = max( 0, scrollY );
+	const int x2 = min( width * tileSize, scrollX + target->width ), y2 = min( height * tileSize, scrollY + target->height );
+	if (x1 >= x2 || y1 >= y2) return;
+	const int capacity = cacheSize > 0 ? cacheSize : ((target->width + cs - 1) / cs + 2) * ((target->height + cs - 1) / cs + 2);
+	for (int cy = y1 / cs; cy <= (y2 - 1) / cs; cy++) for (int cx = x1 / cs; cx <= (x2 - 1) / cs; cx++)
+	{
+		Prepare( cx + cy * chunksX, capacity );
+		// copy the visible part of the chunk
+		const int u1 = max( x1, cx * cs ), u2 = min( x2, (cx + 1) * cs ), v1 = max( y1, cy * cs ), v2 = min( y2, (cy + 1) * cs );
+		const Pixel* s = chunks[cx + cy * chunksX].surface->buffer + (u1 - cx * cs) + (v1 - cy * cs) * cs;
+		Pixel* d = target->buffer + (u1 - scrollX) + (v1 - scrollY) * target->width;
+		for (int v = v1; v < v2; v++, s += cs, d += target->width) memcpy( d, s, (u2 - u1) * sizeof( Pixel ) );
+	}
+	target->MarkDirty( x1 - scrollX, y1 - scrollY, x2 - scrollX, y2 - scrollY );
+}
@@ -0,0 +1,55 @@
+#ifndef _TILEMAP_H
+#define _TILEMAP_H
+
+// tile map: layers of tile indices into a tile set, a Surface with square tiles in rows.
+// Tiles are stored per chunk of CHUNK x CHUNK tiles, all layers of a chunk together, and each
+// visible chunk is composited once into a cached chunk surface. Draw copies the visible part
+// of each cached chunk to the target. Set marks the cell it changes, and the next Draw that
+// shows the chunk composites just the marked cells. Layer 0 is opaque, higher layers skip
+// black (0 rgb) pixels, like sprites. An animated tile shows a run of consecutive tiles from
+// the set; when its frame changes, only the cells that contain an animated tile are
+// composited again. Chunk surfaces are reused least recently drawn first.
+
+class Tilemap
+{
+public:
+	enum { CHUNK = 8, EMPTY = 0xffff };
+	Tilemap( Surface* tileset, int tileSize, int w, int h, int layers = 1 );
+	~Tilemap();
+	ushort Get( int layer, int tx, int ty ) const { return Inside( layer, tx, ty ) ? tiles[Index( layer, tx, ty )] : (ushort)EMPTY; }
+	void Set( int layer, int tx, int ty, ushort tile );
+	void SetAnimation( ushort tile, int frames, int period ); // tile shows tile .. tile + frames - 1, period ticks each
+	void SetTime( uint ticks );
+	void Invalidate(); // composite all chunks again, e.g. after changing the tile set or background
+	void Draw( Surface* target, int scrollX, int scrollY ); // map pixel (scrollX,scrollY) lands at the target origin
+	int Width() const { return width; }
+	int Height() const { return height; }
+	int Composited() const { return composited; } // tiles composited by the last Draw
+	int cacheSize = 0; // chunk surfaces to keep; 0 sizes the cache for the target
+	Pixel background = 0; // shown where layer 0 is EMPTY
+private:
+	enum { CELLS = CHUNK * CHUNK, MIXED = 0, OPAQUE, CLEAR };
+	struct Chunk { Surface* surface = 0; uint used = 0, stamp = 0; bool valid = false; vector<ushort> animated, changed; };
+	struct Animation { ushort frames = 0, period = 1; };
+	bool Inside( int layer, int tx, int ty ) const { return layer >= 0 && layer < layers && tx >= 0 && ty >= 0 && tx < width && ty < height; }
+	int Index( int layer, int tx, int ty ) const
+	{
+		return (((ty / CHUNK) * chunksX + tx / CHUNK) * layers + layer) * CELLS + (ty % CHUNK) * CHUNK + tx % CHUNK;
+	}
+	int Frame( int tile ) const { const Animation& a = animation[tile]; return a.frames ? tile + (time / a.period) % a.frames : tile; }
+	void Prepare( int index, int capacity );
+	void ComposeCell( Chunk& c, const ushort* t, int cell );
+	bool Animated( const ushort* t, int cell ) const;
+	Surface* tileset;
+	int tileSize, width, height, layers, chunksX, chunksY, columns, tileCount;
+	vector<ushort> tiles; // per chunk: layer 0 cells, layer 1 cells, ..
+	vector<uchar> kind; // per tile in the set: MIXED, OPAQUE or CLEAR
+	vector<Animation> animation; // per tile in the set
+	vector<ushort> animated; // tiles with an animation
+	vector<Chunk> chunks;
+	vector<int> cached; // chunks that hold a surface
+	uint time = 0, stamp = 0, frame = 0;
+	int composited = 0;
+};
+
+#endif // _TILEMAP_H
@@ -0,0 +1,134 @@
+// Asset packer: builds a pack for the template, see app/src/main/cpp/pack.h.
+// usage: packer [-lzma] [-store ext,ext,..] [-align n] <output.pak> <asset folder>
+// Files that are already compressed (png, jpg, ogg, mp3 by default) are stored, so the app
+// can use them in place; others are compressed with zlib, or LZMA with -lzma, when that
+// saves at least 10%. Names in the pack are relative to the asset folder, with '/'.
+// Build with CMake from this folder; on Android, copy the pack to app/src/main/assets.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include "zlib.h"
+#include "LzmaLib.h"
+
+using namespace std;
+typedef unsigned char uchar;
+typedef unsigned int uint;
+class Asset;
+#include "pack.h"
+
+struct Item { string name; Pack::Entry entry; vector<uchar> data; };
+
+static bool ReadFile( const filesystem::path& p, vector<uchar>& out )
+{
+	FILE* f = fopen( p.string().c_str(), "rb" );
+	if (!f) return false;
+	fseek( f, 0, SEEK_END );
+	out.resize( (size_t)ftell( f ) );
+	fseek( f, 0, SEEK_SET );
+	const bool ok = fread( out.data(), 1, out.size(), f ) == out.size();
+	fclose( f );
+	return ok;
+}
+
+static bool Compress( const vector<uchar>& src, vector<uchar>& dst, int method )
+{
+	if (method == Pack::ZLIB)
+	{
+		uLongf length = compressBound( (uLong)src.size() );
+		dst.resize( length );
+		if (compress2( dst.data(), &length, src.data(), (uLong)src.size(), 9 ) != Z_OK) return false;
+		dst.resize( length );
+		return true;
+	}
+	// LZMA: 5 property bytes, then the raw stream
+	size_t length = src.size() + src.size() / 3 + 128, props = LZMA_PROPS_SIZE;
+	dst.resize( Pack::LZMAPROPS + length );
+	if (LzmaCompress( dst.data() + Pack::LZMAPROPS, &length, src.data(), src.size(), dst.data(), &props, 9, 0, -1, -1, -1, -1, 1 ) != SZ_OK) return false;
+	dst.resize( Pack::LZMAPROPS + length );
+	return true;
+}
+
+int main( int argc, char** argv )
+{
+	int method = Pack::ZLIB;
+	uint alignment = 16;
+	string store = ",png,jpg,jpeg,ogg,mp3,flac,zip,pak,";
+	int arg = 1;
+	for (; arg < argc && argv[arg][0] == '-'; arg++)
+	{
+		if (!strcmp( argv[arg], "-lzma" )) method = Pack::LZMA;
+		else if (!strcmp( argv[arg], "-store" ) && arg + 1 < argc) store += string( argv[++arg] ) + ",";
+		else if (!strcmp( argv[arg], "-align" ) && arg + 1 < argc) alignment = max( 1, atoi( argv[++arg] ) );
+		else break;
+	}
+	if (argc - arg != 2 || (alignment & (alignment - 1)) || alignment > 4096)
+	{
+		printf( "usage: packer [-lzma] [-store ext,ext,..] [-align n] <output.pak> <asset folder>\n" );
+		printf( "alignment must be a power of two, up to 4096.\n" );
+		return 1;
+	}
+	const filesystem::path output = argv[arg], folder = argv[arg + 1];
+	vector<Item> items;
+	error_code ec;
+	for (auto& f : filesystem::recursive_directory_iterator( folder, ec ))
+	{
+		if (!f.is_regular_file()) continue;
+		string ext = f.path().extension().string();
+		transform( ext.begin(), ext.end(), ext.begin(), ::tolower );
+		if (ext == ".pak") continue; // never pack a previous pack
+		Item item;
+		item.name = filesystem::relative( f.path(), folder ).generic_string();
+		vector<uchar> raw;
+		if (!ReadFile( f.path(), raw )) { printf( "cannot read %s\n", item.name.c_str() ); return 1; }
+		Pack::Entry& e = item.entry;
+		e = {};
+		e.hash = Pack::Hash( item.name.c_str() );
+		e.size = (uint)raw.size(), e.method = Pack::STORE;
+		const bool stored = ext.empty() || store.find( "," + ext.substr( 1 ) + "," ) != string::npos;
+		if (!stored && Compress( raw, item.data, method ) && item.data.size() * 10 < raw.size() * 9) e.method = method;
+		else item.data.swap( raw );
+		e.packedSize = (uint)item.data.size();
+		items.push_back( move( item ) );
+	}
+	if (ec) { printf( "cannot read folder %s\n", folder.string().c_str() ); return 1; }
+	// index sorted by hash, then name; the runtime does a binary search on the hash
+	sort( items.begin(), items.end(), []( const Item& a, const Item& b ) {
+		return a.entry.hash != b.entry.hash ? a.entry.hash < b.entry.hash : a.name < b.name;
+	} );
+	string names;
+	for (Item& i : items) i.entry.name = (uint)names.size(), names += i.name, names += '\0';
+	Pack::Header header = {};
+	memcpy( header.magic, "TPAK", 4 );
+	header.version = Pack::VERSION, header.count = (uint)items.size();
+	header.namesSize = (uint)names.size(), header.alignment = alignment;
+	uint64_t offset = sizeof( header ) + items.size() * sizeof( Pack::Entry ) + names.size();
+	for (Item& i : items)
+	{
+		offset = (offset + alignment - 1) & ~(uint64_t)(alignment - 1);
+		i.entry.offset = offset, offset += i.data.size();
+	}
+	FILE* f = fopen( output.string().c_str(), "wb" );
+	if (!f) { printf( "cannot write %s\n", output.string().c_str() ); return 1; }
+	fwrite( &header, sizeof( header ), 1, f );
+	for (Item& i : items) fwrite( &i.entry, sizeof( Pack::Entry ), 1, f );
+	fwrite( names.data(), 1, names.size(), f );
+	uint64_t total = 0, packed = 0;
+	static const uchar zero[4096] = {};
+	for (Item& i : items)
+	{
+		const long pad = (long)(i.entry.offset - (uint64_t)ftell( f ));
+		fwrite( zero, 1, pad, f );
+		fwrite( i.data.data(), 1, i.data.size(), f );
+		total += i.entry.size, packed += i.entry.packedSize;
+		static const char* methodName[3] = { "store", "zlib", "lzma" };
+		printf( "%-40s %10u -> %10u %s\n", i.name.c_str(), i.entry.size, i.entry.packedSize, methodName[i.entry.method] );
+	}
+	fclose( f );
+	printf( "%u files, %llu -> %llu bytes\n", header.count, (unsigned long long)total, (unsigned long long)packed );
+	return 0;
+}